@@ -24,8 +24,20 @@ SOURCES += \
     element.cpp \
     elementlist.cpp \
     gauss/gauss.cpp \
+    laplace/adapt.c \
+    laplace/cg.c \
+    laplace/energy.c \
+    laplace/fem.c \
+    laplace/kernel.c \
     laplace/laplace.cpp \
     laplace/lattice.c \
+    laplace/mesh.c \
+    laplace/multigrid.c \
+    laplace/pool.c \
+    laplace/raster.cpp \
+    laplace/solutioncache.cpp \
+    laplace/sor.c \
+    laplace/sparse.c \
     laplace/worker.c \
     main.cpp \
     mainwindow.cpp \
@@ -51,8 +63,20 @@ HEADERS += \
     elementlist.h \
     gauss/gauss.h \
     json.hpp \
+    laplace/adapt.h \
+    laplace/cg.h \
+    laplace/energy.h \
+    laplace/fem.h \
+    laplace/kernel.h \
     laplace/laplace.h \
     laplace/lattice.h \
+    laplace/mesh.h \
+    laplace/multigrid.h \
+    laplace/pool.h \
+    laplace/raster.h \
+    laplace/solutioncache.h \
+    laplace/sor.h \
+    laplace/sparse.h \
     laplace/tuple.h \
     laplace/worker.h \
     mainwindow.h \
@@ -45,6 +45,7 @@ void Element::fromJSON(nlohmann::json j)
             vertices.push_back(p);
         }
     }
+    emit verticesChanged();
 }
 
 QString Element::TypeToString(Type type)
@@ -81,17 +82,20 @@ QList<Element::Type> Element::getTypes()
 void Element::addVertex(int index, QPointF vertex)
 {
     vertices.insert(index, vertex);
+    emit verticesChanged();
 }
 
 void Element::appendVertex(QPointF vertex)
 {
     vertices.append(vertex);
+    emit verticesChanged();
 }
 
 void Element::removeVertex(int index)
 {
     if(index >= 0 && index < vertices.size()) {
         vertices.removeAt(index);
+        emit verticesChanged();
     }
 }
 
@@ -99,6 +103,7 @@ void Element::changeVertex(int index, QPointF newCoords)
 {
     if(index >= 0 && index < vertices.size()) {
         vertices[index] = newCoords;
+        emit verticesChanged();
     }
 }
 
@@ -108,6 +113,12 @@ void Element::setType(Type t)
     emit typeChanged();
 }
 
+void Element::setEpsilonR(double er)
+{
+    epsilon_r = er;
+    emit epsilonRChanged();
+}
+
 QPolygonF Element::toPolygon()
 {
     auto ret = QPolygonF(vertices);
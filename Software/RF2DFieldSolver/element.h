@@ -39,11 +39,13 @@ public:
 
     void setName(QString s) {name = s;}
     void setType(Type t);
-    void setEpsilonR(double er) {epsilon_r = er;}
+    void setEpsilonR(double er);
     QPolygonF toPolygon();
 
 signals:
     void typeChanged();
+    void epsilonRChanged();
+    void verticesChanged();
 
 private:
     QList<QPointF> vertices;
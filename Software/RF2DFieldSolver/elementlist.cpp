@@ -2,10 +2,15 @@
 
 #include <QComboBox>
 
+#include <algorithm>
+#include <cmath>
+
 ElementList::ElementList(QObject *parent)
     : QAbstractTableModel{parent}
 {
-
+    indexColumns = 0;
+    indexRows = 0;
+    indexValid = false;
 }
 
 nlohmann::json ElementList::toJSON()
@@ -37,16 +42,27 @@ void ElementList::addElement(Element *e)
 {
     beginInsertRows(QModelIndex(), elements.size(), elements.size());
     elements.append(e);
+    elementBounds.append(e->toPolygon().boundingRect());
+    changedArea = changedArea.united(elementBounds.back());
     // TODO set up connections
     connect(e, &Element::typeChanged, this, [=](){
         auto i = findIndex(e);
         if(i != -1) {
             emit dataChanged(index(i, (int) Column::EpsilonR), index(i, (int) Column::EpsilonR));
         }
+        elementChanged(e);
+    });
+    connect(e, &Element::epsilonRChanged, this, [=](){
+        elementChanged(e);
+    });
+    connect(e, &Element::verticesChanged, this, [=](){
+        invalidateIndex();
+        elementChanged(e);
     });
     connect(e, &Element::destroyed, this, [=](){
         removeElement(e, false);
     });
+    invalidateIndex();
     endInsertRows();
 }
 
@@ -69,7 +85,9 @@ bool ElementList::removeElement(int index, bool del)
     beginRemoveRows(QModelIndex(), index, index);
     auto e = elements[index];
     elements.removeAt(index);
+    changedArea = changedArea.united(elementBounds.takeAt(index));
     disconnect(e, nullptr, this, nullptr);
+    invalidateIndex();
     if(del) {
         delete e;
     }
@@ -86,26 +104,46 @@ Element *ElementList::elementAt(int index) const
     }
 }
 
-double ElementList::getDielectricConstantAt(const QPointF &p)
+int ElementList::getIndexAt(const QPointF &p, bool dielectric)
 {
-    for(unsigned int i=0;i<elements.size();i++) {
-        auto e = elements[i];
-        QPolygonF poly = QPolygonF(e->getVertices());
-        if(poly.containsPoint(p, Qt::OddEvenFill)) {
-            // this polygon defines the weight at these coordinates
-            switch(e->getType()) {
-            case Element::Type::GND:
-            case Element::Type::TracePos:
-            case Element::Type::TraceNeg:
-                return 1.0;
-            case Element::Type::Dielectric:
-                return e->getEpsilonR();
-            case Element::Type::Last:
-                return 1.0;
-            }
+    // the index must not be rebuilt by another caller during the lookup
+    QMutexLocker locker(&indexMutex);
+    updateIndex();
+    if(indexEntries.isEmpty() || !indexBounds.contains(p)) {
+        return -1;
+    }
+    // the candidates are stored in the order of the elements, so the first match has priority
+    for(auto i : indexBuckets[indexColumn(p.x()) + indexRow(p.y()) * indexColumns]) {
+        auto &entry = indexEntries[i];
+        if(!dielectric && elements[i]->getType() == Element::Type::Dielectric) {
+            continue;
+        }
+        if(entry.bounds.contains(p) && entry.polygon.containsPoint(p, Qt::OddEvenFill)) {
+            return i;
         }
     }
-    // not found, we are in the air
+    return -1;
+}
+
+double ElementList::getDielectricConstantAt(const QPointF &p)
+{
+    auto i = getIndexAt(p);
+    if(i < 0) {
+        // not found, we are in the air
+        return 1.0;
+    }
+    auto e = elements[i];
+    // this polygon defines the weight at these coordinates
+    switch(e->getType()) {
+    case Element::Type::GND:
+    case Element::Type::TracePos:
+    case Element::Type::TraceNeg:
+        return 1.0;
+    case Element::Type::Dielectric:
+        return e->getEpsilonR();
+    case Element::Type::Last:
+        return 1.0;
+    }
     return 1.0;
 }
 
@@ -202,6 +240,18 @@ int ElementList::findIndex(Element *e)
     return elements.indexOf(e);
 }
 
+void ElementList::elementChanged(Element *e)
+{
+    auto i = findIndex(e);
+    if(i == -1) {
+        return;
+    }
+    // both the old and the new area of the element are affected
+    changedArea = changedArea.united(elementBounds[i]);
+    elementBounds[i] = e->toPolygon().boundingRect();
+    changedArea = changedArea.united(elementBounds[i]);
+}
+
 QWidget *TypeDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const
 {
     Q_UNUSED(option)
@@ -231,3 +281,76 @@ void TypeDelegate::setModelData(QWidget *editor, QAbstractItemModel *model, cons
     auto c = (QComboBox*) editor;
     list->setData(index, c->currentText());
 }
+
+void ElementList::invalidateIndex()
+{
+    QMutexLocker locker(&indexMutex);
+    indexValid = false;
+}
+
+void ElementList::updateIndex()
+{
+    // called with indexMutex held
+    if(indexValid) {
+        return;
+    }
+    indexEntries.clear();
+    indexBuckets.clear();
+    for(auto e : elements) {
+        IndexEntry entry;
+        entry.polygon = QPolygonF(e->getVertices());
+        // a polygon never contains points outside of the range of its vertices
+        entry.bounds = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+        for(auto &v : e->getVertices()) {
+            entry.bounds.left = std::min(entry.bounds.left, v.x());
+            entry.bounds.right = std::max(entry.bounds.right, v.x());
+            entry.bounds.top = std::min(entry.bounds.top, v.y());
+            entry.bounds.bottom = std::max(entry.bounds.bottom, v.y());
+        }
+        if(indexEntries.isEmpty()) {
+            indexBounds = entry.bounds;
+        } else {
+            indexBounds.left = std::min(indexBounds.left, entry.bounds.left);
+            indexBounds.right = std::max(indexBounds.right, entry.bounds.right);
+            indexBounds.top = std::min(indexBounds.top, entry.bounds.top);
+            indexBounds.bottom = std::max(indexBounds.bottom, entry.bounds.bottom);
+        }
+        indexEntries.append(entry);
+    }
+
+    // roughly one element per bucket
+    indexColumns = indexRows = qBound(1, (int) ceil(sqrt(elements.size())), 256);
+    indexBuckets.resize(indexColumns * indexRows);
+    for(int i=0;i<indexEntries.size();i++) {
+        auto &b = indexEntries[i].bounds;
+        if(b.left > b.right) {
+            // no vertices
+            continue;
+        }
+        for(int row=indexRow(b.top);row<=indexRow(b.bottom);row++) {
+            for(int column=indexColumn(b.left);column<=indexColumn(b.right);column++) {
+                indexBuckets[column + row * indexColumns].append(i);
+            }
+        }
+    }
+    indexValid = true;
+}
+
+int ElementList::indexColumn(double x) const
+{
+    // monotonic in x, so a point within a bounding box maps into the buckets of the box
+    double width = indexBounds.right - indexBounds.left;
+    if(width <= 0) {
+        return 0;
+    }
+    return qBound(0, (int) ((x - indexBounds.left) / width * indexColumns), indexColumns - 1);
+}
+
+int ElementList::indexRow(double y) const
+{
+    double height = indexBounds.bottom - indexBounds.top;
+    if(height <= 0) {
+        return 0;
+    }
+    return qBound(0, (int) ((y - indexBounds.top) / height * indexRows), indexRows - 1);
+}
@@ -3,6 +3,9 @@
 
 #include <QAbstractTableModel>
 #include <QList>
+#include <QMutex>
+#include <QPolygonF>
+#include <QRectF>
 #include <QStyledItemDelegate>
 #include "element.h"
 #include "savable.h"
@@ -37,6 +40,11 @@ public:
     bool removeElement(int index, bool del = true);
     Element *elementAt(int index) const;
     const QList<Element*> getElements() const {return elements;}
+    // the index of the first element containing the point, dielectrics are skipped unless dielectric is set. -1 if there is none
+    int getIndexAt(const QPointF &p, bool dielectric = true);
+    // the area affected by changes of the elements since the last call of clearChangedArea
+    QRectF getChangedArea() const {return changedArea;}
+    void clearChangedArea() {changedArea = QRectF();}
     double getDielectricConstantAt(const QPointF &p);
 
     int rowCount(const QModelIndex &parent) const override { Q_UNUSED(parent) return elements.size();}
@@ -49,8 +57,34 @@ public:
 private:
 
     int findIndex(Element *e);
+    void elementChanged(Element *e);
+    void invalidateIndex();
+    void updateIndex();
 
     QList<Element*> elements;
+    // the area covered by each element, known even while an element is destroyed
+    QList<QRectF> elementBounds;
+    QRectF changedArea;
+
+    // bucket grid over the bounding boxes of the element polygons, rebuilt on the first lookup after a change
+    class IndexBounds {
+    public:
+        bool contains(const QPointF &p) const {return p.x() >= left && p.x() <= right && p.y() >= top && p.y() <= bottom;}
+        double left, right, top, bottom;
+    };
+    class IndexEntry {
+    public:
+        QPolygonF polygon;
+        IndexBounds bounds;
+    };
+    int indexColumn(double x) const;
+    int indexRow(double y) const;
+    QList<IndexEntry> indexEntries;
+    QList<QList<int>> indexBuckets;
+    IndexBounds indexBounds;
+    int indexColumns, indexRows;
+    bool indexValid;
+    QMutex indexMutex;
 };
 
 #endif // ELEMENTMODEL_H
@@ -1,46 +1,181 @@
 #include "gauss.h"
 
 #include "polygon.h"
+#include "laplace/pool.h"
 
 Gauss::Gauss(QObject *parent)
     : QObject{parent}
 {
+    calculationRunning = false;
+    abort = false;
+    laplace = nullptr;
+    gridSize = 1e-5;
+    threads = 1;
+    next = 0;
+    pool = nullptr;
+}
 
+Gauss::~Gauss()
+{
+    if(calculationRunning) {
+        abortCalculation();
+        pthread_join(thread, nullptr);
+    }
+    pool_delete(pool);
 }
 
-double Gauss::getCharge(Laplace *laplace, ElementList *list, Element *e, double gridSize, double distance)
+double Gauss::getCharge(Laplace *laplace, bool dielectric, Element *e, double gridSize, double distance)
 {
-    // extend the element polygon a bit
-    auto integral = Polygon::offset(e->getVertices(), distance);
+    double sign;
+    auto integral = getContour(e, distance, sign);
 
     double chargeSum = 0;
     for(unsigned int i=0;i<integral.size();i++) {
         auto pp = integral[(i+integral.size()-1) % integral.size()];
         auto pc = integral[i];
+        chargeSum += getFlux(laplace, dielectric, pp, pc, gridSize);
+    }
+
+    return chargeSum * sign;
+}
+
+void Gauss::setThreads(int threads)
+{
+    if(calculationRunning) {
+        return;
+    }
+    this->threads = threads;
+}
 
-        auto increment = QLineF(pp, pc);
-        auto unitVector = increment;
-        unitVector.setLength(1.0);
-        unsigned int points = ceil(increment.length() / gridSize);
-        double stepSize = increment.length() / points;
-        increment.setLength(stepSize);
-        auto point = pp + QPointF(increment.dx() / 2, increment.dy() / 2);
-        for(unsigned int j=0;j<points;j++) {
-            QLineF gradient = laplace->getGradient(point);
-            if(list) {
-                gradient.setLength(gradient.length() * list->getDielectricConstantAt(point));
+bool Gauss::startCalculation(Laplace *laplace, ElementList *list, double gridSize, double distance)
+{
+    if(calculationRunning) {
+        return false;
+    }
+    calculationRunning = true;
+    abort = false;
+    this->laplace = laplace;
+    this->gridSize = gridSize;
+
+    // split the contours of all traces into their sides, each one is integrated on its own
+    segments.clear();
+    for(auto e : list->getElements()) {
+        if(e->getType() != Element::Type::TracePos && e->getType() != Element::Type::TraceNeg) {
+            continue;
+        }
+        double sign;
+        auto integral = getContour(e, distance, sign);
+        for(bool dielectric : {false, true}) {
+            for(unsigned int i=0;i<integral.size();i++) {
+                Segment s;
+                s.from = integral[(i+integral.size()-1) % integral.size()];
+                s.to = integral[i];
+                s.dielectric = dielectric;
+                s.negative = e->getType() == Element::Type::TraceNeg;
+                s.sign = s.negative ? -sign : sign;
+                s.flux = 0;
+                segments.append(s);
             }
-            // get amount of gradient that is perpendicular to our integration line
-            double perp = gradient.dx() * unitVector.dy() - gradient.dy() * unitVector.dx();
-            perp *= stepSize / gridSize;
-            chargeSum += perp;
-            point += QPointF(increment.dx(), increment.dy());
         }
     }
 
-    if(!Polygon::isClockwise(integral)) {
-        chargeSum *= -1;
+    // start the calculation thread
+    auto err = pthread_create(&thread, nullptr, calcThreadTrampoline, this);
+    if(err) {
+        calculationRunning = false;
+        emit error("Failed to start gauss thread");
+        return false;
+    }
+    return true;
+}
+
+void Gauss::abortCalculation()
+{
+    if(!calculationRunning) {
+        return;
+    }
+    // request abort of calculation
+    abort = true;
+}
+
+QList<QPointF> Gauss::getContour(Element *e, double distance, double &sign)
+{
+    // extend the element polygon a bit
+    auto integral = Polygon::offset(e->getVertices(), distance);
+    sign = Polygon::isClockwise(integral) ? 1.0 : -1.0;
+    return integral;
+}
+
+double Gauss::getFlux(Laplace *laplace, bool dielectric, const QPointF &from, const QPointF &to, double gridSize)
+{
+    auto increment = QLineF(from, to);
+    auto unitVector = increment;
+    unitVector.setLength(1.0);
+    unsigned int points = ceil(increment.length() / gridSize);
+    if(points == 0) {
+        return 0;
+    }
+    double stepSize = increment.length() / points;
+    increment.setLength(stepSize);
+
+    // sample the whole side at once
+    QVector<QPointF> samples(points);
+    auto point = from + QPointF(increment.dx() / 2, increment.dy() / 2);
+    for(unsigned int j=0;j<points;j++) {
+        samples[j] = point;
+        point += QPointF(increment.dx(), increment.dy());
     }
+    QVector<QPointF> gradients(points);
+    QVector<double> epsilon(points);
+    laplace->sampleField(samples.constData(), points, gradients.data(), dielectric ? epsilon.data() : nullptr, !dielectric);
 
+    double chargeSum = 0;
+    for(unsigned int j=0;j<points;j++) {
+        auto gradient = gradients[j];
+        if(dielectric) {
+            gradient *= epsilon[j];
+        }
+        // get amount of gradient that is perpendicular to our integration line
+        double perp = gradient.x() * unitVector.dy() - gradient.y() * unitVector.dx();
+        perp *= stepSize / gridSize;
+        chargeSum += perp;
+    }
     return chargeSum;
 }
+
+void* Gauss::calcThread()
+{
+    // the threads are kept for the following calculations
+    if(!pool || pool_size(pool) != (uint32_t) threads) {
+        pool_delete(pool);
+        pool = pool_new(threads);
+    }
+
+    emit info("Starting gauss integration of "+QString::number(segments.size())+" contour segments");
+    next = 0;
+    pool_run(pool, calcWorkTrampoline, this);
+
+    calculationRunning = false;
+    if(abort) {
+        emit warning("Gauss integration aborted");
+        emit calculationAborted();
+        return nullptr;
+    }
+    // add up in a fixed order, so the result doesn't depend on the threads
+    double charges[2][2] = {{0, 0}, {0, 0}};
+    for(auto &s : segments) {
+        charges[s.dielectric][s.negative] += s.flux * s.sign;
+    }
+    emit info("Gauss integration complete");
+    emit calculationDone(charges[0][0], charges[0][1], charges[1][0], charges[1][1]);
+    return nullptr;
+}
+
+void Gauss::calcWork()
+{
+    uint32_t i;
+    while(!abort && (i = pool_next(&next)) < (uint32_t) segments.size()) {
+        auto &s = segments[i];
+        s.flux = getFlux(laplace, s.dielectric, s.from, s.to, gridSize);
+    }
+}
@@ -2,6 +2,9 @@
 #define GAUSS_H
 
 #include <QObject>
+#include <QVector>
+
+#include <pthread.h>
 
 #include "laplace/laplace.h"
 #include "elementlist.h"
@@ -11,13 +14,60 @@ class Gauss : public QObject
     Q_OBJECT
 public:
     explicit Gauss(QObject *parent = nullptr);
+    ~Gauss();
+
+    // the charge of a trace divided by e0, the dielectric of the solution is included if set
+    static double getCharge(Laplace *laplace, bool dielectric, Element *e, double gridSize, double distance);
+
+    void setThreads(int threads);
 
-    static double getCharge(Laplace *laplace, ElementList *list, Element *e, double gridSize, double distance);
+    // integrates the charges of all traces of the solution, with and without the dielectric.
+    // The integrals run on worker threads and calculationDone is emitted once all are known
+    bool startCalculation(Laplace *laplace, ElementList *list, double gridSize, double distance);
+    void abortCalculation();
 
 signals:
+    // the charges of the positive traces and the negated charges of the negative traces, divided by e0
+    void calculationDone(double airP, double airN, double dielectricP, double dielectricN);
+    void calculationAborted();
     void info(QString info);
     void warning(QString warning);
     void error(QString error);
+
+private:
+    // one side of the contour around a trace, the unit of work of the threads
+    class Segment {
+    public:
+        QPointF from, to;
+        bool dielectric;
+        bool negative;
+        // the direction of the contour
+        double sign;
+        double flux;
+    };
+    static QList<QPointF> getContour(Element *e, double distance, double &sign);
+    static double getFlux(Laplace *laplace, bool dielectric, const QPointF &from, const QPointF &to, double gridSize);
+    void* calcThread();
+    static void* calcThreadTrampoline(void *ptr) {
+        return ((Gauss*)ptr)->calcThread();
+    }
+    void calcWork();
+    static void calcWorkTrampoline(void *ptr, uint32_t id, uint32_t count) {
+        Q_UNUSED(id);
+        Q_UNUSED(count);
+        ((Gauss*)ptr)->calcWork();
+    }
+    bool calculationRunning;
+    bool abort;
+    Laplace *laplace;
+    double gridSize;
+    int threads;
+    QVector<Segment> segments;
+    // the next segment to integrate
+    uint32_t next;
+    struct pool *pool;
+
+    pthread_t thread;
 };
 
 #endif // GAUSS_H
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "adapt.h"
+
+/**
+ * This is the number of rows handed out at once to a thread.
+ */
+#define ADAPT_BAND 8
+
+/**
+ * This structure holds the state shared by the threads estimating the
+ * error of a lattice.
+ */
+struct adapt_sum {
+    struct lattice* lattice;
+    /* the next band of rows */
+    uint32_t next;
+    /* the estimates of the columns and then the rows of each band */
+    double* bands;
+};
+
+/**
+ * This function computes the position of a cell along one axis.
+ */
+static inline double adapt_position(const double* axis, double step, uint32_t i) {
+    return (axis != NULL) ? axis[i] : ((int32_t) i-1)*step;
+}
+
+/**
+ * This function computes the width of a cell along one axis, it
+ * reaches halfway to the adjacent cells inside the outer ring.
+ */
+static inline double adapt_width(const double* axis, double step, uint32_t i, uint32_t n) {
+    double from = adapt_position(axis, step, (i > 1) ? i-1 : i);
+    double to = adapt_position(axis, step, (i < n-2) ? i+1 : i);
+    return (to-from)/2;
+}
+
+/**
+ * This function computes the squared jump of the flux through a cell
+ * between two of its adjacent cells, which are at the given distances
+ * on either side.
+ */
+static inline double adapt_jump(const double* v, const double* g, uint32_t index, uint32_t stride, double before, double after) {
+    double in = g[index]*g[index-stride]*(v[index]-v[index-stride])/before;
+    double out = g[index]*g[index+stride]*(v[index+stride]-v[index])/after;
+    return (out-in)*(out-in);
+}
+
+/**
+ * This function estimates the error of bands of rows until none are
+ * left.
+ */
+static void adapt_work(void* ptr, uint32_t id, uint32_t count) {
+    struct adapt_sum* sum = (struct adapt_sum*) ptr;
+    struct lattice* lattice = sum->lattice;
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+    const double* v = lattice->value;
+    const double* g = lattice->weight;
+    const uint8_t* cond = lattice->cond;
+    uint32_t band;
+
+    (void) id;
+    (void) count;
+
+    while((band = pool_next(&sum->next)) * ADAPT_BAND + 1 < h-1) {
+        uint32_t first = band*ADAPT_BAND+1;
+        uint32_t last = (first+ADAPT_BAND < h-1) ? first+ADAPT_BAND : h-1;
+        double* ex = &sum->bands[(size_t) band*(w+h-6)];
+        double* ey = &ex[w-3];
+
+        for(uint32_t j = first; j < last; j++) {
+            double y = adapt_position(lattice->ys, lattice->step.y, j);
+            double dy = adapt_width(lattice->ys, lattice->step.y, j, h);
+
+            for(uint32_t i = 1; i < w-1; i++) {
+                uint32_t index = i+j*w;
+                if(cond[index] != NONE)
+                    continue;
+
+                double x = adapt_position(lattice->xs, lattice->step.x, i);
+                double dx = adapt_width(lattice->xs, lattice->step.x, i, w);
+                double area = dx*dy/(g[index]*g[index]);
+
+                if(cond[index-1] != NEUMANN && cond[index+1] != NEUMANN) {
+                    double before = x-adapt_position(lattice->xs, lattice->step.x, i-1);
+                    double after = adapt_position(lattice->xs, lattice->step.x, i+1)-x;
+                    double e = adapt_jump(v, g, index, 1, before, after)*area/2;
+                    ex[i-2] += e;
+                    ex[i-1] += e;
+                }
+                if(cond[index-w] != NEUMANN && cond[index+w] != NEUMANN) {
+                    double before = y-adapt_position(lattice->ys, lattice->step.y, j-1);
+                    double after = adapt_position(lattice->ys, lattice->step.y, j+1)-y;
+                    double e = adapt_jump(v, g, index, w, before, after)*area/2;
+                    ey[j-2] += e;
+                    ey[j-1] += e;
+                }
+            }
+        }
+    }
+}
+
+int adapt_estimate(struct lattice* lattice, struct pool* pool, double* ex, double* ey) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+    uint32_t count = (h-2+ADAPT_BAND-1)/ADAPT_BAND;
+    size_t size = w+h-6;
+
+    double* bands = calloc(count*size, sizeof(double));
+    if(bands == NULL)
+        return -1;
+
+    struct adapt_sum sum = {lattice, 0, bands};
+    pool_run(pool, adapt_work, &sum);
+
+    memset(ex, 0, (w-3)*sizeof(double));
+    memset(ey, 0, (h-3)*sizeof(double));
+    for(uint32_t k = 0; k < count; k++) {
+        for(uint32_t i = 0; i < w-3; i++)
+            ex[i] += bands[k*size+i];
+        for(uint32_t j = 0; j < h-3; j++)
+            ey[j] += bands[k*size+w-3+j];
+    }
+
+    free(bands);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_ADAPT_H
+#define INCLUDE_ADAPT_H
+
+#include "lattice.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This function estimates where the mesh of a solved lattice is too
+ * coarse, so that it can be refined where it matters.
+ *
+ * At each free cell, the flux towards the cell along one axis is
+ * compared with the flux leaving it on the other side. The flux is
+ * continuous across dielectric interfaces, so the jump only comes
+ * from the discretisation and is largest around the corners and edges
+ * of conductors. Its square is scaled by the area of the cell, which
+ * gives an estimate of the energy missed around the cell. Half of it
+ * is added to each interval between the cell and its neighbours along
+ * that axis. The cells next to the outer ring are left out along the
+ * axis across the border.
+ *
+ * The rows are handled in bands shared by the threads of the pool.
+ * The sums of the bands are added in order, so the result doesn't
+ * depend on the number of threads.
+ *
+ * @param lattice
+ *        This is a pointer to the solved lattice.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread.
+ * @param ex
+ *        This array receives dim.x-3 estimates, one for each interval
+ *        between adjacent columns inside the outer ring.
+ * @param ey
+ *        This array receives dim.y-3 estimates, one for each interval
+ *        between adjacent rows inside the outer ring.
+ *
+ * @return 0 if everything went as expected, else -1.
+ */
+int adapt_estimate(struct lattice* lattice, struct pool* pool, double* ex, double* ey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
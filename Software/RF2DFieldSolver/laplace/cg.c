@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "cg.h"
+#include "pool.h"
+#include "sparse.h"
+#include "multigrid.h"
+
+/**
+ * This marks the cells that are not part of the system.
+ */
+#define CG_FIXED UINT32_MAX
+
+/**
+ * This structure contains the state shared by all the threads.
+ */
+struct cg_shared {
+    struct lattice* lattice;
+    struct config* conf;
+    volatile bool* abort;
+
+    /* the system and its unknowns */
+    struct sparse* matrix;
+    uint32_t* cell;
+    double* b;
+    double* x;
+
+    /* the vectors of the iteration */
+    double* r;
+    double* z;
+    double* p;
+    double* q;
+
+    /* the preconditioners */
+    enum preconditioner precond;
+    double* diag_inv;
+    struct sparse* factor;
+    struct multigrid* mg;
+    double* rc;
+    double* zc;
+
+    /* the partial results of each thread */
+    double* rz;
+    double* pq;
+    double* res;
+    uint32_t count;
+
+    uint32_t iterations;
+    int running;
+
+    progress_callback_t cb;
+    void *cb_ptr;
+};
+
+/**
+ * This function assembles the system of the free cells.
+ */
+struct sparse* cg_assemble(struct lattice* lattice, uint32_t* unknown, uint32_t* cell, uint32_t rows, double* b);
+
+/**
+ * This function computes the residual from the solution.
+ */
+double cg_residual(struct cg_shared* shared);
+
+/**
+ * This function applies the preconditioners handled by one thread.
+ */
+void cg_precondition(struct cg_shared* shared);
+
+void cg_work(void* ptr, uint32_t id, uint32_t count);
+
+/**
+ * This function iterates on the system of the shared state until it
+ * converged. The matrix, the right hand side and the initial guess
+ * must be set, the other vectors are allocated here. It returns 0 if
+ * everything went as expected, else -1.
+ */
+static int cg_solve(struct cg_shared* shared) {
+    struct sparse* m = shared->matrix;
+    uint32_t rows = m->rows;
+    uint32_t cells = 0;
+    int ret = -1;
+    double diff;
+
+    shared->r = malloc(rows*sizeof(double));
+    shared->z = malloc(rows*sizeof(double));
+    shared->p = calloc(rows, sizeof(double));
+    shared->q = malloc(rows*sizeof(double));
+    shared->diag_inv = malloc(rows*sizeof(double));
+    if(shared->r == NULL || shared->z == NULL || shared->p == NULL || shared->q == NULL || shared->diag_inv == NULL)
+        goto ERROR;
+
+    for(uint32_t u = 0; u < rows; u++)
+        for(uint32_t k = m->row[u]; k < m->row[u+1]; k++)
+            if(m->col[k] == u) shared->diag_inv[u] = 1.0/m->val[k];
+
+    /* prepare the preconditioner */
+    switch(shared->precond) {
+    case PRECONDITIONER_JACOBI:
+        break;
+    case PRECONDITIONER_ICHOL:
+        shared->factor = sparse_ichol(m);
+        if(shared->factor == NULL) goto ERROR;
+        break;
+    case PRECONDITIONER_MULTIGRID:
+        cells = shared->lattice->dim.x*shared->lattice->dim.y;
+        shared->mg = multigrid_new(shared->lattice);
+        shared->rc = calloc(cells, sizeof(double));
+        shared->zc = calloc(cells, sizeof(double));
+        if(shared->mg == NULL || shared->rc == NULL || shared->zc == NULL) goto ERROR;
+        break;
+    }
+
+    shared->count = pool_size(shared->conf->pool);
+    shared->rz = malloc(shared->count*sizeof(double));
+    shared->pq = malloc(shared->count*sizeof(double));
+    shared->res = malloc(shared->count*sizeof(double));
+    if(shared->rz == NULL || shared->pq == NULL || shared->res == NULL)
+        goto ERROR;
+
+    /* nothing to do if the initial guess is good enough */
+    diff = cg_residual(shared);
+    shared->running = diff > shared->conf->threshold && !(shared->abort && *shared->abort);
+
+    if(shared->running)
+        pool_run(shared->conf->pool, &cg_work, shared);
+    ret = 0;
+
+ERROR:
+    sparse_delete(shared->factor);
+    multigrid_delete(shared->mg);
+    free(shared->rc);
+    free(shared->zc);
+    free(shared->r);
+    free(shared->z);
+    free(shared->p);
+    free(shared->q);
+    free(shared->diag_inv);
+    free(shared->rz);
+    free(shared->pq);
+    free(shared->res);
+
+    return ret;
+}
+
+uint32_t sparse_compute_cg(struct sparse* matrix, const double* b, double* x, struct config* conf, enum preconditioner precond, volatile bool* abort, progress_callback_t cb, void *cb_ptr) {
+    struct cg_shared shared = {0};
+
+    if(matrix->rows == 0)
+        return 0;
+
+    shared.conf = conf;
+    shared.abort = abort;
+    shared.matrix = matrix;
+    shared.b = (double*) b;
+    shared.x = x;
+    /* the multigrid hierarchy needs a lattice */
+    shared.precond = (precond == PRECONDITIONER_MULTIGRID) ? PRECONDITIONER_ICHOL : precond;
+    shared.cb = cb;
+    shared.cb_ptr = cb_ptr;
+
+    if(cg_solve(&shared) != 0)
+        return COMPUTE_FAILED;
+
+    return shared.iterations;
+}
+
+uint32_t lattice_compute_cg(struct lattice* lattice, struct config* conf, enum preconditioner precond, progress_callback_t cb, void *cb_ptr) {
+    struct cg_shared shared = {0};
+    uint32_t* unknown = NULL;
+    uint32_t cells = lattice->dim.x*lattice->dim.y;
+    uint32_t rows = 0;
+    uint32_t iterations = COMPUTE_FAILED;
+
+    shared.lattice = lattice;
+    shared.conf = conf;
+    shared.abort = lattice->abort;
+    shared.precond = precond;
+    shared.cb = cb;
+    shared.cb_ptr = cb_ptr;
+
+    /* number the free cells */
+    unknown = malloc(cells*sizeof(uint32_t));
+    if(unknown == NULL) goto ERROR;
+
+    for(uint32_t i = 0; i < cells; i++)
+        unknown[i] = !lattice_fixed(lattice, i) ? rows++ : CG_FIXED;
+
+    if(rows == 0) {
+        free(unknown);
+        return 0;
+    }
+
+    shared.cell = malloc(rows*sizeof(uint32_t));
+    shared.b = malloc(rows*sizeof(double));
+    shared.x = malloc(rows*sizeof(double));
+    if(shared.cell == NULL || shared.b == NULL || shared.x == NULL)
+        goto ERROR;
+
+    shared.matrix = cg_assemble(lattice, unknown, shared.cell, rows, shared.b);
+    if(shared.matrix == NULL) goto ERROR;
+
+    /* start from the current values */
+    for(uint32_t u = 0; u < rows; u++)
+        shared.x[u] = lattice->value[shared.cell[u]];
+
+    if(cg_solve(&shared) != 0) goto ERROR;
+
+    /* copy the solution back to the lattice */
+    for(uint32_t u = 0; u < rows; u++)
+        lattice->value[shared.cell[u]] = shared.x[u];
+    iterations = shared.iterations;
+
+ERROR:
+    sparse_delete(shared.matrix);
+    free(shared.cell);
+    free(shared.b);
+    free(shared.x);
+    free(unknown);
+
+    return iterations;
+}
+
+struct sparse* cg_assemble(struct lattice* lattice, uint32_t* unknown, uint32_t* cell, uint32_t rows, double* b) {
+    /* the neighbours in the order of their index */
+    static const enum stencil order[STENCIL_SIZE] = {STENCIL_S, STENCIL_W, STENCIL_C, STENCIL_E, STENCIL_N};
+    int32_t w = lattice->dim.x;
+    int32_t offset[STENCIL_SIZE];
+    struct sparse* matrix;
+    uint32_t size = 0;
+    double a[STENCIL_SIZE];
+
+    offset[STENCIL_C] = 0;
+    offset[STENCIL_W] = -1;
+    offset[STENCIL_E] = 1;
+    offset[STENCIL_S] = -w;
+    offset[STENCIL_N] = w;
+
+    matrix = sparse_new(rows, rows*STENCIL_SIZE);
+    if(matrix == NULL)
+        return NULL;
+
+    for(uint32_t i = 0; i < lattice->dim.x*lattice->dim.y; i++) {
+        uint32_t u = unknown[i];
+
+        if(u == CG_FIXED)
+            continue;
+
+        cell[u] = i;
+        b[u] = 0;
+        matrix->row[u] = size;
+        lattice_stencil(lattice, i, a);
+
+        for(uint32_t k = 0; k < STENCIL_SIZE; k++) {
+            uint32_t j = i+offset[order[k]];
+
+            if(a[order[k]] == 0)
+                continue;
+
+            /* the fixed cells move to the right hand side */
+            if(unknown[j] == CG_FIXED) {
+                b[u] -= a[order[k]]*lattice->value[j];
+                continue;
+            }
+
+            matrix->col[size] = unknown[j];
+            matrix->val[size] = a[order[k]];
+            size++;
+        }
+    }
+    matrix->row[rows] = size;
+
+    return matrix;
+}
+
+double cg_residual(struct cg_shared* shared) {
+    struct sparse* matrix = shared->matrix;
+    double res = 0;
+
+    sparse_multiply(matrix, shared->x, shared->r, 0, matrix->rows);
+    for(uint32_t u = 0; u < matrix->rows; u++) {
+        shared->r[u] = shared->b[u]-shared->r[u];
+        if(fabs(shared->r[u]*shared->diag_inv[u]) > res)
+            res = fabs(shared->r[u]*shared->diag_inv[u]);
+    }
+
+    return res;
+}
+
+void cg_precondition(struct cg_shared* shared) {
+    uint32_t rows = shared->matrix->rows;
+
+    switch(shared->precond) {
+    case PRECONDITIONER_JACOBI:
+        break;
+    case PRECONDITIONER_ICHOL:
+        sparse_ichol_solve(shared->factor, shared->r, shared->z);
+        break;
+    case PRECONDITIONER_MULTIGRID:
+        /* the hierarchy works on the cells of the lattice */
+        for(uint32_t u = 0; u < rows; u++)
+            shared->rc[shared->cell[u]] = shared->r[u];
+        multigrid_precondition(shared->mg, shared->rc, shared->zc);
+        for(uint32_t u = 0; u < rows; u++)
+            shared->z[u] = shared->zc[shared->cell[u]];
+        break;
+    }
+}
+
+void cg_work(void* ptr, uint32_t id, uint32_t count) {
+    struct cg_shared* shared = (struct cg_shared*) ptr;
+    struct pool* pool = shared->conf->pool;
+    uint32_t rows = shared->matrix->rows;
+    double rz_old = 0;
+    double rz, pq, alpha, beta, sum, res;
+
+    /* split the rows between the threads */
+    uint32_t first = (uint64_t) rows*id/count;
+    uint32_t last = (uint64_t) rows*(id+1)/count;
+
+    do {
+        /* precondition the residual */
+        if(shared->precond == PRECONDITIONER_JACOBI) {
+            for(uint32_t u = first; u < last; u++)
+                shared->z[u] = shared->r[u]*shared->diag_inv[u];
+        } else if(id == 0) {
+            cg_precondition(shared);
+        }
+        pool_barrier(pool);
+
+        /* update the search direction */
+        sum = 0;
+        for(uint32_t u = first; u < last; u++)
+            sum += shared->r[u]*shared->z[u];
+        shared->rz[id] = sum;
+        pool_barrier(pool);
+
+        rz = 0;
+        for(uint32_t t = 0; t < shared->count; t++)
+            rz += shared->rz[t];
+        beta = rz_old > 0 ? rz/rz_old : 0;
+        rz_old = rz;
+
+        for(uint32_t u = first; u < last; u++)
+            shared->p[u] = shared->z[u]+beta*shared->p[u];
+        pool_barrier(pool);
+
+        /* step along the search direction */
+        sparse_multiply(shared->matrix, shared->p, shared->q, first, last);
+        sum = 0;
+        for(uint32_t u = first; u < last; u++)
+            sum += shared->p[u]*shared->q[u];
+        shared->pq[id] = sum;
+        pool_barrier(pool);
+
+        pq = 0;
+        for(uint32_t t = 0; t < shared->count; t++)
+            pq += shared->pq[t];
+        alpha = pq > 0 ? rz/pq : 0;
+
+        res = 0;
+        for(uint32_t u = first; u < last; u++) {
+            shared->x[u] += alpha*shared->p[u];
+            shared->r[u] -= alpha*shared->q[u];
+            if(fabs(shared->r[u]*shared->diag_inv[u]) > res)
+                res = fabs(shared->r[u]*shared->diag_inv[u]);
+        }
+        shared->res[id] = res;
+        pool_barrier(pool);
+
+        /* the first thread collects the result of the iteration */
+        if(id == 0) {
+            res = 0;
+            for(uint32_t t = 0; t < shared->count; t++)
+                if(shared->res[t] > res) res = shared->res[t];
+
+            /* confirm convergence with the actual residual */
+            if(res <= shared->conf->threshold)
+                res = cg_residual(shared);
+
+            shared->iterations++;
+            if(shared->cb) {
+                shared->cb(shared->cb_ptr, res);
+            }
+
+            shared->running = res > shared->conf->threshold && pq > 0 && !(shared->abort && *shared->abort);
+        }
+        pool_barrier(pool);
+    } while(shared->running);
+}
@@ -0,0 +1,85 @@
+#ifndef INCLUDE_CG_H
+#define INCLUDE_CG_H
+
+#include <stdint.h>
+
+#include "lattice.h"
+#include "sparse.h"
+#include "worker.h"
+#include "tuple.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This enumeration defines the preconditioners available for the
+ * conjugate gradient solver.
+ */
+enum preconditioner {
+    PRECONDITIONER_JACOBI,
+    PRECONDITIONER_ICHOL,
+    PRECONDITIONER_MULTIGRID,
+};
+
+/**
+ * This function computes the laplace equation for a given lattice
+ * with preconditioned conjugate gradients.
+ *
+ * The free cells of the lattice are assembled into a sparse symmetric
+ * positive-definite matrix (see lattice_stencil), the dirichlet cells
+ * move to the right hand side. The matrix products, the dot products
+ * and the Jacobi preconditioner are split between the threads, the
+ * incomplete Cholesky and multigrid preconditioners are applied by a
+ * single thread.
+ *
+ * The computation stops once the residual, divided by the diagonal,
+ * falls below the threshold everywhere. This is the largest change a
+ * Jacobi iteration would apply to the solution. The residual is
+ * recomputed from the solution before stopping.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice. The values of the free
+ *        cells are used as initial guess.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ * @param precond
+ *        This is the preconditioner to use.
+ *
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t lattice_compute_cg(struct lattice* lattice, struct config* conf, enum preconditioner precond, progress_callback_t cb, void *cb_ptr);
+
+/**
+ * This function solves a sparse symmetric positive-definite system
+ * with preconditioned conjugate gradients, with the same iteration
+ * and stopping rule as lattice_compute_cg.
+ *
+ * @param matrix
+ *        This is a pointer to the matrix, with all entries of each
+ *        row.
+ * @param b
+ *        This is the right hand side.
+ * @param x
+ *        This contains the initial guess and receives the solution.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ * @param precond
+ *        This is the preconditioner to use. The multigrid
+ *        preconditioner needs a lattice, the incomplete Cholesky
+ *        factorisation is used instead.
+ * @param abort
+ *        The computation stops as soon as possible once this is set,
+ *        it may be @{code NULL}.
+ *
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t sparse_compute_cg(struct sparse* matrix, const double* b, double* x, struct config* conf, enum preconditioner precond, volatile bool* abort, progress_callback_t cb, void *cb_ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
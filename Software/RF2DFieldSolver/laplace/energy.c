@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "energy.h"
+#include "kernel.h"
+
+/**
+ * This is the number of rows handed out at once to a thread.
+ */
+#define ENERGY_BAND 8
+
+/**
+ * This structure holds the state shared by the threads adding up the
+ * energy of a lattice.
+ */
+struct energy_sum {
+    struct lattice* lattice;
+    bool air;
+    /* the conductor of each cell, only used for the conductor charges */
+    const int32_t* label;
+    /* the number of sums of each band */
+    uint32_t count;
+    /* the next band of rows */
+    uint32_t next;
+    /* the sums of each band */
+    double* bands;
+};
+
+/**
+ * This function adds up bands of rows until none are left.
+ */
+static void energy_work(void* ptr, uint32_t id, uint32_t count) {
+    struct energy_sum* sum = (struct energy_sum*) ptr;
+    /* the outer ring is left out */
+    uint32_t h = sum->lattice->dim.y-1;
+    uint32_t band;
+
+    (void) id;
+    (void) count;
+
+    while((band = pool_next(&sum->next)) * ENERGY_BAND + 1 < h) {
+        uint32_t first = band*ENERGY_BAND+1;
+        uint32_t last = (first+ENERGY_BAND < h) ? first+ENERGY_BAND : h;
+
+        for(uint32_t j = first; j < last; j++)
+            kernel_energy_row(sum->lattice, j, sum->air, &sum->bands[2*band]);
+    }
+}
+
+/**
+ * This function adds the charge of an edge between two cells to the
+ * conductors on either side.
+ */
+static void energy_edge(const int32_t* label, uint32_t a, uint32_t b, double d, double* sums) {
+    if(label[a] == label[b])
+        return;
+    if(label[a] >= 0)
+        sums[label[a]] += d;
+    if(label[b] >= 0)
+        sums[label[b]] -= d;
+}
+
+/**
+ * This function adds the edges of one row to the charges of the
+ * conductors, with the coefficients of lattice_edges.
+ */
+static void energy_conductor_row(struct lattice* lattice, uint32_t j, bool air, const int32_t* label, double* sums) {
+    uint32_t w = lattice->dim.x;
+    const double* v = lattice->value;
+
+    for(uint32_t i = 1; i < w-1; i++) {
+        uint32_t index = i+j*w;
+        double east, north;
+        lattice_edges(lattice, index, air, &east, &north);
+
+        if(east != 0)
+            energy_edge(label, index, index+1, east*(v[index]-v[index+1]), sums);
+        if(north != 0)
+            energy_edge(label, index, index+w, north*(v[index]-v[index+w]), sums);
+    }
+}
+
+/**
+ * This function adds up the conductor charges of bands of rows until
+ * none are left.
+ */
+static void energy_conductor_work(void* ptr, uint32_t id, uint32_t count) {
+    struct energy_sum* sum = (struct energy_sum*) ptr;
+    uint32_t h = sum->lattice->dim.y-1;
+    uint32_t band;
+
+    (void) id;
+    (void) count;
+
+    while((band = pool_next(&sum->next)) * ENERGY_BAND + 1 < h) {
+        uint32_t first = band*ENERGY_BAND+1;
+        uint32_t last = (first+ENERGY_BAND < h) ? first+ENERGY_BAND : h;
+
+        for(uint32_t j = first; j < last; j++)
+            energy_conductor_row(sum->lattice, j, sum->air, sum->label, &sum->bands[sum->count*band]);
+    }
+}
+
+/**
+ * This function adds the energy outside of the open borders, which is
+ * held by the cells next to them.
+ */
+static void energy_open(struct lattice* lattice, bool air, double* charges) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+    const double* v = lattice->value;
+
+    for(uint32_t j = 1; j < h-1; j++) {
+        /* only the first and last column of the rows in between */
+        uint32_t step = (j == 1 || j == h-2) ? 1 : w-3;
+        for(uint32_t i = 1; i < w-1; i += step) {
+            uint32_t index = i+j*w;
+            if(lattice->cond[index] != NONE)
+                continue;
+
+            double a = v[index];
+            double c = lattice_open_term(lattice, index, air);
+            charges[0] += c*a*fmax(a, 0);
+            charges[1] += c*a*fmin(a, 0);
+        }
+    }
+}
+
+int energy_charges(struct lattice* lattice, struct pool* pool, bool air, double* charges) {
+    uint32_t count = (lattice->dim.y-2+ENERGY_BAND-1)/ENERGY_BAND;
+
+    double* bands = calloc(2*count, sizeof(double));
+    if(bands == NULL)
+        return -1;
+
+    struct energy_sum sum = {lattice, air, NULL, 2, 0, bands};
+    pool_run(pool, energy_work, &sum);
+
+    charges[0] = 0;
+    charges[1] = 0;
+    for(uint32_t k = 0; k < count; k++) {
+        charges[0] += bands[2*k];
+        charges[1] += bands[2*k+1];
+    }
+    if(lattice->open != 0)
+        energy_open(lattice, air, charges);
+
+    free(bands);
+    return 0;
+}
+
+int energy_conductor_charges(struct lattice* lattice, struct pool* pool, bool air, const int32_t* label, uint32_t count, double* charges) {
+    uint32_t bandCount = (lattice->dim.y-2+ENERGY_BAND-1)/ENERGY_BAND;
+
+    double* bands = calloc((size_t) count*bandCount, sizeof(double));
+    if(bands == NULL && count > 0)
+        return -1;
+
+    struct energy_sum sum = {lattice, air, label, count, 0, bands};
+    pool_run(pool, energy_conductor_work, &sum);
+
+    for(uint32_t c = 0; c < count; c++) {
+        charges[c] = 0;
+        for(uint32_t k = 0; k < bandCount; k++)
+            charges[c] += bands[count*k+c];
+    }
+
+    free(bands);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef INCLUDE_ENERGY_H
+#define INCLUDE_ENERGY_H
+
+#include <stdbool.h>
+
+#include "lattice.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This function computes the charges of the traces from the energy
+ * of the field stored in a solved lattice.
+ *
+ * The energy of each edge between adjacent cells is the product of
+ * the weights of both cells and the squared difference of their
+ * values, with the same coefficients as the stencil of the solver.
+ * It is split between the positive and negative part of the
+ * potential. The positive part is the charge of the cells fixed at
+ * 1 and the negative part is the charge of the cells fixed at -1,
+ * with the opposite sign. This follows from the discrete equations
+ * at the free cells, so it holds exactly once the lattice converged.
+ * The energy outside of open borders is held by the cells next to
+ * them and added as well.
+ * Both charges are divided by the permittivity of vacuum.
+ *
+ * The rows are added in bands shared by the threads of the pool. The
+ * sums of the bands are added in order, so the result doesn't depend
+ * on the number of threads.
+ *
+ * @param lattice
+ *        This is a pointer to the solved lattice.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread.
+ * @param air
+ *        Set this to true to ignore the weights of the cells, which
+ *        gives the charges of the same field without dielectric.
+ * @param charges
+ *        This array receives the positive and then the negative
+ *        charge.
+ *
+ * @return 0 if everything went as expected, else -1.
+ */
+int energy_charges(struct lattice* lattice, struct pool* pool, bool air, double* charges);
+
+/**
+ * This function computes the charge of each conductor of a solved
+ * lattice. It uses the same edges as energy_charges, but only the
+ * edges leaving a conductor contribute, which gives the charge of
+ * every conductor in one pass. The charges are divided by the
+ * permittivity of vacuum. The result doesn't depend on the number of
+ * threads.
+ *
+ * @param lattice
+ *        This is a pointer to the solved lattice.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread.
+ * @param air
+ *        Set this to true to ignore the weights of the cells.
+ * @param label
+ *        This array holds the conductor of each cell, a negative
+ *        value for cells not belonging to a conductor.
+ * @param count
+ *        This is the number of conductors.
+ * @param charges
+ *        This array receives the charge of each conductor.
+ *
+ * @return 0 if everything went as expected, else -1.
+ */
+int energy_conductor_charges(struct lattice* lattice, struct pool* pool, bool air, const int32_t* label, uint32_t count, double* charges);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
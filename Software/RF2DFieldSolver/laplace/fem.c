@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fem.h"
+#include "sparse.h"
+
+/**
+ * This marks the points that are not part of the system.
+ */
+#define FEM_FIXED UINT32_MAX
+
+/**
+ * This is the number of triangles handed out at once to a thread.
+ */
+#define FEM_BAND 1024
+
+/**
+ * This structure holds an entry of the system before assembly.
+ */
+struct fem_entry {
+    uint32_t row;
+    uint32_t col;
+    double val;
+};
+
+/**
+ * This structure holds the state shared by the threads adding up the
+ * energy of a problem.
+ */
+struct fem_sum {
+    struct fem* fem;
+    bool air;
+    /* the conductor of each point, only used for the conductor charges */
+    const int32_t* label;
+    /* the number of sums of each band */
+    uint32_t count;
+    /* the next band of triangles */
+    uint32_t next;
+    /* the sums of each band */
+    double* bands;
+};
+
+/**
+ * This function allocates a problem with uninitialised values.
+ */
+static struct fem* fem_alloc(struct mesh* mesh) {
+    struct fem* fem = calloc(1, sizeof(struct fem));
+    if(fem == NULL)
+        return NULL;
+
+    fem->mesh = mesh;
+    fem->epsilon = malloc(mesh->triangles*sizeof(double));
+    fem->cond = malloc(mesh->points*sizeof(uint8_t));
+    fem->value = malloc(mesh->points*sizeof(double));
+    if(fem->epsilon == NULL || fem->cond == NULL || fem->value == NULL) {
+        fem_delete(fem);
+        return NULL;
+    }
+    return fem;
+}
+
+struct fem* fem_new(struct mesh* mesh) {
+    struct fem* fem = fem_alloc(mesh);
+    if(fem == NULL)
+        return NULL;
+
+    for(uint32_t t = 0; t < mesh->triangles; t++)
+        fem->epsilon[t] = 1.0;
+    for(uint32_t i = 0; i < mesh->points; i++) {
+        fem->cond[i] = NONE;
+        fem->value[i] = 0;
+    }
+    return fem;
+}
+
+struct fem* fem_new_uniform(struct fem* from) {
+    struct fem* fem = fem_alloc(from->mesh);
+    if(fem == NULL)
+        return NULL;
+
+    for(uint32_t t = 0; t < fem->mesh->triangles; t++)
+        fem->epsilon[t] = 1.0;
+    memcpy(fem->cond, from->cond, fem->mesh->points*sizeof(uint8_t));
+    memcpy(fem->value, from->value, fem->mesh->points*sizeof(double));
+    fem->abort = from->abort;
+    return fem;
+}
+
+struct fem* fem_new_excitation(struct fem* from, const int32_t* label, int32_t conductor) {
+    struct fem* fem = fem_alloc(from->mesh);
+    if(fem == NULL)
+        return NULL;
+
+    memcpy(fem->epsilon, from->epsilon, fem->mesh->triangles*sizeof(double));
+    memcpy(fem->cond, from->cond, fem->mesh->points*sizeof(uint8_t));
+    for(uint32_t i = 0; i < fem->mesh->points; i++)
+        fem->value[i] = (fem->cond[i] == DIRICHLET && label[i] == conductor) ? 1.0 : 0;
+    fem->abort = from->abort;
+    return fem;
+}
+
+void fem_delete(struct fem* fem) {
+    if(fem == NULL)
+        return;
+
+    free(fem->epsilon);
+    free(fem->cond);
+    free(fem->value);
+    free(fem);
+}
+
+/**
+ * This function computes the stiffness matrix of a triangle, row major.
+ * The rows add up to zero.
+ */
+static void fem_stiffness(struct mesh* mesh, uint32_t t, double epsilon, double* k) {
+    const uint32_t* c = &mesh->corner[3*t];
+    double b[3], d[3];
+
+    for(uint32_t i = 0; i < 3; i++) {
+        const struct rect* p = &mesh->point[c[(i+1)%3]];
+        const struct rect* q = &mesh->point[c[(i+2)%3]];
+        b[i] = p->y-q->y;
+        d[i] = q->x-p->x;
+    }
+    /* twice the area of the triangle */
+    double area = b[0]*d[1]-b[1]*d[0];
+
+    for(uint32_t i = 0; i < 3; i++)
+        for(uint32_t j = 0; j < 3; j++)
+            k[3*i+j] = epsilon*(b[i]*b[j]+d[i]*d[j])/(2*area);
+}
+
+/**
+ * This function compares two entries by row and column.
+ */
+static int fem_compare(const void* a, const void* b) {
+    const struct fem_entry* s = (const struct fem_entry*) a;
+    const struct fem_entry* t = (const struct fem_entry*) b;
+
+    if(s->row != t->row)
+        return s->row < t->row ? -1 : 1;
+    if(s->col != t->col)
+        return s->col < t->col ? -1 : 1;
+    return 0;
+}
+
+/**
+ * This function assembles the system of the free points.
+ */
+static struct sparse* fem_assemble(struct fem* fem, const uint32_t* unknown, uint32_t rows, double* b) {
+    struct mesh* mesh = fem->mesh;
+    struct sparse* matrix = NULL;
+    uint64_t count = 0;
+    double k[9];
+
+    struct fem_entry* entries = malloc(9*(size_t) mesh->triangles*sizeof(struct fem_entry));
+    if(entries == NULL)
+        return NULL;
+
+    for(uint32_t u = 0; u < rows; u++)
+        b[u] = 0;
+
+    for(uint32_t t = 0; t < mesh->triangles; t++) {
+        const uint32_t* c = &mesh->corner[3*t];
+
+        fem_stiffness(mesh, t, fem->epsilon[t], k);
+        for(uint32_t i = 0; i < 3; i++) {
+            uint32_t u = unknown[c[i]];
+            if(u == FEM_FIXED)
+                continue;
+            for(uint32_t j = 0; j < 3; j++) {
+                /* the fixed points move to the right hand side */
+                if(unknown[c[j]] == FEM_FIXED) {
+                    b[u] -= k[3*i+j]*fem->value[c[j]];
+                    continue;
+                }
+                entries[count].row = u;
+                entries[count].col = unknown[c[j]];
+                entries[count].val = k[3*i+j];
+                count++;
+            }
+        }
+    }
+
+    /* the entries of the triangles sharing an edge are added */
+    qsort(entries, count, sizeof(struct fem_entry), fem_compare);
+    uint32_t size = 0;
+    for(uint64_t e = 0; e < count; e++)
+        if(e == 0 || fem_compare(&entries[e], &entries[e-1]) != 0)
+            size++;
+
+    matrix = sparse_new(rows, size);
+    if(matrix == NULL)
+        goto ERROR;
+
+    size = 0;
+    for(uint64_t e = 0; e < count; e++) {
+        if(e > 0 && fem_compare(&entries[e], &entries[e-1]) == 0) {
+            matrix->val[size-1] += entries[e].val;
+            continue;
+        }
+        matrix->col[size] = entries[e].col;
+        matrix->val[size] = entries[e].val;
+        size++;
+        matrix->row[entries[e].row+1] = size;
+    }
+    /* rows without entries start where the last one ended */
+    for(uint32_t u = 1; u <= rows; u++)
+        if(matrix->row[u] < matrix->row[u-1])
+            matrix->row[u] = matrix->row[u-1];
+
+ERROR:
+    free(entries);
+    return matrix;
+}
+
+uint32_t fem_compute(struct fem* fem, struct config* conf, enum preconditioner precond, progress_callback_t cb, void *cb_ptr) {
+    struct mesh* mesh = fem->mesh;
+    struct sparse* matrix = NULL;
+    uint32_t* unknown = malloc(mesh->points*sizeof(uint32_t));
+    uint32_t* point = NULL;
+    double* b = NULL;
+    double* x = NULL;
+    uint32_t rows = 0;
+    uint32_t iterations = COMPUTE_FAILED;
+
+    if(unknown == NULL)
+        goto ERROR;
+
+    /* number the free points */
+    for(uint32_t i = 0; i < mesh->points; i++)
+        unknown[i] = (fem->cond[i] == DIRICHLET) ? FEM_FIXED : rows++;
+
+    point = malloc(rows*sizeof(uint32_t));
+    b = malloc(rows*sizeof(double));
+    x = malloc(rows*sizeof(double));
+    if((point == NULL || b == NULL || x == NULL) && rows > 0)
+        goto ERROR;
+
+    matrix = fem_assemble(fem, unknown, rows, b);
+    if(matrix == NULL)
+        goto ERROR;
+
+    /* start from the current values */
+    for(uint32_t i = 0; i < mesh->points; i++) {
+        if(unknown[i] == FEM_FIXED)
+            continue;
+        point[unknown[i]] = i;
+        x[unknown[i]] = fem->value[i];
+    }
+
+    iterations = sparse_compute_cg(matrix, b, x, conf, precond, fem->abort, cb, cb_ptr);
+    if(iterations == COMPUTE_FAILED)
+        goto ERROR;
+
+    /* copy the solution back to the points */
+    for(uint32_t u = 0; u < rows; u++)
+        fem->value[point[u]] = x[u];
+
+ERROR:
+    sparse_delete(matrix);
+    free(unknown);
+    free(point);
+    free(b);
+    free(x);
+
+    return iterations;
+}
+
+/**
+ * This function adds up the energy of bands of triangles until none
+ * are left.
+ */
+static void fem_work(void* ptr, uint32_t id, uint32_t count) {
+    struct fem_sum* sum = (struct fem_sum*) ptr;
+    struct fem* fem = sum->fem;
+    const double* v = fem->value;
+    uint32_t triangles = fem->mesh->triangles;
+    uint32_t band;
+    double k[9];
+
+    (void) id;
+    (void) count;
+
+    while((band = pool_next(&sum->next)) * FEM_BAND < triangles) {
+        uint32_t first = band*FEM_BAND;
+        uint32_t last = (first+FEM_BAND < triangles) ? first+FEM_BAND : triangles;
+        double pos = 0, neg = 0;
+
+        for(uint32_t t = first; t < last; t++) {
+            const uint32_t* c = &fem->mesh->corner[3*t];
+            fem_stiffness(fem->mesh, t, sum->air ? 1.0 : fem->epsilon[t], k);
+
+            /* the edge between the corners i and j, the coupling is the negative entry */
+            for(uint32_t i = 0; i < 3; i++) {
+                uint32_t j = (i+1)%3;
+                double a = v[c[i]];
+                double e = v[c[j]];
+                double d = -k[3*i+j]*(a-e);
+                pos += d*(fmax(a, 0)-fmax(e, 0));
+                neg += d*(fmin(a, 0)-fmin(e, 0));
+            }
+        }
+        sum->bands[2*band] = pos;
+        sum->bands[2*band+1] = neg;
+    }
+}
+
+/**
+ * This function adds up the conductor charges of bands of triangles
+ * until none are left.
+ */
+static void fem_conductor_work(void* ptr, uint32_t id, uint32_t count) {
+    struct fem_sum* sum = (struct fem_sum*) ptr;
+    struct fem* fem = sum->fem;
+    const double* v = fem->value;
+    const int32_t* label = sum->label;
+    uint32_t triangles = fem->mesh->triangles;
+    uint32_t band;
+    double k[9];
+
+    (void) id;
+    (void) count;
+
+    while((band = pool_next(&sum->next)) * FEM_BAND < triangles) {
+        uint32_t first = band*FEM_BAND;
+        uint32_t last = (first+FEM_BAND < triangles) ? first+FEM_BAND : triangles;
+        double* sums = &sum->bands[sum->count*band];
+
+        for(uint32_t t = first; t < last; t++) {
+            const uint32_t* c = &fem->mesh->corner[3*t];
+            fem_stiffness(fem->mesh, t, sum->air ? 1.0 : fem->epsilon[t], k);
+
+            for(uint32_t i = 0; i < 3; i++) {
+                uint32_t a = c[i];
+                uint32_t e = c[(i+1)%3];
+                if(label[a] == label[e])
+                    continue;
+                double d = -k[3*i+(i+1)%3]*(v[a]-v[e]);
+                if(label[a] >= 0)
+                    sums[label[a]] += d;
+                if(label[e] >= 0)
+                    sums[label[e]] -= d;
+            }
+        }
+    }
+}
+
+int fem_charges(struct fem* fem, struct pool* pool, bool air, double* charges) {
+    uint32_t count = (fem->mesh->triangles+FEM_BAND-1)/FEM_BAND;
+
+    double* bands = calloc(2*(size_t) count+2, sizeof(double));
+    if(bands == NULL)
+        return -1;
+
+    struct fem_sum sum = {fem, air, NULL, 2, 0, bands};
+    pool_run(pool, fem_work, &sum);
+
+    charges[0] = 0;
+    charges[1] = 0;
+    for(uint32_t k = 0; k < count; k++) {
+        charges[0] += bands[2*k];
+        charges[1] += bands[2*k+1];
+    }
+
+    free(bands);
+    return 0;
+}
+
+int fem_conductor_charges(struct fem* fem, struct pool* pool, bool air, const int32_t* label, uint32_t count, double* charges) {
+    uint32_t bandCount = (fem->mesh->triangles+FEM_BAND-1)/FEM_BAND;
+
+    double* bands = calloc((size_t) count*bandCount, sizeof(double));
+    if(bands == NULL && count > 0 && bandCount > 0)
+        return -1;
+
+    struct fem_sum sum = {fem, air, label, count, 0, bands};
+    pool_run(pool, fem_conductor_work, &sum);
+
+    for(uint32_t c = 0; c < count; c++) {
+        charges[c] = 0;
+        for(uint32_t k = 0; k < bandCount; k++)
+            charges[c] += bands[count*k+c];
+    }
+
+    free(bands);
+    return 0;
+}
+
+double fem_interpolate(struct fem* fem, uint32_t triangle, const struct rect* pos, struct rect* gradient) {
+    const uint32_t* c = &fem->mesh->corner[3*triangle];
+    const struct rect* p = fem->mesh->point;
+    const double* v = fem->value;
+
+    /* the potential is a + gx*x + gy*y on the triangle */
+    double bx = p[c[1]].x-p[c[0]].x, by = p[c[1]].y-p[c[0]].y;
+    double cx = p[c[2]].x-p[c[0]].x, cy = p[c[2]].y-p[c[0]].y;
+    double area = bx*cy-by*cx;
+    double dv1 = v[c[1]]-v[c[0]];
+    double dv2 = v[c[2]]-v[c[0]];
+    double gx = (dv1*cy-dv2*by)/area;
+    double gy = (dv2*bx-dv1*cx)/area;
+
+    if(gradient) {
+        gradient->x = gx;
+        gradient->y = gy;
+    }
+    return v[c[0]]+gx*(pos->x-p[c[0]].x)+gy*(pos->y-p[c[0]].y);
+}
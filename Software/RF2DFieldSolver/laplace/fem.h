@@ -0,0 +1,191 @@
+#ifndef INCLUDE_FEM_H
+#define INCLUDE_FEM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cg.h"
+#include "lattice.h"
+#include "mesh.h"
+#include "pool.h"
+#include "worker.h"
+#include "tuple.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure represents the laplace equation on the triangles of
+ * a mesh, with a linear potential on each triangle.
+ */
+struct fem {
+    /**
+     * This is the mesh, it is not owned by the structure.
+     */
+    struct mesh* mesh;
+    /**
+     * This contains the relative permittivity of each triangle.
+     */
+    double* epsilon;
+    /**
+     * This contains the condition of each point, NONE for the free
+     * points and DIRICHLET for the fixed ones (see enum condition).
+     */
+    uint8_t* cond;
+    /**
+     * This contains the potential at each point.
+     */
+    double* value;
+    /**
+     * This points to a flag that stops the computation as soon as
+     * possible once it is set, it may be shared by several problems.
+     * It is @{code NULL} if the computation can't be aborted.
+     */
+    volatile bool* abort;
+};
+
+/**
+ * This function creates the problem on a mesh. All points are free
+ * at 0 and all triangles have a permittivity of 1, the caller sets
+ * the conditions and the permittivities.
+ *
+ * @param mesh
+ *        This is a pointer to the mesh, it must stay valid until the
+ *        problem is freed.
+ *
+ * @return The pointer to the new problem if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct fem* fem_new(struct mesh* mesh);
+
+/**
+ * This function creates a problem with the conditions, values and
+ * abort flag of another problem on the same mesh, but a permittivity
+ * of 1 everywhere.
+ *
+ * @param from
+ *        This is a pointer to the problem to copy.
+ *
+ * @return The pointer to the new problem if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct fem* fem_new_uniform(struct fem* from);
+
+/**
+ * This function creates a problem with the conditions,
+ * permittivities and abort flag of another problem, where only one
+ * conductor is driven. The fixed points of that conductor are set to 1 and all
+ * other points to 0.
+ *
+ * @param from
+ *        This is a pointer to the problem to copy.
+ * @param label
+ *        This array holds the conductor of each point, a negative
+ *        value for points not belonging to a conductor.
+ * @param conductor
+ *        This is the conductor set to 1.
+ *
+ * @return The pointer to the new problem if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct fem* fem_new_excitation(struct fem* from, const int32_t* label, int32_t conductor);
+
+/**
+ * This function frees the memory of a problem, but not its mesh.
+ *
+ * @param fem
+ *        This is a pointer to the problem to free.
+ */
+void fem_delete(struct fem* fem);
+
+/**
+ * This function solves the problem with linear finite elements.
+ *
+ * The stiffness matrix of each triangle is added to the rows of its
+ * free points, the fixed points move to the right hand side. The
+ * system is symmetric positive-definite and solved with
+ * sparse_compute_cg, starting from the current values.
+ *
+ * @param fem
+ *        This is a pointer to the problem.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ * @param precond
+ *        This is the preconditioner of the conjugate gradients.
+ *
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t fem_compute(struct fem* fem, struct config* conf, enum preconditioner precond, progress_callback_t cb, void *cb_ptr);
+
+/**
+ * This function computes the charges of the traces from the energy
+ * of a solved problem, in the same way as energy_charges. Each edge
+ * of each triangle couples its two points with the negative entry of
+ * the stiffness matrix of the triangle. Both charges are divided by
+ * the permittivity of vacuum. The result doesn't depend on the number
+ * of threads.
+ *
+ * @param fem
+ *        This is a pointer to the solved problem.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread.
+ * @param air
+ *        Set this to true to ignore the permittivities.
+ * @param charges
+ *        This array receives the positive and then the negative
+ *        charge.
+ *
+ * @return 0 if everything went as expected, else -1.
+ */
+int fem_charges(struct fem* fem, struct pool* pool, bool air, double* charges);
+
+/**
+ * This function computes the charge of each conductor of a solved
+ * problem with the edges of fem_charges, in the same way as
+ * energy_conductor_charges.
+ *
+ * @param fem
+ *        This is a pointer to the solved problem.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread.
+ * @param air
+ *        Set this to true to ignore the permittivities.
+ * @param label
+ *        This array holds the conductor of each point, a negative
+ *        value for points not belonging to a conductor.
+ * @param count
+ *        This is the number of conductors.
+ * @param charges
+ *        This array receives the charge of each conductor.
+ *
+ * @return 0 if everything went as expected, else -1.
+ */
+int fem_conductor_charges(struct fem* fem, struct pool* pool, bool air, const int32_t* label, uint32_t count, double* charges);
+
+/**
+ * This function interpolates the potential inside a triangle.
+ *
+ * @param fem
+ *        This is a pointer to the solved problem.
+ * @param triangle
+ *        This is the triangle containing the position (see
+ *        mesh_locate).
+ * @param pos
+ *        This is the position.
+ * @param gradient
+ *        This receives the gradient of the potential, which is the
+ *        same on the whole triangle. It may be @{code NULL}.
+ *
+ * @return The potential at the position.
+ */
+double fem_interpolate(struct fem* fem, uint32_t triangle, const struct rect* pos, struct rect* gradient);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
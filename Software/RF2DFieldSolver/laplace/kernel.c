@@ -0,0 +1,354 @@
+#include <math.h>
+
+#include "kernel.h"
+
+/*
+ * The vector kernels need the target attribute and the cpu detection
+ * builtins of GCC and Clang. They are left out on Windows, where GCC
+ * does not align the stack for spilled AVX registers.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && !defined(_WIN32)
+#define KERNEL_X86
+#include <immintrin.h>
+#endif
+
+typedef double (*kernel_row_t)(struct lattice*, uint32_t, uint32_t, uint32_t, uint32_t, double);
+typedef void (*kernel_energy_t)(struct lattice*, uint32_t, uint32_t, uint32_t, double, double, bool, double*);
+
+/**
+ * This structure contains the kernels for one instruction set.
+ */
+struct kernel_set {
+    const char* name;
+    kernel_row_t row;
+    kernel_energy_t energy;
+};
+
+static double kernel_row_scalar(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, uint32_t colour, double omega) {
+    uint32_t w = lattice->dim.x;
+    double diff = 0;
+
+    /* move to the first cell of this colour */
+    if(((first+j+colour)&1) != 0)
+        first++;
+
+    for(uint32_t i = first; i < last; i += 2) {
+        uint32_t index = i+j*w;
+        double value, update;
+
+        /* over-relax the new value, fixed cells keep theirs */
+        value = lattice->value[index];
+        update = omega*(lattice_update(lattice, index)-value);
+        if(fabs(update) > diff) diff = fabs(update);
+
+        /* update the cell */
+        lattice->value[index] = value+update;
+    }
+
+    return diff;
+}
+
+/*
+ * The energy kernels add the edges to the east and north neighbours
+ * of the cells from first to last, multiplied by the given factors.
+ * The energy of each edge is split between the positive and negative
+ * part of the potential, which gives the charges of the traces.
+ */
+
+static void kernel_energy_scalar(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, double hf, double vf, bool air, double* sums) {
+    uint32_t w = lattice->dim.x;
+    const double* v = lattice->value;
+    const double* g = lattice->weight;
+    double pos = 0, neg = 0;
+
+    for(uint32_t i = first; i < last; i++) {
+        uint32_t index = i+j*w;
+        double a = v[index];
+
+        if(hf != 0) {
+            double e = v[index+1];
+            double c = air ? hf : hf*g[index]*g[index+1];
+            double d = c*(a-e);
+            pos += d*(fmax(a, 0)-fmax(e, 0));
+            neg += d*(fmin(a, 0)-fmin(e, 0));
+        }
+        if(vf != 0) {
+            double n = v[index+w];
+            double c = air ? vf : vf*g[index]*g[index+w];
+            double d = c*(a-n);
+            pos += d*(fmax(a, 0)-fmax(n, 0));
+            neg += d*(fmin(a, 0)-fmin(n, 0));
+        }
+    }
+
+    sums[0] += pos;
+    sums[1] += neg;
+}
+
+/**
+ * This function adds up the energy of one row of a graded lattice,
+ * where every edge has its own coefficient.
+ */
+static void kernel_energy_graded(struct lattice* lattice, uint32_t j, bool air, double* sums) {
+    uint32_t w = lattice->dim.x;
+    const double* v = lattice->value;
+    double pos = 0, neg = 0;
+
+    for(uint32_t i = 1; i < w-1; i++) {
+        uint32_t index = i+j*w;
+        double a = v[index];
+        double east, north;
+        lattice_edges(lattice, index, air, &east, &north);
+
+        double e = v[index+1];
+        double d = east*(a-e);
+        pos += d*(fmax(a, 0)-fmax(e, 0));
+        neg += d*(fmin(a, 0)-fmin(e, 0));
+
+        double n = v[index+w];
+        d = north*(a-n);
+        pos += d*(fmax(a, 0)-fmax(n, 0));
+        neg += d*(fmin(a, 0)-fmin(n, 0));
+    }
+
+    sums[0] += pos;
+    sums[1] += neg;
+}
+
+#ifdef KERNEL_X86
+
+/*
+ * The vector kernels compute all the cells of a row, in the same
+ * order of operations as lattice_update, and only store the cells of
+ * the requested colour. Since the column advances by an even number
+ * of cells, the colour of each lane never changes within a row.
+ */
+
+__attribute__((target("avx2")))
+static double kernel_row_avx2(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, uint32_t colour, double omega) {
+    uint32_t w = lattice->dim.x;
+    double* v = lattice->value+j*w;
+    const double* cc = lattice->coeff[STENCIL_C]+j*w;
+    const double* cw = lattice->coeff[STENCIL_W]+j*w;
+    const double* ce = lattice->coeff[STENCIL_E]+j*w;
+    const double* cs = lattice->coeff[STENCIL_S]+j*w;
+    const double* cn = lattice->coeff[STENCIL_N]+j*w;
+    __m256d om = _mm256_set1_pd(omega);
+    __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d dmax = _mm256_setzero_pd();
+    double lanes[4], diff;
+    uint32_t i;
+
+    /* the cell of the first lane has the requested colour if i+j+colour is even */
+    __m256i mask = ((first+j+colour)&1) == 0
+        ? _mm256_set_epi64x(0, -1, 0, -1)
+        : _mm256_set_epi64x(-1, 0, -1, 0);
+
+    for(i = first; i+4 <= last; i += 4) {
+        __m256d value = _mm256_loadu_pd(v+i);
+        __m256d sum = _mm256_mul_pd(_mm256_loadu_pd(cc+i), value);
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(cw+i), _mm256_loadu_pd(v+i-1)));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(ce+i), _mm256_loadu_pd(v+i+1)));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(cs+i), _mm256_loadu_pd(v+i-w)));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(cn+i), _mm256_loadu_pd(v+i+w)));
+
+        /* over-relax and only keep the cells of this colour */
+        __m256d update = _mm256_and_pd(_mm256_mul_pd(om, _mm256_sub_pd(sum, value)), _mm256_castsi256_pd(mask));
+        dmax = _mm256_max_pd(dmax, _mm256_andnot_pd(sign, update));
+        _mm256_maskstore_pd(v+i, mask, _mm256_add_pd(value, update));
+    }
+
+    _mm256_storeu_pd(lanes, dmax);
+    diff = fmax(fmax(lanes[0], lanes[1]), fmax(lanes[2], lanes[3]));
+
+    /* the remaining cells */
+    return fmax(diff, kernel_row_scalar(lattice, j, i, last, colour, omega));
+}
+
+__attribute__((target("avx512f")))
+static double kernel_row_avx512(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, uint32_t colour, double omega) {
+    uint32_t w = lattice->dim.x;
+    double* v = lattice->value+j*w;
+    const double* cc = lattice->coeff[STENCIL_C]+j*w;
+    const double* cw = lattice->coeff[STENCIL_W]+j*w;
+    const double* ce = lattice->coeff[STENCIL_E]+j*w;
+    const double* cs = lattice->coeff[STENCIL_S]+j*w;
+    const double* cn = lattice->coeff[STENCIL_N]+j*w;
+    __m512d om = _mm512_set1_pd(omega);
+    __m512d dmax = _mm512_setzero_pd();
+    double diff;
+    uint32_t i;
+
+    /* the cell of the first lane has the requested colour if i+j+colour is even */
+    __mmask8 mask = ((first+j+colour)&1) == 0 ? 0x55 : 0xAA;
+
+    for(i = first; i+8 <= last; i += 8) {
+        __m512d value = _mm512_loadu_pd(v+i);
+        __m512d sum = _mm512_mul_pd(_mm512_loadu_pd(cc+i), value);
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(cw+i), _mm512_loadu_pd(v+i-1)));
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(ce+i), _mm512_loadu_pd(v+i+1)));
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(cs+i), _mm512_loadu_pd(v+i-w)));
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(cn+i), _mm512_loadu_pd(v+i+w)));
+
+        /* over-relax and only keep the cells of this colour */
+        __m512d update = _mm512_maskz_mul_pd(mask, om, _mm512_sub_pd(sum, value));
+        dmax = _mm512_max_pd(dmax, _mm512_abs_pd(update));
+        _mm512_mask_storeu_pd(v+i, mask, _mm512_add_pd(value, update));
+    }
+
+    diff = _mm512_reduce_max_pd(dmax);
+
+    /* the remaining cells */
+    return fmax(diff, kernel_row_scalar(lattice, j, i, last, colour, omega));
+}
+
+__attribute__((target("avx2")))
+static void kernel_energy_avx2(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, double hf, double vf, bool air, double* sums) {
+    uint32_t w = lattice->dim.x;
+    const double* v = lattice->value+j*w;
+    const double* g = lattice->weight+j*w;
+    __m256d zero = _mm256_setzero_pd();
+    __m256d pos = _mm256_setzero_pd();
+    __m256d neg = _mm256_setzero_pd();
+    double lanes[4];
+    uint32_t i;
+
+    for(i = first; i+4 <= last; i += 4) {
+        __m256d a = _mm256_loadu_pd(v+i);
+        __m256d pa = _mm256_max_pd(a, zero);
+        __m256d na = _mm256_min_pd(a, zero);
+        __m256d ch = _mm256_set1_pd(hf);
+        __m256d cv = _mm256_set1_pd(vf);
+        if(!air) {
+            __m256d ga = _mm256_loadu_pd(g+i);
+            ch = _mm256_mul_pd(ch, _mm256_mul_pd(ga, _mm256_loadu_pd(g+i+1)));
+            cv = _mm256_mul_pd(cv, _mm256_mul_pd(ga, _mm256_loadu_pd(g+i+w)));
+        }
+
+        __m256d e = _mm256_loadu_pd(v+i+1);
+        __m256d d = _mm256_mul_pd(ch, _mm256_sub_pd(a, e));
+        pos = _mm256_add_pd(pos, _mm256_mul_pd(d, _mm256_sub_pd(pa, _mm256_max_pd(e, zero))));
+        neg = _mm256_add_pd(neg, _mm256_mul_pd(d, _mm256_sub_pd(na, _mm256_min_pd(e, zero))));
+
+        /* the last row has no north edge, its factor is zero */
+        if(vf != 0) {
+            __m256d n = _mm256_loadu_pd(v+i+w);
+            d = _mm256_mul_pd(cv, _mm256_sub_pd(a, n));
+            pos = _mm256_add_pd(pos, _mm256_mul_pd(d, _mm256_sub_pd(pa, _mm256_max_pd(n, zero))));
+            neg = _mm256_add_pd(neg, _mm256_mul_pd(d, _mm256_sub_pd(na, _mm256_min_pd(n, zero))));
+        }
+    }
+
+    _mm256_storeu_pd(lanes, pos);
+    sums[0] += (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+    _mm256_storeu_pd(lanes, neg);
+    sums[1] += (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+
+    /* the remaining cells */
+    kernel_energy_scalar(lattice, j, i, last, hf, vf, air, sums);
+}
+
+__attribute__((target("avx512f")))
+static void kernel_energy_avx512(struct lattice* lattice, uint32_t j, uint32_t first, uint32_t last, double hf, double vf, bool air, double* sums) {
+    uint32_t w = lattice->dim.x;
+    const double* v = lattice->value+j*w;
+    const double* g = lattice->weight+j*w;
+    __m512d zero = _mm512_setzero_pd();
+    __m512d pos = _mm512_setzero_pd();
+    __m512d neg = _mm512_setzero_pd();
+    uint32_t i;
+
+    for(i = first; i+8 <= last; i += 8) {
+        __m512d a = _mm512_loadu_pd(v+i);
+        __m512d pa = _mm512_max_pd(a, zero);
+        __m512d na = _mm512_min_pd(a, zero);
+        __m512d ch = _mm512_set1_pd(hf);
+        __m512d cv = _mm512_set1_pd(vf);
+        if(!air) {
+            __m512d ga = _mm512_loadu_pd(g+i);
+            ch = _mm512_mul_pd(ch, _mm512_mul_pd(ga, _mm512_loadu_pd(g+i+1)));
+            cv = _mm512_mul_pd(cv, _mm512_mul_pd(ga, _mm512_loadu_pd(g+i+w)));
+        }
+
+        __m512d e = _mm512_loadu_pd(v+i+1);
+        __m512d d = _mm512_mul_pd(ch, _mm512_sub_pd(a, e));
+        pos = _mm512_fmadd_pd(d, _mm512_sub_pd(pa, _mm512_max_pd(e, zero)), pos);
+        neg = _mm512_fmadd_pd(d, _mm512_sub_pd(na, _mm512_min_pd(e, zero)), neg);
+
+        /* the last row has no north edge, its factor is zero */
+        if(vf != 0) {
+            __m512d n = _mm512_loadu_pd(v+i+w);
+            d = _mm512_mul_pd(cv, _mm512_sub_pd(a, n));
+            pos = _mm512_fmadd_pd(d, _mm512_sub_pd(pa, _mm512_max_pd(n, zero)), pos);
+            neg = _mm512_fmadd_pd(d, _mm512_sub_pd(na, _mm512_min_pd(n, zero)), neg);
+        }
+    }
+
+    sums[0] += _mm512_reduce_add_pd(pos);
+    sums[1] += _mm512_reduce_add_pd(neg);
+
+    /* the remaining cells */
+    kernel_energy_scalar(lattice, j, i, last, hf, vf, air, sums);
+}
+
+#endif
+
+static const struct kernel_set kernel_scalar = {"scalar", &kernel_row_scalar, &kernel_energy_scalar};
+#ifdef KERNEL_X86
+static const struct kernel_set kernel_avx2 = {"AVX2", &kernel_row_avx2, &kernel_energy_avx2};
+static const struct kernel_set kernel_avx512 = {"AVX-512", &kernel_row_avx512, &kernel_energy_avx512};
+#endif
+
+/**
+ * This function picks the widest kernels supported by the processor.
+ */
+static const struct kernel_set* kernel_select(void) {
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return &kernel_avx512;
+    if(__builtin_cpu_supports("avx2"))
+        return &kernel_avx2;
+#endif
+    return &kernel_scalar;
+}
+
+static const struct kernel_set* kernel = NULL;
+
+double kernel_sweep_row(struct lattice* lattice, uint32_t row, uint32_t first, uint32_t last, uint32_t colour, double omega) {
+    /* all threads select the same kernel, so a race is harmless */
+    if(kernel == NULL)
+        kernel = kernel_select();
+
+    return (*kernel->row)(lattice, row, first, last, colour, omega);
+}
+
+void kernel_energy_row(struct lattice* lattice, uint32_t row, bool air, double* sums) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+
+    if(kernel == NULL)
+        kernel = kernel_select();
+
+    if(lattice->xs != NULL) {
+        kernel_energy_graded(lattice, row, air, sums);
+        return;
+    }
+
+    /* the edges along the outer cells are shared with their mirror image */
+    double hf = (row == 1 || row == h-2) ? 0.5 : 1.0;
+    /* the last row has no edge to the outer ring */
+    double vf = (row == h-2) ? 0 : 1.0;
+
+    /* the first and last columns are added on their own */
+    kernel_energy_scalar(lattice, row, 1, 2, hf, 0.5*vf, air, sums);
+    (*kernel->energy)(lattice, row, 2, w-2, hf, vf, air, sums);
+    kernel_energy_scalar(lattice, row, w-2, w-1, 0, 0.5*vf, air, sums);
+}
+
+const char* kernel_name(void) {
+    if(kernel == NULL)
+        kernel = kernel_select();
+
+    return kernel->name;
+}
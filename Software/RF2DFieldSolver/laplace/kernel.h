@@ -0,0 +1,67 @@
+#ifndef INCLUDE_KERNEL_H
+#define INCLUDE_KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lattice.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This function over-relaxes all the cells of one colour in a part
+ * of a row of the lattice, like sor_sweep_tiles does for a tile.
+ *
+ * Several cells of the same colour are computed at once with the
+ * widest vector instructions supported by the processor, which are
+ * detected on the first call. The result only differs from the
+ * scalar computation by rounding.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param row
+ *        This is the row to update, it must not be on the outer ring.
+ * @param first
+ *        This is the first column to update, at least 1.
+ * @param last
+ *        This is the column following the last one, at most dim.x-1.
+ * @param colour
+ *        This selects the cells to update, 0 or 1.
+ * @param omega
+ *        This is the over-relaxation factor, 1 gives Gauss-Seidel.
+ *
+ * @return The largest difference applied to a cell.
+ */
+double kernel_sweep_row(struct lattice* lattice, uint32_t row, uint32_t first, uint32_t last, uint32_t colour, double omega);
+
+/**
+ * This function adds the contributions of one row of the lattice to
+ * the charges computed by energy_charges. Each cell contributes the
+ * edges to its east and north neighbours, the edges to the outer ring
+ * are left out and the edges along the outer cells count half.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param row
+ *        This is the row to add, it must not be on the outer ring.
+ * @param air
+ *        Set this to true to ignore the weights of the cells.
+ * @param sums
+ *        These are the two sums the row is added to, first the
+ *        positive and then the negative part of the potential.
+ */
+void kernel_energy_row(struct lattice* lattice, uint32_t row, bool air, double* sums);
+
+/**
+ * This function returns the name of the instruction set used by
+ * kernel_sweep_row and kernel_energy_row.
+ */
+const char* kernel_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,11 +1,116 @@
 #include "laplace.h"
 
+#include <algorithm>
+#include <numeric>
+
 #include <QPolygonF>
 
+#include "sor.h"
+#include "multigrid.h"
+#include "cg.h"
+#include "energy.h"
+#include "adapt.h"
+#include "mesh.h"
+#include "pool.h"
+
+namespace {
+
+// The helpers below work along one axis of the lattice. A graded lattice has the positions of its cells in the mesh,
+// without the outer ring, a uniform lattice has an empty mesh and uses the distance between the cells instead.
+// The cells are counted from the outer ring like the cells of the lattice
+
+// the position of a cell, the outer ring mirrors the cells next to it
+double meshPosition(const QVector<double> &mesh, double step, int index)
+{
+    if(mesh.isEmpty()) {
+        return (index - 1) * step;
+    }
+    if(index < 1) {
+        return 2 * mesh.first() - mesh[1];
+    }
+    if(index > mesh.size()) {
+        return 2 * mesh.last() - mesh[mesh.size() - 2];
+    }
+    return mesh[index - 1];
+}
+
+// the fractional cell at a position, linear between the cells and beyond the first and last one
+double meshIndex(const QVector<double> &mesh, double step, double pos)
+{
+    if(mesh.isEmpty()) {
+        return pos / step + 1;
+    }
+    int k = std::upper_bound(mesh.begin(), mesh.end(), pos) - mesh.begin() - 1;
+    k = qBound(0, k, (int) mesh.size() - 2);
+    return k + 1 + (pos - mesh[k]) / (mesh[k + 1] - mesh[k]);
+}
+
+// the positions of the cells from 0 to the length, one grid step apart at the breakpoints. The distance grows
+// geometrically away from them, so the field is resolved where it changes fast and little cells are spent elsewhere
+QVector<double> gradeAxis(QVector<double> breakpoints, double length)
+{
+    constexpr double finest = 1.0;
+    constexpr double ratio = 1.2;
+    constexpr double coarsest = 16.0;
+
+    // breakpoints closer than half a step would only add tiny cells
+    std::sort(breakpoints.begin(), breakpoints.end());
+    QVector<double> points = {0};
+    for(auto p : breakpoints) {
+        if(p > points.last() + finest / 2 && p < length - finest / 2) {
+            points.append(p);
+        }
+    }
+    points.append(length);
+
+    QVector<double> mesh = {0};
+    for(int k=0;k+1<points.size();k++) {
+        // grow the cells from both ends of the interval towards its middle
+        double from = points[k];
+        double to = points[k + 1];
+        QVector<double> upper = {to};
+        double step = finest;
+        while(to - from >= 3 * step) {
+            from += step;
+            mesh.append(from);
+            to -= step;
+            upper.prepend(to);
+            step = std::min(step * ratio, coarsest);
+        }
+        // the gap left in the middle is split evenly
+        int n = std::max(1L, lround((to - from) / step));
+        for(int i=1;i<n;i++) {
+            mesh.append(from + (to - from) * i / n);
+        }
+        mesh += upper;
+    }
+    return mesh;
+}
+
+// splits the intervals of a mesh in half where the estimate reaches the limit, unless they would become smaller
+// than the finest step. Returns the number of split intervals
+int splitIntervals(QVector<double> &mesh, const QVector<double> &estimate, double limit, double finest)
+{
+    QVector<double> refined = {mesh.first()};
+    int count = 0;
+    for(int k=0;k+1<mesh.size();k++) {
+        if(estimate[k] >= limit && mesh[k + 1] - mesh[k] >= 2 * finest) {
+            refined.append((mesh[k] + mesh[k + 1]) / 2);
+            count++;
+        }
+        refined.append(mesh[k + 1]);
+    }
+    mesh = refined;
+    return count;
+}
+
+}
+
 Laplace::Laplace(QObject *parent)
     : QObject{parent}
 {
     calculationRunning = false;
+    abortRequested = false;
     resultReady = false;
     list = nullptr;
     grid = 1e-5;
@@ -13,7 +118,145 @@ Laplace::Laplace(QObject *parent)
     threshold = 1e-6;
     lattice = nullptr;
     groundedBorders = true;
+    openBorders = false;
     ignoreDielectric = false;
+    solver = Solver::GaussSeidel;
+    preconditioner = Preconditioner::Multigrid;
+    nestedIteration = false;
+    warmStart = false;
+    airSolve = false;
+    conductorMatrix = false;
+    useSymmetry = false;
+    symmetry = Symmetry::None;
+    symmetryCenter = 0;
+    symmetryPlane = 0;
+    gradedMesh = false;
+    adaptiveMesh = false;
+    triangleMesh = false;
+    triangles = nullptr;
+    fem = nullptr;
+    airFem = nullptr;
+    potentialHint = MESH_NONE;
+    airLattice = nullptr;
+    airTarget = nullptr;
+    airConf = {1, threshold, nullptr};
+    airIterations = 0;
+    latticeSettings = getLatticeSettings(nullptr);
+    previous = nullptr;
+    previousSettings = latticeSettings;
+    pool = nullptr;
+    airPool = nullptr;
+}
+
+Laplace::~Laplace()
+{
+    if(calculationRunning) {
+        abortCalculation();
+        pthread_join(thread, nullptr);
+    }
+    pool_delete(pool);
+    pool_delete(airPool);
+    if(lattice) {
+        lattice_delete(lattice);
+    }
+    if(airLattice) {
+        lattice_delete(airLattice);
+    }
+    if(previous) {
+        lattice_delete(previous);
+    }
+    deleteTriangles();
+}
+
+QString Laplace::SolverToString(Solver solver)
+{
+    switch(solver) {
+    case Solver::GaussSeidel: return "Gauss-Seidel";
+    case Solver::RedBlackSOR: return "Red-black SOR";
+    case Solver::Multigrid: return "Multigrid";
+    case Solver::ConjugateGradient: return "Conjugate gradient";
+    case Solver::Last: return "";
+    }
+    return "";
+}
+
+Laplace::Solver Laplace::SolverFromString(QString s)
+{
+    for(unsigned int i=0;i<(int) Solver::Last;i++) {
+        if(s == SolverToString((Solver) i)) {
+            return (Solver) i;
+        }
+    }
+    return Solver::Last;
+}
+
+QList<Laplace::Solver> Laplace::getSolvers()
+{
+    QList<Solver> ret;
+    for(unsigned int i=0;i<(int) Solver::Last;i++) {
+        ret.append((Solver) i);
+    }
+    return ret;
+}
+
+QString Laplace::PreconditionerToString(Preconditioner p)
+{
+    switch(p) {
+    case Preconditioner::Jacobi: return "Jacobi";
+    case Preconditioner::IncompleteCholesky: return "Incomplete Cholesky";
+    case Preconditioner::Multigrid: return "Multigrid";
+    case Preconditioner::Last: return "";
+    }
+    return "";
+}
+
+Laplace::Preconditioner Laplace::PreconditionerFromString(QString s)
+{
+    for(unsigned int i=0;i<(int) Preconditioner::Last;i++) {
+        if(s == PreconditionerToString((Preconditioner) i)) {
+            return (Preconditioner) i;
+        }
+    }
+    return Preconditioner::Last;
+}
+
+QList<Laplace::Preconditioner> Laplace::getPreconditioners()
+{
+    QList<Preconditioner> ret;
+    for(unsigned int i=0;i<(int) Preconditioner::Last;i++) {
+        ret.append((Preconditioner) i);
+    }
+    return ret;
+}
+
+QString Laplace::ExtractionToString(Extraction e)
+{
+    switch(e) {
+    case Extraction::GaussIntegration: return "Gauss integration";
+    case Extraction::FieldEnergy: return "Field energy";
+    case Extraction::FieldEnergyChecked: return "Field energy, checked";
+    case Extraction::Last: return "";
+    }
+    return "";
+}
+
+Laplace::Extraction Laplace::ExtractionFromString(QString s)
+{
+    for(unsigned int i=0;i<(int) Extraction::Last;i++) {
+        if(s == ExtractionToString((Extraction) i)) {
+            return (Extraction) i;
+        }
+    }
+    return Extraction::Last;
+}
+
+QList<Laplace::Extraction> Laplace::getExtractions()
+{
+    QList<Extraction> ret;
+    for(unsigned int i=0;i<(int) Extraction::Last;i++) {
+        ret.append((Extraction) i);
+    }
+    return ret;
 }
 
 void Laplace::setArea(const QPointF &topLeft, const QPointF &bottomRight)
@@ -63,6 +306,14 @@ void Laplace::setGroundedBorders(bool gnd)
     groundedBorders = gnd;
 }
 
+void Laplace::setOpenBorders(bool open)
+{
+    if(calculationRunning) {
+        return;
+    }
+    openBorders = open;
+}
+
 void Laplace::setIgnoreDielectric(bool ignore)
 {
     if(calculationRunning) {
@@ -71,20 +322,151 @@ void Laplace::setIgnoreDielectric(bool ignore)
     ignoreDielectric = ignore;
 }
 
+void Laplace::setSolver(Solver solver)
+{
+    if(calculationRunning) {
+        return;
+    }
+    if(solver != Solver::Last) {
+        this->solver = solver;
+    }
+}
+
+void Laplace::setPreconditioner(Preconditioner preconditioner)
+{
+    if(calculationRunning) {
+        return;
+    }
+    if(preconditioner != Preconditioner::Last) {
+        this->preconditioner = preconditioner;
+    }
+}
+
+void Laplace::setNestedIteration(bool nested)
+{
+    if(calculationRunning) {
+        return;
+    }
+    nestedIteration = nested;
+}
+
+void Laplace::setWarmStart(bool warm)
+{
+    if(calculationRunning) {
+        return;
+    }
+    warmStart = warm;
+}
+
+void Laplace::setAirSolve(bool air)
+{
+    if(calculationRunning) {
+        return;
+    }
+    airSolve = air;
+}
+
+void Laplace::setConductorMatrix(bool matrix)
+{
+    if(calculationRunning) {
+        return;
+    }
+    conductorMatrix = matrix;
+}
+
+void Laplace::setUseSymmetry(bool use)
+{
+    if(calculationRunning) {
+        return;
+    }
+    useSymmetry = use;
+}
+
+void Laplace::setGradedMesh(bool graded)
+{
+    if(calculationRunning) {
+        return;
+    }
+    gradedMesh = graded;
+}
+
+void Laplace::setAdaptiveMesh(bool adaptive)
+{
+    if(calculationRunning) {
+        return;
+    }
+    adaptiveMesh = adaptive;
+}
+
+void Laplace::setTriangleMesh(bool triangles)
+{
+    if(calculationRunning) {
+        return;
+    }
+    triangleMesh = triangles;
+}
+
+void Laplace::setCacheDirectory(const QString &directory)
+{
+    cache.setDirectory(directory);
+}
+
 bool Laplace::startCalculation(ElementList *list)
 {
     if(calculationRunning) {
         return false;
     }
     calculationRunning = true;
+    abortRequested = false;
     resultReady = false;
     lastPercent = 0;
     emit info("Laplace calculation starting");
-    if(lattice) {
-        delete lattice;
+    if(previous) {
+        lattice_delete(previous);
+        previous = nullptr;
+    }
+    changedArea = QRectF();
+    symmetry = findSymmetry(list);
+    createMesh(list);
+    // the triangles are built from scratch for every calculation
+    deleteTriangles();
+    if(triangleMesh && lattice) {
+        lattice_delete(lattice);
         lattice = nullptr;
     }
+    auto settings = getLatticeSettings(list);
+    if(lattice && warmStart && settings == latticeSettings) {
+        // only the cells around the changed elements have to be built again
+        changedArea = list->getChangedArea();
+        if(symmetry != Symmetry::None && !changedArea.isNull()) {
+            // the changes right of the plane show up on the solved half as well
+            auto r = changedArea;
+            changedArea = changedArea.united(QRectF(QPointF(2 * symmetryCenter - r.right(), r.top()), QPointF(2 * symmetryCenter - r.left(), r.bottom())).normalized());
+        }
+    } else if(lattice) {
+        if(warmStart && settings.symmetry == latticeSettings.symmetry) {
+            // keep the last solution as the starting point
+            previous = lattice;
+            previousSettings = latticeSettings;
+        } else {
+            lattice_delete(lattice);
+        }
+        lattice = nullptr;
+    }
+    list->clearChangedArea();
     this->list = list;
+    solutionKey = getSolutionKey(list);
+    results.clear();
+    conductorNames.clear();
+    capacitances.clear();
+    airCapacitances.clear();
+    if(conductorMatrix) {
+        for(auto e : list->getElements()) {
+            if(e->getType() == Element::Type::TracePos || e->getType() == Element::Type::TraceNeg) {
+                conductorNames.append(e->getName());
+            }
+        }
+    }
 
     // start the calculation thread
     auto err = pthread_create(&thread, nullptr, calcThreadTrampoline, this);
@@ -102,7 +484,7 @@ void Laplace::abortCalculation()
         return;
     }
     // request abort of calculation
-    lattice->abort = true;
+    abortRequested = true;
 }
 
 double Laplace::getPotential(const QPointF &p)
@@ -110,15 +492,25 @@ double Laplace::getPotential(const QPointF &p)
     if(!resultReady) {
         return std::numeric_limits<double>::quiet_NaN();
     }
-    auto pos = coordToRect(p);
-    // convert to integers and shift by the added outside boundary of NaNs
-    int index_x = round(pos.x) + 1;
-    int index_y = round(pos.y) + 1;
+    auto point = p;
+    double sign;
+    mirror(point, sign);
+    auto pos = coordToRect(point);
+    if(fem) {
+        // the pixels are drawn in order, so the last triangle is usually close
+        potentialHint = mesh_locate(triangles, &pos, potentialHint);
+        if(potentialHint == MESH_NONE) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return sign * fem_interpolate(fem, potentialHint, &pos, nullptr);
+    }
+    // the nearest cell, shifted by the added outside boundary of NaNs
+    int index_x = lround(meshIndex(meshX, lattice->step.x, pos.x));
+    int index_y = lround(meshIndex(meshY, lattice->step.y, pos.y));
     if(index_x < 0 || index_x >= (int) lattice->dim.x || index_y < 0 || index_y >= (int) lattice->dim.y) {
         return std::numeric_limits<double>::quiet_NaN();
     }
-    auto c = &lattice->cells[index_x+index_y*lattice->dim.x];
-    return c->value;
+    return sign * lattice->value[index_x+index_y*lattice->dim.x];
 }
 
 QLineF Laplace::getGradient(const QPointF &p)
@@ -127,29 +519,169 @@ QLineF Laplace::getGradient(const QPointF &p)
     if(!resultReady) {
         return ret;
     }
-    auto pos = coordToRect(p);
-    // convert to integers and shift by the added outside boundary of NaNs
-    int index_x = floor(pos.x) + 1;
-    int index_y = floor(pos.y) + 1;
+    auto point = p;
+    double sign;
+    bool mirrored = mirror(point, sign);
+    auto pos = coordToRect(point);
+    double grad_x, grad_y;
+    if(fem) {
+        // the gradient is the same on the whole triangle
+        auto t = mesh_locate(triangles, &pos, MESH_NONE);
+        if(t == MESH_NONE) {
+            return ret;
+        }
+        struct rect gradient;
+        fem_interpolate(fem, t, &pos, &gradient);
+        grad_x = gradient.x;
+        grad_y = gradient.y;
+    } else {
+        // the cell below and left of the point, shifted by the added outside boundary of NaNs
+        int index_x = floor(meshIndex(meshX, lattice->step.x, pos.x));
+        int index_y = floor(meshIndex(meshY, lattice->step.y, pos.y));
 
-    if(index_x < 0 || index_x + 1 >= (int) lattice->dim.x || index_y < 0 || index_y + 1>= (int) lattice->dim.y) {
-        return ret;
+        if(index_x < 0 || index_x + 1 >= (int) lattice->dim.x || index_y < 0 || index_y + 1>= (int) lattice->dim.y) {
+            return ret;
+        }
+        // calculate gradient
+        auto index = index_x+index_y*lattice->dim.x;
+        auto dx = meshPosition(meshX, lattice->step.x, index_x + 1) - meshPosition(meshX, lattice->step.x, index_x);
+        auto dy = meshPosition(meshY, lattice->step.y, index_y + 1) - meshPosition(meshY, lattice->step.y, index_y);
+        grad_x = (lattice->value[index+1] - lattice->value[index]) / dx;
+        grad_y = (lattice->value[index+lattice->dim.x] - lattice->value[index]) / dy;
+    }
+    if(mirrored) {
+        grad_x *= -sign;
+        grad_y *= sign;
     }
-    // calculate gradient
-    auto c_floor = &lattice->cells[index_x+index_y*lattice->dim.x];
-    auto c_x = &lattice->cells[index_x+1+index_y*lattice->dim.x];
-    auto c_y = &lattice->cells[index_x+(index_y+1)*lattice->dim.x];
-    auto grad_x = c_x->value - c_floor->value;
-    auto grad_y = c_y->value - c_floor->value;
     ret.setP2(p + QPointF(grad_x, grad_y));
     return ret;
 }
 
+void Laplace::sampleField(const QPointF *points, int count, QPointF *gradients, double *epsilon, bool air)
+{
+    for(int k=0;k<count;k++) {
+        gradients[k] = QPointF(0, 0);
+        if(epsilon) {
+            epsilon[k] = 1.0;
+        }
+    }
+    if(!resultReady) {
+        return;
+    }
+    if(fem) {
+        // the gradient and the permittivity are those of the triangle containing the point.
+        // The points are usually close to each other, so the search starts at the last triangle
+        auto problem = air && airFem ? airFem : fem;
+        uint32_t hint = MESH_NONE;
+        for(int k=0;k<count;k++) {
+            auto pos = coordToRect(points[k]);
+            auto t = mesh_locate(triangles, &pos, hint);
+            if(t == MESH_NONE) {
+                continue;
+            }
+            hint = t;
+            struct rect gradient;
+            fem_interpolate(problem, t, &pos, &gradient);
+            gradients[k] = QPointF(gradient.x, gradient.y);
+            if(epsilon) {
+                epsilon[k] = problem->epsilon[t];
+            }
+        }
+        return;
+    }
+    auto lattice = air && airLattice ? airLattice : this->lattice;
+    const int w = lattice->dim.x;
+    const int h = lattice->dim.y;
+    const double *value = lattice->value;
+    const uint8_t *cond = lattice->cond;
+    const auto step = lattice->step;
+    // the central difference at a cell, the outer ring mirrors the cells inside
+    auto gradientAt = [&](int index) {
+        int i = index % w;
+        int j = index / w;
+        auto west = cond[index-1] == NEUMANN ? value[index+1] : value[index-1];
+        auto east = cond[index+1] == NEUMANN ? value[index-1] : value[index+1];
+        auto south = cond[index-w] == NEUMANN ? value[index+w] : value[index-w];
+        auto north = cond[index+w] == NEUMANN ? value[index-w] : value[index+w];
+        auto dx = meshPosition(meshX, step.x, i + 1) - meshPosition(meshX, step.x, i - 1);
+        auto dy = meshPosition(meshY, step.y, j + 1) - meshPosition(meshY, step.y, j - 1);
+        return QPointF((east - west) / dx, (north - south) / dy);
+    };
+    for(int k=0;k<count;k++) {
+        auto point = points[k];
+        double sign;
+        bool mirrored = mirror(point, sign);
+        auto pos = coordToRect(point);
+        // position in cells, shifted by the outer ring
+        double x = meshIndex(meshX, step.x, pos.x);
+        double y = meshIndex(meshY, step.y, pos.y);
+        int i = floor(x);
+        int j = floor(y);
+        if(i < 1 || i + 1 > w - 2 || j < 1 || j + 1 > h - 2) {
+            continue;
+        }
+        double fx = x - i;
+        double fy = y - j;
+        int index = i + j * w;
+        gradients[k] = gradientAt(index) * (1 - fx) * (1 - fy) + gradientAt(index + 1) * fx * (1 - fy)
+                + gradientAt(index + w) * (1 - fx) * fy + gradientAt(index + w + 1) * fx * fy;
+        if(mirrored) {
+            gradients[k] = QPointF(-sign * gradients[k].x(), sign * gradients[k].y());
+        }
+        if(epsilon) {
+            // the weight of a cell is the square root of its permittivity
+            auto weight = lattice->weight[lround(x) + lround(y) * w];
+            epsilon[k] = weight * weight;
+        }
+    }
+}
+
+bool Laplace::getEnergyCharges(bool air, double &positive, double &negative)
+{
+    if(!resultReady) {
+        return false;
+    }
+    double charges[2];
+    if(fem) {
+        if(fem_charges(air && airFem ? airFem : fem, pool, air, charges) != 0) {
+            return false;
+        }
+    } else if(energy_charges(air && airLattice ? airLattice : lattice, pool, air, charges) != 0) {
+        return false;
+    }
+    switch(symmetry) {
+    case Symmetry::None:
+        positive = charges[0];
+        negative = charges[1];
+        break;
+    case Symmetry::Even:
+        // the other half holds the same charges
+        positive = 2 * charges[0];
+        negative = 2 * charges[1];
+        break;
+    case Symmetry::Odd:
+        // the other half holds the same charges with swapped polarity
+        positive = charges[0] + charges[1];
+        negative = charges[0] + charges[1];
+        break;
+    }
+    return true;
+}
+
 void Laplace::invalidateResult()
 {
     resultReady = false;
 }
 
+void Laplace::setResults(const QMap<QString, double> &results)
+{
+    if(calculationRunning || !resultReady) {
+        return;
+    }
+    this->results = results;
+    cache.setResults(solutionKey, results);
+}
+
 QPointF Laplace::coordFromRect(rect *pos)
 {
     QPointF ret;
@@ -166,6 +698,285 @@ struct rect Laplace::coordToRect(const QPointF &pos)
     return ret;
 }
 
+Laplace::LatticeSettings Laplace::getLatticeSettings(ElementList *list)
+{
+    LatticeSettings s;
+    s.list = list;
+    s.topLeft = topLeft;
+    s.bottomRight = bottomRight;
+    s.grid = grid;
+    s.groundedBorders = groundedBorders;
+    s.openBorders = openBorders;
+    s.ignoreDielectric = ignoreDielectric;
+    s.symmetry = symmetry;
+    s.meshX = meshX;
+    s.meshY = meshY;
+    return s;
+}
+
+Laplace::Symmetry Laplace::findSymmetry(ElementList *list)
+{
+    // the matrices need every trace driven on its own, which breaks the symmetry
+    if(!useSymmetry || conductorMatrix || triangleMesh) {
+        return Symmetry::None;
+    }
+    symmetryCenter = (topLeft.x() + bottomRight.x()) / 2;
+    auto tolerance = grid * 1e-3;
+    auto isMirrored = [=](Element *a, Element *b) {
+        auto va = a->getVertices();
+        auto vb = b->getVertices();
+        if(va.size() != vb.size()) {
+            return false;
+        }
+        for(const auto &p : va) {
+            QPointF m(2 * symmetryCenter - p.x(), p.y());
+            if(std::none_of(vb.begin(), vb.end(), [=](const QPointF &q) {
+                return std::abs(q.x() - m.x()) <= tolerance && std::abs(q.y() - m.y()) <= tolerance;
+            })) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    bool even = true;
+    bool odd = true;
+    auto elements = list->getElements();
+    for(auto e : elements) {
+        bool evenFound = false;
+        bool oddFound = false;
+        for(auto m : elements) {
+            if(!isMirrored(e, m)) {
+                continue;
+            }
+            switch(e->getType()) {
+            case Element::Type::Dielectric:
+                if(m->getType() == Element::Type::Dielectric && m->getEpsilonR() == e->getEpsilonR()) {
+                    evenFound = true;
+                    oddFound = true;
+                }
+                break;
+            case Element::Type::GND:
+                if(m->getType() == Element::Type::GND) {
+                    evenFound = true;
+                    oddFound = true;
+                }
+                break;
+            case Element::Type::TracePos:
+                evenFound |= m->getType() == Element::Type::TracePos;
+                oddFound |= m->getType() == Element::Type::TraceNeg;
+                break;
+            case Element::Type::TraceNeg:
+                evenFound |= m->getType() == Element::Type::TraceNeg;
+                oddFound |= m->getType() == Element::Type::TracePos;
+                break;
+            case Element::Type::Last:
+                break;
+            }
+        }
+        even &= evenFound;
+        odd &= oddFound;
+    }
+    if(even) {
+        return Symmetry::Even;
+    } else if(odd) {
+        return Symmetry::Odd;
+    }
+    return Symmetry::None;
+}
+
+bool Laplace::mirror(QPointF &p, double &sign)
+{
+    sign = 1.0;
+    if(symmetry == Symmetry::None || p.x() <= symmetryCenter) {
+        return false;
+    }
+    if(symmetry == Symmetry::Odd) {
+        sign = -1.0;
+    }
+    p.rx() = 2 * symmetryCenter - p.x();
+    return true;
+}
+
+void Laplace::createMesh(ElementList *list)
+{
+    meshX.clear();
+    meshY.clear();
+    if(!gradedMesh || triangleMesh) {
+        return;
+    }
+    double width = (bottomRight.x() - topLeft.x()) / grid;
+    double height = (topLeft.y() - bottomRight.y()) / grid;
+    if(symmetry != Symmetry::None) {
+        width /= 2;
+    }
+    // the field changes fastest at the corners and along the edges of the elements
+    QVector<double> xs, ys;
+    for(auto e : list->getElements()) {
+        for(const auto &v : e->getVertices()) {
+            auto pos = coordToRect(v);
+            xs.append(pos.x);
+            ys.append(pos.y);
+        }
+    }
+    meshX = gradeAxis(xs, width);
+    meshY = gradeAxis(ys, height);
+}
+
+void Laplace::rasterise(point *first, point *last)
+{
+    rasterOffset = *first;
+    QVector<double> xs, ys;
+    for(int i=first->x;i<(int) last->x;i++) {
+        struct rect pos = {meshPosition(meshX, rasterStep.x, i), 0};
+        xs.append(coordFromRect(&pos).x());
+    }
+    for(int j=first->y;j<(int) last->y;j++) {
+        struct rect pos = {0, meshPosition(meshY, rasterStep.y, j)};
+        ys.append(coordFromRect(&pos).y());
+    }
+
+    // assign the elements to the cells, the first matching element is used
+    conductors.setGrid(xs, ys);
+    materials.setGrid(xs, ys);
+    auto elements = list->getElements();
+    for(int i=0;i<elements.size();i++) {
+        auto e = elements[i];
+        if(e->getType() != Element::Type::Dielectric) {
+            // dielectric has no influence on boundary and trace/GND should always take priority
+            conductors.fill(e->getVertices(), i);
+        }
+        if(!ignoreDielectric) {
+            materials.fill(e->getVertices(), i);
+        }
+    }
+}
+
+QByteArray Laplace::getSolutionKey(ElementList *list)
+{
+    // everything the solution depends on, the names of the elements don't matter
+    auto jlist = list->toJSON();
+    for(auto &jelement : jlist["elements"]) {
+        jelement.erase("name");
+    }
+    nlohmann::json j;
+    j["list"] = jlist;
+    j["xleft"] = topLeft.x();
+    j["xright"] = bottomRight.x();
+    j["ytop"] = topLeft.y();
+    j["ybottom"] = bottomRight.y();
+    j["grid"] = grid;
+    j["threshold"] = threshold;
+    j["groundedBorders"] = groundedBorders;
+    j["openBorders"] = openBorders && !groundedBorders;
+    j["ignoreDielectric"] = ignoreDielectric;
+    j["airSolve"] = airSolve;
+    j["conductorMatrix"] = conductorMatrix;
+    j["symmetry"] = (int) symmetry;
+    j["gradedMesh"] = gradedMesh;
+    j["adaptiveMesh"] = gradedMesh && adaptiveMesh;
+    j["triangleMesh"] = triangleMesh;
+    // the keys of the objects are sorted, so the same problem always gives the same string
+    return SolutionCache::key(QByteArray::fromStdString(j.dump()));
+}
+
+struct lattice *Laplace::createLattice(rect *size, point *dim)
+{
+    // the lattice adds a ring of cells around the problem
+    rasterStep = {size->x / dim->x, size->y / dim->y};
+    struct point first = {0, 0};
+    struct point last = {dim->x + 3, dim->y + 3};
+    if(!meshX.isEmpty()) {
+        // the cells of a graded lattice are at the positions of the mesh instead
+        last = {(uint32_t) meshX.size() + 2, (uint32_t) meshY.size() + 2};
+    }
+    rasterise(&first, &last);
+
+    // the lookups only read the rasters, so the threads of the pool can share the work
+    struct lattice *lattice;
+    if(meshX.isEmpty()) {
+        lattice = lattice_new(size, dim, &boundaryTrampoline, &weightTrampoline, this, pool);
+    } else {
+        lattice = lattice_new_graded(meshX.constData(), meshX.size(), meshY.constData(), meshY.size(), &boundaryTrampoline, &weightTrampoline, this, pool);
+    }
+    conductors.clear();
+    materials.clear();
+    if(lattice) {
+        lattice->abort = &abortRequested;
+    }
+    if(lattice && openBorders && !groundedBorders) {
+        // the symmetry plane keeps mirroring the cells
+        uint8_t borders = BORDER_SOUTH | BORDER_NORTH | BORDER_WEST;
+        if(symmetry == Symmetry::None) {
+            borders |= BORDER_EAST;
+        }
+        auto center = getOpenCenter();
+        lattice_set_open(lattice, borders, &center);
+    }
+    return lattice;
+}
+
+struct rect Laplace::getOpenCenter()
+{
+    // the traces and their image in the ground plane below them form a dipole
+    QRectF traces;
+    for(auto e : list->getElements()) {
+        if(e->getType() == Element::Type::TracePos || e->getType() == Element::Type::TraceNeg) {
+            traces = traces.united(QPolygonF(e->getVertices()).boundingRect());
+        }
+    }
+    if(traces.isNull()) {
+        return coordToRect((topLeft + bottomRight) / 2);
+    }
+    // the rectangles have their lowest y coordinate at the top
+    auto center = traces.center();
+    double plane = -std::numeric_limits<double>::infinity();
+    for(auto e : list->getElements()) {
+        if(e->getType() == Element::Type::GND) {
+            auto r = QPolygonF(e->getVertices()).boundingRect();
+            if(r.bottom() <= traces.top() && r.bottom() > plane) {
+                plane = r.bottom();
+            }
+        }
+    }
+    if(std::isfinite(plane)) {
+        center.ry() = plane;
+    }
+    return coordToRect(center);
+}
+
+void Laplace::updateLattice(const QRectF &area)
+{
+    if(area.isNull()) {
+        return;
+    }
+    if(lattice->open) {
+        // moving the traces moves the centre the field decays from
+        auto center = getOpenCenter();
+        if(center.x != lattice->center.x || center.y != lattice->center.y) {
+            lattice_set_open(lattice, lattice->open, &center);
+        }
+    }
+    // find the cells covered by the area, with a margin of one cell for the rounding
+    rasterStep = lattice->step;
+    auto p1 = coordToRect(area.topLeft());
+    auto p2 = coordToRect(area.bottomRight());
+    auto firstX = (long) floor(meshIndex(meshX, rasterStep.x, std::min(p1.x, p2.x))) - 1;
+    auto firstY = (long) floor(meshIndex(meshY, rasterStep.y, std::min(p1.y, p2.y))) - 1;
+    auto lastX = (long) ceil(meshIndex(meshX, rasterStep.x, std::max(p1.x, p2.x))) + 2;
+    auto lastY = (long) ceil(meshIndex(meshY, rasterStep.y, std::max(p1.y, p2.y))) + 2;
+    struct point first = {(uint32_t) qBound(0L, firstX, (long) lattice->dim.x), (uint32_t) qBound(0L, firstY, (long) lattice->dim.y)};
+    struct point last = {(uint32_t) qBound(0L, lastX, (long) lattice->dim.x), (uint32_t) qBound(0L, lastY, (long) lattice->dim.y)};
+    if(first.x >= last.x || first.y >= last.y) {
+        return;
+    }
+
+    rasterise(&first, &last);
+    lattice_rebuild(lattice, &first, &last, &boundaryTrampoline, &weightTrampoline, this);
+    conductors.clear();
+    materials.clear();
+}
+
 bound *Laplace::boundary(bound *bound, rect *pos)
 {
     auto coord = coordFromRect(pos);
@@ -179,35 +990,38 @@ bound *Laplace::boundary(bound *bound, rect *pos)
         bound->value = 0;
         bound->cond = DIRICHLET;
         return bound;
-    } else {
-        // find the matching polygon
-        for(auto e : list->getElements()) {
-            if(e->getType() == Element::Type::Dielectric) {
-                // skip, dielectric has no influence on boundary and trace/GND should always take priority
-                continue;
-            }
-            QPolygonF poly = e->toPolygon();
-            if(poly.containsPoint(coord, Qt::OddEvenFill)) {
-                // this polygon defines the boundary at these coordinates
-                switch(e->getType()) {
-                case Element::Type::GND:
-                    bound->value = 0;
-                    bound->cond = DIRICHLET;
-                    return bound;
-                case Element::Type::TracePos:
-                    bound->value = 1.0;
-                    bound->cond = DIRICHLET;
-                    return bound;
-                case Element::Type::TraceNeg:
-                    bound->value = -1.0;
-                    bound->cond = DIRICHLET;
-                    return bound;
-                case Element::Type::Dielectric:
-                case Element::Type::Last:
-                    return bound;
-                }
-            }
-        }
+    }
+    auto column = lround(meshIndex(meshX, rasterStep.x, pos->x));
+    if(symmetry == Symmetry::Odd && column == lround(meshIndex(meshX, rasterStep.x, symmetryPlane))) {
+        // the potential changes sign across the plane
+        bound->value = 0;
+        bound->cond = DIRICHLET;
+        return bound;
+    }
+
+    // find the matching polygon
+    auto row = lround(meshIndex(meshY, rasterStep.y, pos->y));
+    int index = conductors.at(column - rasterOffset.x, row - rasterOffset.y);
+    if(index == Raster::unset) {
+        return bound;
+    }
+    // this polygon defines the boundary at these coordinates
+    switch(list->getElements()[index]->getType()) {
+    case Element::Type::GND:
+        bound->value = 0;
+        bound->cond = DIRICHLET;
+        return bound;
+    case Element::Type::TracePos:
+        bound->value = 1.0;
+        bound->cond = DIRICHLET;
+        return bound;
+    case Element::Type::TraceNeg:
+        bound->value = -1.0;
+        bound->cond = DIRICHLET;
+        return bound;
+    case Element::Type::Dielectric:
+    case Element::Type::Last:
+        return bound;
     }
     return bound;
 }
@@ -218,45 +1032,679 @@ double Laplace::weight(rect *pos)
         return 1.0;
     }
 
-    auto coord = coordFromRect(pos);
-    return sqrt(list->getDielectricConstantAt(coord));
+    // same rules as ElementList::getDielectricConstantAt
+    auto column = lround(meshIndex(meshX, rasterStep.x, pos->x));
+    auto row = lround(meshIndex(meshY, rasterStep.y, pos->y));
+    int index = materials.at(column - rasterOffset.x, row - rasterOffset.y);
+    if(index == Raster::unset) {
+        // not found, we are in the air
+        return 1.0;
+    }
+    auto e = list->getElements()[index];
+    switch(e->getType()) {
+    case Element::Type::GND:
+    case Element::Type::TracePos:
+    case Element::Type::TraceNeg:
+    case Element::Type::Last:
+        return 1.0;
+    case Element::Type::Dielectric:
+        return sqrt(e->getEpsilonR());
+    }
+    return 1.0;
+}
+
+enum preconditioner Laplace::getCGPreconditioner()
+{
+    switch(preconditioner) {
+    case Preconditioner::Jacobi: return PRECONDITIONER_JACOBI;
+    case Preconditioner::IncompleteCholesky: return PRECONDITIONER_ICHOL;
+    case Preconditioner::Multigrid: return PRECONDITIONER_MULTIGRID;
+    case Preconditioner::Last: break;
+    }
+    return PRECONDITIONER_MULTIGRID;
+}
+
+uint32_t Laplace::solve(struct lattice *lattice, struct config *conf, progress_callback_t cb)
+{
+    uint32_t it = 0;
+    switch(solver) {
+    case Solver::GaussSeidel:
+        it = lattice_compute_threaded(lattice, conf, cb, this);
+        break;
+    case Solver::RedBlackSOR:
+        it = lattice_compute_sor(lattice, conf, cb, this);
+        break;
+    case Solver::Multigrid:
+        it = lattice_compute_multigrid(lattice, conf, cb, this);
+        break;
+    case Solver::ConjugateGradient:
+        it = lattice_compute_cg(lattice, conf, getCGPreconditioner(), cb, this);
+        break;
+    case Solver::Last:
+        break;
+    }
+    return checkSolved(it);
+}
+
+uint32_t Laplace::solve(struct fem *fem, struct config *conf, progress_callback_t cb)
+{
+    return checkSolved(fem_compute(fem, conf, getCGPreconditioner(), cb, this));
+}
+
+uint32_t Laplace::checkSolved(uint32_t iterations)
+{
+    if(iterations != COMPUTE_FAILED) {
+        return iterations;
+    }
+    // the values are not a solution, stop like an abort so nothing is cached or shown
+    emit error("Laplace solver failed");
+    abortRequested = true;
+    return 0;
 }
 
 void* Laplace::calcThread()
 {
-    emit info("Creating lattice");
+    // the solvers share the work along both axes, so all threads can be used.
+    // The air solve runs at the same time and takes half of them, except on triangles where it follows the
+    // dielectric one
+    uint32_t airThreads = airSolve && !triangleMesh ? threads / 2 : 0;
+    struct config conf = {(uint32_t) threads - airThreads, threshold, nullptr};
+    // the threads are kept for the following calculations
+    if(!pool || pool_size(pool) != conf.threads) {
+        emit info("Starting calculation threads");
+        pool_delete(pool);
+        pool = pool_new(conf.threads);
+    }
+    conf.pool = pool;
+    if(airThreads > 0 && (!airPool || pool_size(airPool) != airThreads)) {
+        pool_delete(airPool);
+        airPool = pool_new(airThreads);
+    }
+    airConf = {airThreads, threshold, airPool};
+    if(airLattice) {
+        auto old = airLattice;
+        airLattice = nullptr;
+        lattice_delete(old);
+    }
+    if(triangleMesh) {
+        return calcTriangles(&conf);
+    }
+
     struct rect size = {(bottomRight.x() - topLeft.x()) / grid, (topLeft.y() - bottomRight.y()) / grid};
     struct point dim = {(uint32_t) ((bottomRight.x() - topLeft.x()) / grid), (uint32_t) ((topLeft.y() - bottomRight.y()) / grid)};
-    lattice = lattice_new(&size, &dim, &boundaryTrampoline, &weightTrampoline, this);
+    if(symmetry != Symmetry::None) {
+        // only the left half is solved, the outer ring on the right mirrors the cells at the plane
+        emit info(QString("Solving the left half with ")+(symmetry == Symmetry::Even ? "even" : "odd")+" symmetry");
+        size.x /= 2;
+        dim.x /= 2;
+    }
+    symmetryPlane = size.x;
+    const struct point fineDim = dim;
+    bool updated = false;
     if(lattice) {
-        emit info("Lattice creation complete");
+        // the last solution is the starting point, only the changed cells are built again
+        emit info("Updating lattice");
+        updateLattice(changedArea);
+        updated = true;
+        emit info("Lattice update complete");
     } else {
-        emit error("Lattice creation failed");
-        return nullptr;
+        emit info("Creating lattice");
+        lattice = createLattice(&size, &dim);
+        if(lattice) {
+            latticeSettings = getLatticeSettings(list);
+            if(!meshX.isEmpty()) {
+                emit info("Graded mesh with "+QString::number(meshX.size())+"x"+QString::number(meshY.size())+" cells");
+            }
+            emit info("Lattice creation complete");
+        } else {
+            emit error("Lattice creation failed");
+            finishCalculation(true, 0);
+            return nullptr;
+        }
     }
 
-    struct config conf = {(uint8_t) threads, 10, threshold};
-    if(conf.threads > lattice->dim.y / 5) {
-        conf.threads = lattice->dim.y / 5;
+    SolutionCache::Solution cached;
+    bool found = cache.get(solutionKey, cached);
+    if(found && !cached.meshX.isEmpty() && (cached.meshX != meshX || cached.meshY != meshY)) {
+        // the solution is on the mesh it was refined to
+        meshX = cached.meshX;
+        meshY = cached.meshY;
+        if(!remesh(&size, &dim)) {
+            finishCalculation(true, 0);
+            return nullptr;
+        }
     }
-    conf.distance = lattice->dim.y / threads;
-    emit info("Starting calculation threads");
-    auto it = lattice_compute_threaded(lattice, &conf, calcProgressFromDiffTrampoline, this);
+    found = found && cached.dimX == lattice->dim.x && cached.dimY == lattice->dim.y
+            && (!airSolve || cached.airValues.size() == cached.values.size())
+            && (!conductorMatrix || cached.capacitances.size() == conductorNames.size() * conductorNames.size());
+    if(found) {
+        // this problem has been solved before
+        std::copy(cached.values.begin(), cached.values.end(), lattice->value);
+        results = cached.results;
+        capacitances = cached.capacitances;
+        airCapacitances = cached.airCapacitances;
+        if(previous) {
+            lattice_delete(previous);
+            previous = nullptr;
+        }
+        emit info("Using the cached solution");
+    } else if(previous) {
+        // start from the last solution, moved onto the cells of the new lattice
+        auto from = previousSettings;
+        struct rect origin = {(topLeft.x() - from.topLeft.x()) / from.grid, (bottomRight.y() - from.bottomRight.y()) / from.grid};
+        struct rect scale = {grid / from.grid, grid / from.grid};
+        lattice_resample(previous, lattice, &origin, &scale);
+        lattice_delete(previous);
+        previous = nullptr;
+        emit info("Starting from the previous solution");
+    } else if(nestedIteration && !updated && meshX.isEmpty()) {
+        // solve on coarser grids first, each result is the starting point of the next finer grid
+        constexpr uint32_t minCells = 16;
+        struct lattice *coarse = nullptr;
+        for(uint32_t factor : {4, 2}) {
+            struct point coarseDim = {fineDim.x / factor, fineDim.y / factor};
+            if(coarseDim.x < minCells || coarseDim.y < minCells) {
+                continue;
+            }
+            auto next = createLattice(&size, &coarseDim);
+            if(!next) {
+                break;
+            }
+            if(coarse) {
+                lattice_prolongate(coarse, next);
+                lattice_delete(coarse);
+            }
+            coarse = next;
+            auto it = solve(coarse, &conf, nullptr);
+            if(abortRequested) {
+                break;
+            }
+            emit info("Coarse solution on "+QString::number(factor)+"x grid took "+QString::number(it)+" iterations");
+        }
+        if(coarse) {
+            lattice_prolongate(coarse, lattice);
+            lattice_delete(coarse);
+        }
+    }
+
+    if(adaptiveMesh && !meshX.isEmpty() && !found && !abortRequested) {
+        solve(lattice, &conf, calcProgressFromDiffTrampoline);
+        refineMesh(&size, &dim, &conf);
+    }
+
+    if(airSolve && !abortRequested) {
+        // the same conditions without dielectric, starting from the values of the dielectric lattice
+        airLattice = lattice_new_uniform(lattice);
+        if(!airLattice) {
+            emit error("Air lattice creation failed");
+            abortRequested = true;
+        } else if(found) {
+            std::copy(cached.airValues.begin(), cached.airValues.end(), airLattice->value);
+        }
+    }
+
+    uint32_t it = 0;
+    if(!abortRequested && !found) {
+        it = solveBoth(lattice, airLattice, &conf, calcProgressFromDiffTrampoline);
+        if(airLattice && !abortRequested) {
+            emit info("Air calculation complete, took "+QString::number(airIterations)+" iterations");
+        }
+        if(conductorMatrix && !abortRequested && !calcMatrix(&conf)) {
+            // the matrix is part of the result, without it nothing is cached or shown
+            abortRequested = true;
+        }
+        if(!abortRequested) {
+            SolutionCache::Solution solution;
+            solution.dimX = lattice->dim.x;
+            solution.dimY = lattice->dim.y;
+            solution.values = QVector<double>(lattice->value, lattice->value + lattice->dim.x * lattice->dim.y);
+            if(airLattice) {
+                solution.airValues = QVector<double>(airLattice->value, airLattice->value + airLattice->dim.x * airLattice->dim.y);
+            }
+            solution.capacitances = capacitances;
+            solution.airCapacitances = airCapacitances;
+            solution.meshX = meshX;
+            solution.meshY = meshY;
+            cache.insert(solutionKey, solution);
+        }
+    }
+    finishCalculation(abortRequested, it);
+    return nullptr;
+}
+
+void Laplace::finishCalculation(bool aborted, uint32_t iterations)
+{
     calculationRunning = false;
-    if(lattice->abort) {
+    if(aborted) {
         emit warning("Laplace calculation aborted");
         resultReady = false;
         emit percentage(0);
         emit calculationAborted();
     } else {
-        emit info("Laplace calculation complete, took "+QString::number(it)+" iterations");
+        emit info("Laplace calculation complete, took "+QString::number(iterations)+" iterations");
         resultReady = true;
         emit percentage(100);
         emit calculationDone();
     }
+}
+
+bool Laplace::remesh(struct rect *size, struct point *dim)
+{
+    auto refined = createLattice(size, dim);
+    if(!refined) {
+        emit error("Lattice creation failed");
+        abortRequested = true;
+        return false;
+    }
+    lattice_prolongate(lattice, refined);
+    auto old = lattice;
+    lattice = refined;
+    lattice_delete(old);
+    latticeSettings = getLatticeSettings(list);
+    return true;
+}
+
+void Laplace::refineMesh(struct rect *size, struct point *dim, struct config *conf)
+{
+    // the intervals holding this part of the estimated error are split in each pass
+    constexpr double fraction = 0.5;
+    // the passes stop once the charges change less than this
+    constexpr double tolerance = 1e-3;
+    constexpr int maxPasses = 10;
+    constexpr double maxCells = 4e6;
+    // the smallest interval in units of the grid, the field at the corners of conductors needs very small cells
+    constexpr double finest = 1.0 / 64;
+
+    double last = 0;
+    for(int pass=0;pass<maxPasses && !abortRequested;pass++) {
+        double charges[2];
+        if(energy_charges(lattice, conf->pool, false, charges) != 0) {
+            break;
+        }
+        double total = charges[0] + charges[1];
+        if(pass > 0 && std::abs(total - last) <= tolerance * std::abs(total)) {
+            break;
+        }
+        last = total;
+        if((double) lattice->dim.x * lattice->dim.y > maxCells) {
+            emit warning("Stopped refining the mesh at "+QString::number(lattice->dim.x * lattice->dim.y)+" cells");
+            break;
+        }
+
+        QVector<double> ex(meshX.size() - 1), ey(meshY.size() - 1);
+        if(adapt_estimate(lattice, conf->pool, ex.data(), ey.data()) != 0) {
+            break;
+        }
+        // the largest estimates of both axes that add up to the fraction of the total are refined
+        QVector<double> sorted = ex;
+        sorted += ey;
+        std::sort(sorted.begin(), sorted.end(), std::greater<double>());
+        double sum = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+        double limit = sorted.first();
+        double marked = 0;
+        for(auto e : sorted) {
+            marked += e;
+            limit = e;
+            if(marked >= fraction * sum) {
+                break;
+            }
+        }
+        int split = splitIntervals(meshX, ex, limit, finest);
+        split += splitIntervals(meshY, ey, limit, finest);
+        if(split == 0) {
+            break;
+        }
+
+        if(!remesh(size, dim)) {
+            return;
+        }
+        auto it = solve(lattice, conf, nullptr);
+        if(abortRequested) {
+            return;
+        }
+        emit info("Refined the mesh to "+QString::number(meshX.size())+"x"+QString::number(meshY.size())+" cells, took "+QString::number(it)+" iterations");
+    }
+}
+
+void* Laplace::airThread()
+{
+    airIterations = solve(airTarget, &airConf, nullptr);
     return nullptr;
 }
 
+uint32_t Laplace::solveBoth(struct lattice *lattice, struct lattice *air, struct config *conf, progress_callback_t cb)
+{
+    airTarget = air;
+    bool airRunning = false;
+    if(air && airConf.threads > 0) {
+        airRunning = pthread_create(&airSolveThread, nullptr, airThreadTrampoline, this) == 0;
+    }
+    auto it = solve(lattice, conf, cb);
+    if(airRunning) {
+        pthread_join(airSolveThread, nullptr);
+    } else if(air && !abortRequested) {
+        // not enough threads to share, solve one after the other
+        airIterations = solve(air, conf, nullptr);
+    }
+    airTarget = nullptr;
+    return it;
+}
+
+QVector<int32_t> Laplace::getConductorLabels()
+{
+    // the traces are numbered in the order of the list
+    QVector<int> conductorOf;
+    int count = 0;
+    for(auto e : list->getElements()) {
+        if(e->getType() == Element::Type::TracePos || e->getType() == Element::Type::TraceNeg) {
+            conductorOf.append(count++);
+        } else {
+            conductorOf.append(-1);
+        }
+    }
+
+    // same rules as the boundary function, only the driven cells belong to a trace
+    const uint32_t w = lattice->dim.x;
+    const uint32_t h = lattice->dim.y;
+    rasterStep = lattice->step;
+    struct point first = {0, 0};
+    rasterise(&first, &lattice->dim);
+    QVector<int32_t> labels(w * h, -1);
+    for(uint32_t j=1;j<h-1;j++) {
+        for(uint32_t i=1;i<w-1;i++) {
+            auto index = i + j * w;
+            if(lattice->cond[index] != DIRICHLET) {
+                continue;
+            }
+            struct rect pos = {meshPosition(meshX, rasterStep.x, i), meshPosition(meshY, rasterStep.y, j)};
+            struct bound b;
+            boundary(&b, &pos);
+            if(b.value != 0) {
+                labels[index] = conductorOf[conductors.at(i, j)];
+            }
+        }
+    }
+    conductors.clear();
+    materials.clear();
+    return labels;
+}
+
+bool Laplace::calcMatrix(struct config *conf)
+{
+    emit info("Starting capacitance matrix calculation");
+    auto labels = getConductorLabels();
+    const int n = conductorNames.size();
+    QVector<double> C(n * n), Cair(n * n), charges(n);
+    for(int k=0;k<n;k++) {
+        if(abortRequested) {
+            return false;
+        }
+        // the same stencil with only this trace at 1V, solved with and without dielectric
+        auto driven = lattice_new_excitation(lattice, labels.constData(), k);
+        auto air = driven ? lattice_new_uniform(driven) : nullptr;
+        if(!air) {
+            emit error("Lattice creation failed");
+            if(driven) {
+                lattice_delete(driven);
+            }
+            return false;
+        }
+        auto it = solveBoth(driven, air, conf, nullptr);
+        bool ok = !abortRequested;
+        if(ok) {
+            emit info("Solved for "+conductorNames[k]+", took "+QString::number(it)+" and "+QString::number(airIterations)+" iterations");
+            ok = energy_conductor_charges(driven, pool, false, labels.constData(), n, charges.data()) == 0;
+            for(int i=0;i<n && ok;i++) {
+                C[i * n + k] = charges[i];
+            }
+            ok = ok && energy_conductor_charges(air, pool, true, labels.constData(), n, charges.data()) == 0;
+            for(int i=0;i<n && ok;i++) {
+                Cair[i * n + k] = charges[i];
+            }
+            if(!ok) {
+                emit error("Charge calculation failed");
+            }
+        }
+        lattice_delete(driven);
+        lattice_delete(air);
+        if(!ok) {
+            return false;
+        }
+    }
+    capacitances = C;
+    airCapacitances = Cair;
+    emit info("Capacitance matrix calculation complete");
+    return true;
+}
+
+bool Laplace::createTriangles()
+{
+    // the triangles are one grid step wide at the vertices of the elements and grow away from them
+    constexpr double finest = 1.0;
+    constexpr double growth = 0.2;
+    constexpr double coarsest = 16.0;
+    constexpr uint32_t maxPoints = 4000000;
+
+    // the edges of the elements become edges of the triangles
+    auto elements = list->getElements();
+    QVector<struct rect> vertices;
+    QVector<uint32_t> segments;
+    for(auto e : elements) {
+        if(ignoreDielectric && e->getType() == Element::Type::Dielectric) {
+            continue;
+        }
+        auto v = e->getVertices();
+        uint32_t first = vertices.size();
+        for(int i=0;i<v.size();i++) {
+            vertices.append(coordToRect(v[i]));
+            segments.append(first + i);
+            segments.append(first + (i + 1) % v.size());
+        }
+    }
+    struct rect size = {(bottomRight.x() - topLeft.x()) / grid, (topLeft.y() - bottomRight.y()) / grid};
+    triangles = mesh_new(&size, vertices.constData(), vertices.size(), segments.constData(), segments.size() / 2, finest, growth, coarsest, maxPoints);
+    fem = triangles ? fem_new(triangles) : nullptr;
+    if(!fem) {
+        return false;
+    }
+    fem->abort = &abortRequested;
+    if(triangles->missing > 0) {
+        // the triangles along these edges can reach into the neighbouring elements
+        emit warning(QString::number(triangles->missing)+" element edges are missing from the triangle mesh");
+    }
+
+    // the traces are numbered in the order of the list
+    QVector<int> conductorOf;
+    int count = 0;
+    for(auto e : elements) {
+        if(e->getType() == Element::Type::TracePos || e->getType() == Element::Type::TraceNeg) {
+            conductorOf.append(count++);
+        } else {
+            conductorOf.append(-1);
+        }
+    }
+
+    // each triangle lies inside or outside of every element, so its center decides. Same rules as the rasters
+    // of the lattice, the first matching element is used and conductors take priority over dielectric
+    triangleLabels = QVector<int32_t>(triangles->points, -1);
+    for(uint32_t t=0;t<triangles->triangles;t++) {
+        const uint32_t *corner = &triangles->corner[3 * t];
+        struct rect center = {0, 0};
+        for(int k=0;k<3;k++) {
+            center.x += triangles->point[corner[k]].x / 3;
+            center.y += triangles->point[corner[k]].y / 3;
+        }
+        // the index of the list only tests the polygons near the center
+        auto coord = coordFromRect(&center);
+        int material = list->getIndexAt(coord);
+        int conductor = material;
+        if(material >= 0 && elements[material]->getType() == Element::Type::Dielectric) {
+            conductor = list->getIndexAt(coord, false);
+        }
+        if(!ignoreDielectric && material >= 0 && elements[material]->getType() == Element::Type::Dielectric) {
+            fem->epsilon[t] = elements[material]->getEpsilonR();
+        }
+        if(conductor < 0) {
+            continue;
+        }
+        double value = 0;
+        switch(elements[conductor]->getType()) {
+        case Element::Type::TracePos: value = 1.0; break;
+        case Element::Type::TraceNeg: value = -1.0; break;
+        case Element::Type::GND:
+        case Element::Type::Dielectric:
+        case Element::Type::Last:
+            break;
+        }
+        // the points of a conductor are fixed, the first conductor touching a point sets its value
+        for(int k=0;k<3;k++) {
+            if(fem->cond[corner[k]] != DIRICHLET) {
+                fem->cond[corner[k]] = DIRICHLET;
+                fem->value[corner[k]] = value;
+                triangleLabels[corner[k]] = conductorOf[conductor];
+            }
+        }
+    }
+
+    if(groundedBorders) {
+        // the borders take priority like in the boundary function
+        for(uint32_t i=0;i<triangles->points;i++) {
+            auto p = triangles->point[i];
+            if(p.x == 0 || p.y == 0 || p.x == size.x || p.y == size.y) {
+                fem->cond[i] = DIRICHLET;
+                fem->value[i] = 0;
+                triangleLabels[i] = -1;
+            }
+        }
+    }
+    return true;
+}
+
+void Laplace::deleteTriangles()
+{
+    fem_delete(fem);
+    fem = nullptr;
+    fem_delete(airFem);
+    airFem = nullptr;
+    mesh_delete(triangles);
+    triangles = nullptr;
+    triangleLabels.clear();
+    potentialHint = MESH_NONE;
+}
+
+void* Laplace::calcTriangles(struct config *conf)
+{
+    emit info("Creating triangles");
+    if(!createTriangles()) {
+        deleteTriangles();
+        emit error("Triangle creation failed");
+        finishCalculation(true, 0);
+        return nullptr;
+    }
+    emit info("Triangle mesh with "+QString::number(triangles->points)+" points and "+QString::number(triangles->triangles)+" triangles");
+
+    // the values belong to the points, the triangles are the same for the same problem
+    SolutionCache::Solution cached;
+    bool found = cache.get(solutionKey, cached) && cached.dimX == triangles->points && cached.dimY == 1
+            && (!airSolve || cached.airValues.size() == cached.values.size())
+            && (!conductorMatrix || cached.capacitances.size() == conductorNames.size() * conductorNames.size());
+    if(found) {
+        std::copy(cached.values.begin(), cached.values.end(), fem->value);
+        results = cached.results;
+        capacitances = cached.capacitances;
+        airCapacitances = cached.airCapacitances;
+        emit info("Using the cached solution");
+    }
+
+    if(airSolve) {
+        // the same conditions without dielectric, starting from the values of the dielectric problem
+        airFem = fem_new_uniform(fem);
+        if(!airFem) {
+            emit error("Air problem creation failed");
+            abortRequested = true;
+        } else if(found) {
+            std::copy(cached.airValues.begin(), cached.airValues.end(), airFem->value);
+        }
+    }
+
+    // the system has no lattice, so it is always solved with conjugate gradients. The air solve follows the
+    // dielectric one on all threads
+    uint32_t it = 0;
+    if(!abortRequested && !found) {
+        it = solve(fem, conf, calcProgressFromDiffTrampoline);
+        if(airFem && !abortRequested) {
+            airIterations = solve(airFem, conf, nullptr);
+        }
+        if(airFem && !abortRequested) {
+            emit info("Air calculation complete, took "+QString::number(airIterations)+" iterations");
+        }
+        if(conductorMatrix && !abortRequested && !calcTriangleMatrix(conf)) {
+            // the matrix is part of the result, without it nothing is cached or shown
+            abortRequested = true;
+        }
+        if(!abortRequested) {
+            SolutionCache::Solution solution;
+            solution.dimX = triangles->points;
+            solution.dimY = 1;
+            solution.values = QVector<double>(fem->value, fem->value + triangles->points);
+            if(airFem) {
+                solution.airValues = QVector<double>(airFem->value, airFem->value + triangles->points);
+            }
+            solution.capacitances = capacitances;
+            solution.airCapacitances = airCapacitances;
+            cache.insert(solutionKey, solution);
+        }
+    }
+    finishCalculation(abortRequested, it);
+    return nullptr;
+}
+
+bool Laplace::calcTriangleMatrix(struct config *conf)
+{
+    emit info("Starting capacitance matrix calculation");
+    const int n = conductorNames.size();
+    QVector<double> C(n * n), Cair(n * n), charges(n);
+    for(int k=0;k<n;k++) {
+        if(abortRequested) {
+            return false;
+        }
+        // the same system with only this trace at 1V, solved with and without dielectric
+        auto driven = fem_new_excitation(fem, triangleLabels.constData(), k);
+        auto air = driven ? fem_new_uniform(driven) : nullptr;
+        if(!air) {
+            emit error("Problem creation failed");
+            fem_delete(driven);
+            return false;
+        }
+        auto it = solve(driven, conf, nullptr);
+        auto airIt = abortRequested ? 0 : solve(air, conf, nullptr);
+        bool ok = !abortRequested;
+        if(ok) {
+            emit info("Solved for "+conductorNames[k]+", took "+QString::number(it)+" and "+QString::number(airIt)+" iterations");
+            ok = fem_conductor_charges(driven, pool, false, triangleLabels.constData(), n, charges.data()) == 0;
+            for(int i=0;i<n && ok;i++) {
+                C[i * n + k] = charges[i];
+            }
+            ok = ok && fem_conductor_charges(air, pool, true, triangleLabels.constData(), n, charges.data()) == 0;
+            for(int i=0;i<n && ok;i++) {
+                Cair[i * n + k] = charges[i];
+            }
+            if(!ok) {
+                emit error("Charge calculation failed");
+            }
+        }
+        fem_delete(driven);
+        fem_delete(air);
+        if(!ok) {
+            return false;
+        }
+    }
+    capacitances = C;
+    airCapacitances = Cair;
+    emit info("Capacitance matrix calculation complete");
+    return true;
+}
+
 void Laplace::calcProgressFromDiff(double diff)
 {
     // diff is expected to go down from 1.0 to the threshold with exponetial decay
@@ -3,31 +3,111 @@
 
 #include <QObject>
 #include <QPointF>
+#include <QRectF>
+#include <QStringList>
 
 #include <pthread.h>
 
 #include "elementlist.h"
+#include "fem.h"
 #include "lattice.h"
+#include "raster.h"
+#include "solutioncache.h"
 
 class Laplace : public QObject
 {
     Q_OBJECT
 public:
     explicit Laplace(QObject *parent = nullptr);
+    ~Laplace();
+
+    enum class Solver {
+        GaussSeidel,
+        RedBlackSOR,
+        Multigrid,
+        ConjugateGradient,
+        Last,
+    };
+
+    static QString SolverToString(Solver solver);
+    static Solver SolverFromString(QString s);
+    static QList<Solver> getSolvers();
+
+    enum class Preconditioner {
+        Jacobi,
+        IncompleteCholesky,
+        Multigrid,
+        Last,
+    };
+
+    static QString PreconditionerToString(Preconditioner p);
+    static Preconditioner PreconditionerFromString(QString s);
+    static QList<Preconditioner> getPreconditioners();
+
+    // how the charges of the traces are found from the solution
+    enum class Extraction {
+        GaussIntegration,
+        FieldEnergy,
+        // uses the field energy, but also integrates the charges to compare them
+        FieldEnergyChecked,
+        Last,
+    };
+
+    static QString ExtractionToString(Extraction e);
+    static Extraction ExtractionFromString(QString s);
+    static QList<Extraction> getExtractions();
 
     void setArea(const QPointF &topLeft, const QPointF &bottomRight);
     void setGrid(double grid);
     void setThreads(int threads);
     void setThreshold(double threshold);
     void setGroundedBorders(bool gnd);
+    // borders that are not grounded are open instead of mirroring the field, which allows a smaller area
+    void setOpenBorders(bool open);
     void setIgnoreDielectric(bool ignore);
+    void setSolver(Solver solver);
+    void setPreconditioner(Preconditioner preconditioner);
+    void setNestedIteration(bool nested);
+    void setWarmStart(bool warm);
+    // solves the problem without dielectric at the same time, sharing the lattice conditions
+    void setAirSolve(bool air);
+    // also finds the capacitance matrices of all traces, with one more solve per trace
+    void setConductorMatrix(bool matrix);
+    // solves only the left half if the elements are symmetric about the middle of the area
+    void setUseSymmetry(bool use);
+    // places the cells one grid step apart at the edges of the elements and further apart away from them
+    void setGradedMesh(bool graded);
+    // refines a graded mesh where the estimated error is largest and solves again, until the charges settle
+    void setAdaptiveMesh(bool adaptive);
+    // solves on triangles that follow the edges of the elements instead of a lattice, with linear finite elements.
+    // Symmetry, open borders and the graded mesh are not used then
+    void setTriangleMesh(bool triangles);
+    // stores the solutions in this directory in addition to the memory, disabled if empty
+    void setCacheDirectory(const QString &directory);
 
     bool startCalculation(ElementList *list);
     void abortCalculation();
     double getPotential(const QPointF &p);
     QLineF getGradient(const QPointF &p);
+    // samples the field at all points at once. The gradients are interpolated bilinearly between the central
+    // differences at the adjacent cells, in volts per grid step. The relative permittivity is taken from the weight of
+    // the nearest cell, epsilon may be nullptr if it is not needed. Points outside of the lattice get no gradient.
+    // With air set, the field of the air solve is sampled, or the dielectric field if there was no air solve
+    void sampleField(const QPointF *points, int count, QPointF *gradients, double *epsilon, bool air = false);
+    // the charges of the positive and negative traces divided by e0, found from the energy of the field.
+    // With air set, the dielectric is ignored and the field of the air solve is used if there was one
+    bool getEnergyCharges(bool air, double &positive, double &negative);
     bool isResultReady() {return resultReady;}
     void invalidateResult();
+    // the parameters extracted from the last solution, if it was found in the cache
+    QMap<QString, double> getResults() {return results;}
+    // stores the parameters extracted from the last solution along with it in the cache
+    void setResults(const QMap<QString, double> &results);
+    // the names of the traces in the order of the rows of the capacitance matrices
+    QStringList getConductorNames() {return conductorNames;}
+    // the Maxwell capacitance matrix divided by e0, row major. Each column holds the charges of all traces
+    // with only the trace of that column at 1V. With air set, the dielectric is ignored. Empty if not calculated
+    QVector<double> getCapacitanceMatrix(bool air) {return air ? airCapacitances : capacitances;}
 
     double weight(rect *pos);
 
@@ -40,6 +120,48 @@ signals:
     void error(QString error);
 
 private:
+    // the symmetry of the elements about the vertical line through the middle of the area
+    enum class Symmetry {
+        None,
+        // every element is mirrored onto one of the same type, so no field crosses the plane
+        Even,
+        // the traces are mirrored onto traces of the opposite polarity, so the plane is at 0V
+        Odd,
+    };
+    Symmetry findSymmetry(ElementList *list);
+    // moves a point right of the symmetry plane onto the solved half, sign is the factor of the potential there
+    bool mirror(QPointF &p, double &sign);
+
+    // the inputs of a lattice, it can only be updated in place while these stay the same
+    class LatticeSettings {
+    public:
+        bool operator==(const LatticeSettings &s) const {
+            return list == s.list && topLeft == s.topLeft && bottomRight == s.bottomRight && grid == s.grid
+                    && groundedBorders == s.groundedBorders && openBorders == s.openBorders
+                    && ignoreDielectric == s.ignoreDielectric && symmetry == s.symmetry
+                    && meshX == s.meshX && meshY == s.meshY;
+        }
+        ElementList *list;
+        QPointF topLeft, bottomRight;
+        double grid;
+        bool groundedBorders;
+        bool openBorders;
+        bool ignoreDielectric;
+        Symmetry symmetry;
+        QVector<double> meshX, meshY;
+    };
+    LatticeSettings getLatticeSettings(ElementList *list);
+    QByteArray getSolutionKey(ElementList *list);
+    // the positions of the cells of a graded lattice, dense at the edges of the elements
+    void createMesh(ElementList *list);
+    // builds the lattice again on the current mesh, starting from the values of the old one
+    bool remesh(struct rect *size, struct point *dim);
+    void refineMesh(struct rect *size, struct point *dim, struct config *conf);
+    void rasterise(struct point *first, struct point *last);
+    struct lattice* createLattice(struct rect *size, struct point *dim);
+    // the position the field decays from at open borders
+    struct rect getOpenCenter();
+    void updateLattice(const QRectF &area);
     QPointF coordFromRect(struct rect *pos);
     struct rect coordToRect(const QPointF &pos);
     bound* boundary(struct bound* bound, struct rect* pos);
@@ -49,15 +171,36 @@ private:
     static double weightTrampoline(void *ptr, struct rect* pos) {
         return ((Laplace*)ptr)->weight(pos);
     }
+    enum preconditioner getCGPreconditioner();
+    uint32_t solve(struct lattice *lattice, struct config *conf, progress_callback_t cb);
+    uint32_t solve(struct fem *fem, struct config *conf, progress_callback_t cb);
+    // reports a failed solve as an error and stops the calculation, returns the iterations otherwise
+    uint32_t checkSolved(uint32_t iterations);
+    // solves both lattices, at the same time if there are threads for the air solve
+    uint32_t solveBoth(struct lattice *lattice, struct lattice *air, struct config *conf, progress_callback_t cb);
+    QVector<int32_t> getConductorLabels();
+    bool calcMatrix(struct config *conf);
+    // builds the triangles and the conditions on their points
+    bool createTriangles();
+    void deleteTriangles();
+    void* calcTriangles(struct config *conf);
+    bool calcTriangleMatrix(struct config *conf);
+    void finishCalculation(bool aborted, uint32_t iterations);
     void* calcThread();
     static void* calcThreadTrampoline(void *ptr) {
         return ((Laplace*)ptr)->calcThread();
     }
+    void* airThread();
+    static void* airThreadTrampoline(void *ptr) {
+        return ((Laplace*)ptr)->airThread();
+    }
     void calcProgressFromDiff(double diff);
     static void calcProgressFromDiffTrampoline(void *ptr, double diff) {
         ((Laplace*)ptr)->calcProgressFromDiff(diff);
     }
     bool calculationRunning;
+    // shared by all lattices and problems of the calculation, so an abort never writes to one that is replaced
+    volatile bool abortRequested;
     bool resultReady;
     ElementList *list;
     QPointF topLeft, bottomRight;
@@ -65,11 +208,62 @@ private:
     int threads;
     double threshold;
     bool groundedBorders;
+    bool openBorders;
     bool ignoreDielectric;
+    Solver solver;
+    Preconditioner preconditioner;
+    // the elements at each cell of the lattice under construction
+    Raster conductors, materials;
+    struct rect rasterStep;
+    // the first cell covered by the rasters
+    struct point rasterOffset;
+    bool nestedIteration;
+    bool warmStart;
+    bool airSolve;
+    bool conductorMatrix;
+    bool useSymmetry;
+    Symmetry symmetry;
+    bool gradedMesh;
+    bool adaptiveMesh;
+    // the positions of the columns and rows of a graded lattice without the outer ring, in units of the grid.
+    // Both are empty for a uniform lattice
+    QVector<double> meshX, meshY;
+    bool triangleMesh;
+    // the triangles of the area and the problems solved on them, only set if the problem is solved on triangles
+    struct mesh *triangles;
+    struct fem *fem, *airFem;
+    // the trace of each point of the triangles, negative for the other points
+    QVector<int32_t> triangleLabels;
+    // the triangle found last by getPotential, the search for the next pixel starts there
+    uint32_t potentialHint;
+    // the x coordinate of the symmetry plane
+    double symmetryCenter;
+    // the same plane on the lattice, it is the last column inside the outer ring
+    double symmetryPlane;
     struct lattice *lattice;
+    // the same problem without dielectric, only set if it is solved as well
+    struct lattice *airLattice;
+    // the lattice solved by the air thread
+    struct lattice *airTarget;
+    struct config airConf;
+    uint32_t airIterations;
+    QStringList conductorNames;
+    QVector<double> capacitances, airCapacitances;
+    LatticeSettings latticeSettings;
+    // the area changed since the lattice was built, only set if the lattice is updated in place
+    QRectF changedArea;
+    // the lattice of the last calculation, used as the starting point of the next one
+    struct lattice *previous;
+    LatticeSettings previousSettings;
+    struct pool *pool;
+    struct pool *airPool;
+    SolutionCache cache;
+    QByteArray solutionKey;
+    QMap<QString, double> results;
     int lastPercent;
 
     pthread_t thread;
+    pthread_t airSolveThread;
 };
 
 #endif // LAPLACE_H
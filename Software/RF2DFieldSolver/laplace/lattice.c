@@ -1,41 +1,128 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <pthread.h>
 
 #include "lattice.h"
 #include "worker.h"
+#include "pool.h"
 
 /**
- * This function setups each of the cell in the lattice.
+ * This is the number of rows handed to a thread at once while
+ * building the lattice.
  */
-void lattice_set_size(struct lattice* lattice, struct rect* size);
+#define LATTICE_BAND 8
 
 /**
- * This function applies the boundary function to each of the cell.
+ * This structure holds the state shared by the threads building a
+ * lattice.
  */
-void lattice_apply_bound(struct lattice* lattice, bound_t func, void *ptr);
+struct lattice_build {
+    struct lattice* lattice;
+    bound_t func;
+    weight_t w_func;
+    void* ptr;
+    struct pool* pool;
+    /* the next band of rows of each step */
+    uint32_t next[2];
+};
+
+/**
+ * This function builds a lattice on one thread of the pool, the
+ * threads take bands of rows until none are left.
+ */
+void lattice_build_work(void* ptr, uint32_t id, uint32_t count);
+
+/**
+ * This function setups the cells of the rows first to last-1.
+ */
+void lattice_set_size(struct lattice* lattice, uint32_t first, uint32_t last);
 
 /**
- * This function applies the weight function to each of the cells.
+ * This function applies the boundary function to the cells of the
+ * rows first to last-1.
  */
-void lattice_apply_weight(struct lattice* lattice, weight_t func, void *ptr);
+void lattice_apply_bound(struct lattice* lattice, bound_t func, void *ptr, uint32_t first, uint32_t last);
 
 /**
- * This function generates the function for each of the cell.
+ * This function applies the weight function to the cells of the rows
+ * first to last-1.
  */
-void lattice_generate_function(struct lattice* lattice);
+void lattice_apply_weight(struct lattice* lattice, weight_t func, void *ptr, uint32_t first, uint32_t last);
+
+/**
+ * This function computes the stencil coefficients of the cells from
+ * first to last-1 along both axes. The conditions and weights of the
+ * adjacent cells must be known.
+ */
+void lattice_compile(struct lattice* lattice, struct point* first, struct point* last);
 
 /**
  * This function applies one sequential iteration.
  */
 double lattice_iterate(struct lattice* lattice);
 
-struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func, weight_t w_func, void *ptr) {
-    struct cell* cells;
-    struct lattice* lattice;
-    double (**update)(struct lattice*, struct cell*);
+/**
+ * This function allocates a lattice and all its arrays, the dimension
+ * includes the outer ring.
+ */
+static struct lattice* lattice_alloc(struct point* dim) {
+    struct lattice* lattice = NULL;
+    double* value = NULL;
+    double* weight = NULL;
+    uint8_t* cond = NULL;
+
+    /* compute the number of cell */
+    uint32_t m = dim->x*dim->y;
+
+    /* allocate memory for each array of the cells */
+    value = lattice_alloc_aligned(m*sizeof(double));
+    if(value == NULL) goto ERROR;
+
+    weight = lattice_alloc_aligned(m*sizeof(double));
+    if(weight == NULL) goto ERROR;
+
+    cond = lattice_alloc_aligned(m*sizeof(uint8_t));
+    if(cond == NULL) goto ERROR;
+
+    /* allocate the memory for the lattice structure */
+    lattice = calloc(1, sizeof(struct lattice));
+    if(lattice == NULL) goto ERROR;
+
+    /* allocate memory for the coefficients */
+    for(uint32_t k = 0; k < STENCIL_SIZE; k++) {
+        lattice->coeff[k] = lattice_alloc_aligned(m*sizeof(double));
+        if(lattice->coeff[k] == NULL) goto ERROR;
+    }
+
+    /* initialise the lattice structure */
+    lattice->dim.x = dim->x;
+    lattice->dim.y = dim->y;
+    lattice->value = value;
+    lattice->weight = weight;
+    lattice->cond = cond;
+    lattice->xs = NULL;
+    lattice->ys = NULL;
+    lattice->open = 0;
+    lattice->abort = NULL;
 
+    return lattice;
+
+ERROR:
+    lattice_free_aligned(value);
+    lattice_free_aligned(weight);
+    lattice_free_aligned(cond);
+    if(lattice != NULL) {
+        for(uint32_t k = 0; k < STENCIL_SIZE; k++)
+            lattice_free_aligned(lattice->coeff[k]);
+        free(lattice);
+    }
+
+    return NULL;
+}
+
+struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func, weight_t w_func, void *ptr, struct pool* pool) {
     /* make sure the dimension is useful */
     if(dim->x == 0 || dim->y == 0)
         return NULL;
@@ -44,51 +131,178 @@ struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func,
     dim->x += 3;
     dim->y += 3;
 
-    /* compute the number of cell */
-    uint32_t m = dim->x*dim->y;
+    struct lattice* lattice = lattice_alloc(dim);
+    if(lattice == NULL)
+        return NULL;
 
-    /* allocate memory for the cells */
-    cells = malloc(m*sizeof(struct cell));
-    if(cells == NULL) goto ERROR;
+    /* compute the subdivisions */
+    lattice->step.x = size->x/(dim->x-3);
+    lattice->step.y = size->y/(dim->y-3);
 
-    /* allocate memory for the functions */
-    update = malloc(m*sizeof(double (*)(struct lattice*, struct cell*)));
-    if(update == NULL) goto ERROR;
+    /* apply all the steps for finishing the lattice */
+    struct lattice_build build = {lattice, func, w_func, ptr, pool, {0, 0}};
+    pool_run(pool, lattice_build_work, &build);
 
-    /* allocate the memory for the lattice structure */
-    lattice = malloc(sizeof(struct lattice));
-    if(lattice == NULL) goto ERROR;
+    return lattice;
+}
 
-    /* initialise the lattice structure */
-    lattice->dim.x = dim->x;
-    lattice->dim.y = dim->y;
-    lattice->cells = cells;
-    lattice->update = update;
-    lattice->abort = false;
+/**
+ * This function stores the positions of the columns or rows of a
+ * graded lattice, the cells of the outer ring mirror the cells next
+ * to them.
+ */
+static double* lattice_new_axis(const double* nodes, uint32_t n) {
+    double* pos = malloc((n+2)*sizeof(double));
+    if(pos == NULL)
+        return NULL;
+
+    for(uint32_t i = 0; i < n; i++)
+        pos[i+1] = nodes[i];
+    pos[0] = 2*nodes[0]-nodes[1];
+    pos[n+1] = 2*nodes[n-1]-nodes[n-2];
+
+    return pos;
+}
+
+/**
+ * This function copies the positions of the columns and rows of a
+ * graded lattice. It returns 0 if everything went as expected, else
+ * -1.
+ */
+static int lattice_copy_axes(struct lattice* from, struct lattice* to) {
+    if(from->xs == NULL)
+        return 0;
+
+    to->xs = malloc(from->dim.x*sizeof(double));
+    to->ys = malloc(from->dim.y*sizeof(double));
+    if(to->xs == NULL || to->ys == NULL)
+        return -1;
+
+    memcpy(to->xs, from->xs, from->dim.x*sizeof(double));
+    memcpy(to->ys, from->ys, from->dim.y*sizeof(double));
+    return 0;
+}
+
+struct lattice* lattice_new_graded(const double* xs, uint32_t nx, const double* ys, uint32_t ny, bound_t func, weight_t w_func, void *ptr, struct pool* pool) {
+    /* make sure the dimension is useful */
+    if(nx < 2 || ny < 2)
+        return NULL;
+
+    /* add the outer ring */
+    struct point dim = {nx+2, ny+2};
+    struct lattice* lattice = lattice_alloc(&dim);
+    if(lattice == NULL)
+        return NULL;
+
+    lattice->xs = lattice_new_axis(xs, nx);
+    lattice->ys = lattice_new_axis(ys, ny);
+    if(lattice->xs == NULL || lattice->ys == NULL) {
+        lattice_delete(lattice);
+        return NULL;
+    }
+
+    /* the average distance between the cells */
+    lattice->step.x = (xs[nx-1]-xs[0])/(nx-1);
+    lattice->step.y = (ys[ny-1]-ys[0])/(ny-1);
 
     /* apply all the steps for finishing the lattice */
-    lattice_set_size(lattice, size);
-    lattice_apply_bound(lattice, func, ptr);
-    lattice_apply_weight(lattice, w_func, ptr);
-    lattice_generate_function(lattice);
+    struct lattice_build build = {lattice, func, w_func, ptr, pool, {0, 0}};
+    pool_run(pool, lattice_build_work, &build);
 
     return lattice;
+}
 
-ERROR:
-    if(cells   != NULL) free(cells);
-    if(update  != NULL) free(update);
-    if(lattice != NULL) free(lattice);
+struct lattice* lattice_new_uniform(struct lattice* from) {
+    struct lattice* lattice = lattice_alloc(&from->dim);
+    if(lattice == NULL)
+        return NULL;
 
-    return NULL;
+    lattice->step = from->step;
+    lattice->open = from->open;
+    lattice->center = from->center;
+    lattice->abort = from->abort;
+    if(lattice_copy_axes(from, lattice) != 0) {
+        lattice_delete(lattice);
+        return NULL;
+    }
+
+    /* the conditions and values are shared, only the weights differ */
+    uint32_t m = from->dim.x*from->dim.y;
+    for(uint32_t index = 0; index < m; index++) {
+        lattice->value[index] = from->value[index];
+        lattice->weight[index] = 1.0;
+        lattice->cond[index] = from->cond[index];
+    }
+
+    struct point first = {0, 0};
+    lattice_compile(lattice, &first, &lattice->dim);
+
+    return lattice;
+}
+
+struct lattice* lattice_new_excitation(struct lattice* from, const int32_t* label, int32_t conductor) {
+    struct lattice* lattice = lattice_alloc(&from->dim);
+    if(lattice == NULL)
+        return NULL;
+
+    lattice->step = from->step;
+    lattice->open = from->open;
+    lattice->center = from->center;
+    lattice->abort = from->abort;
+    if(lattice_copy_axes(from, lattice) != 0) {
+        lattice_delete(lattice);
+        return NULL;
+    }
+
+    /* the stencil is the same, only the fixed values differ */
+    uint32_t m = from->dim.x*from->dim.y;
+    memcpy(lattice->weight, from->weight, m*sizeof(double));
+    memcpy(lattice->cond, from->cond, m*sizeof(uint8_t));
+    for(uint32_t k = 0; k < STENCIL_SIZE; k++)
+        memcpy(lattice->coeff[k], from->coeff[k], m*sizeof(double));
+    for(uint32_t index = 0; index < m; index++)
+        lattice->value[index] = (lattice->cond[index] == DIRICHLET && label[index] == conductor) ? 1.0 : 0;
+
+    return lattice;
 }
 
 void lattice_delete(struct lattice* lattice) {
     /* free all the allocated memory */
-    free(lattice->cells);
-    free(lattice->update);
+    lattice_free_aligned(lattice->value);
+    lattice_free_aligned(lattice->weight);
+    lattice_free_aligned(lattice->cond);
+    for(uint32_t k = 0; k < STENCIL_SIZE; k++)
+        lattice_free_aligned(lattice->coeff[k]);
+    free(lattice->xs);
+    free(lattice->ys);
     free(lattice);
 }
 
+void* lattice_alloc_aligned(size_t size) {
+    /* round up to a multiple of the alignment */
+    size = (size+LATTICE_ALIGNMENT-1)/LATTICE_ALIGNMENT*LATTICE_ALIGNMENT;
+
+#ifdef _WIN32
+    return _aligned_malloc(size, LATTICE_ALIGNMENT);
+#else
+    void* ptr;
+    if(posix_memalign(&ptr, LATTICE_ALIGNMENT, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void lattice_free_aligned(void* ptr) {
+    if(ptr == NULL)
+        return;
+
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
 void lattice_print(struct lattice* lattice) {
     /* extract the dimension of the lattice */
     uint32_t w = lattice->dim.x;
@@ -96,243 +310,583 @@ void lattice_print(struct lattice* lattice) {
 
     for(uint32_t j = 0; j < h; j++) {
         for(uint32_t i = 0; i < w; i++) {
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[i+j*w];
+            /* compute the index of the cell */
+            uint32_t index = i+j*w;
 
             /* don't print cells if they contain neumann condition */
-            if(cell->cond == NEUMANN)
+            if(lattice->cond[index] == NEUMANN)
                 fprintf(stderr, "          ,");
             else
-                fprintf(stderr, "% 10.5f,", cell->value);
+                fprintf(stderr, "% 10.5f,", lattice->value[index]);
         }
         fprintf(stderr, "\n");
     }
 }
 
-void lattice_set_size(struct lattice* lattice, struct rect* size) {
+void lattice_build_work(void* ptr, uint32_t id, uint32_t count) {
+    struct lattice_build* build = (struct lattice_build*) ptr;
+    struct lattice* lattice = build->lattice;
+    uint32_t h = lattice->dim.y;
+    uint32_t first;
+
+    (void) id;
+    (void) count;
+
+    /* the conditions and weights of a cell only depend on its position */
+    while((first = pool_next(&build->next[0])*LATTICE_BAND) < h) {
+        uint32_t last = (first+LATTICE_BAND < h) ? first+LATTICE_BAND : h;
+
+        lattice_set_size(lattice, first, last);
+        lattice_apply_bound(lattice, build->func, build->ptr, first, last);
+        lattice_apply_weight(lattice, build->w_func, build->ptr, first, last);
+    }
+
+    /* the stencils need the adjacent rows of the other threads */
+    pool_barrier(build->pool);
+
+    while((first = pool_next(&build->next[1])*LATTICE_BAND) < h) {
+        struct point from = {0, first};
+        struct point to = {lattice->dim.x, (first+LATTICE_BAND < h) ? first+LATTICE_BAND : h};
+
+        lattice_compile(lattice, &from, &to);
+    }
+}
+
+void lattice_set_size(struct lattice* lattice, uint32_t first, uint32_t last) {
     /* extract the dimension of the lattice */
     int32_t w = lattice->dim.x;
     int32_t h = lattice->dim.y;
 
-    /* compute the subdivisions */
-    double dx = size->x/(w-3);
-    double dy = size->y/(h-3);
-
-    for(int32_t j = -1; j+1 < h; j++) {
+    for(int32_t j = (int32_t) first-1; j+1 < (int32_t) last; j++) {
         for(int32_t i = -1; i+1 < w; i++) {
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[(i+1)+(j+1)*w];
+            /* compute the index of the cell */
+            uint32_t index = (i+1)+(j+1)*w;
 
             /* initialise the cell */
-            cell->pos.x = i*dx;
-            cell->pos.y = j*dy;
-            cell->index.x = i+1;
-            cell->index.y = j+1;
-            cell->value = 0;
+            lattice->value[index] = 0;
+            lattice->weight[index] = 1.0;
 
             /* the limits of the lattice are Neumann conditions */
-            if(i == -1 || j == -1 || i == w-2 || j == h-2) {
-                /* we don't need the adjacent cells */
-                cell->adj[0] = 0;
-                cell->adj[1] = 0;
-                cell->adj[2] = 0;
-                cell->adj[3] = 0;
-
-                /* we don't need the adjacent cells */
-                cell->diag[0] = 0;
-                cell->diag[1] = 0;
-                cell->diag[2] = 0;
-                cell->diag[3] = 0;
-
-                cell->cond = NEUMANN;
-            } else {
-                /* compute the index of the adjacent cells */
-                cell->adj[0] = (i+1)+(j-0)*w;
-                cell->adj[1] = (i+1)+(j+2)*w;
-                cell->adj[2] = (i-0)+(j+1)*w;
-                cell->adj[3] = (i+2)+(j+1)*w;
-
-                /* compute the index of the diagonal cells */
-                cell->diag[0] = (i+2)+(j-0)*w;
-                cell->diag[1] = (i+2)+(j+2)*w;
-                cell->diag[2] = (i-0)+(j+2)*w;
-                cell->diag[3] = (i-0)+(j-0)*w;
-
-                cell->cond = UNSET;
-            }
+            if(i == -1 || j == -1 || i == w-2 || j == h-2)
+                lattice->cond[index] = NEUMANN;
+            else
+                lattice->cond[index] = UNSET;
         }
     }
 }
 
-void lattice_apply_bound(struct lattice* lattice, bound_t func, void *ptr) {
+/**
+ * This function computes the spatial position of a cell.
+ */
+static inline void lattice_position(struct lattice* lattice, uint32_t i, uint32_t j, struct rect* pos) {
+    if(lattice->xs != NULL) {
+        pos->x = lattice->xs[i];
+        pos->y = lattice->ys[j];
+        return;
+    }
+
+    /* the first row and column are outside of the problem */
+    pos->x = ((int32_t) i-1)*lattice->step.x;
+    pos->y = ((int32_t) j-1)*lattice->step.y;
+}
+
+/**
+ * This function computes the width of the part of the problem that a
+ * cell of a graded lattice stands for along one axis. It reaches
+ * halfway to the adjacent cells, so the cells next to the outer ring
+ * only cover half of the distance to their neighbour inside.
+ */
+static inline double lattice_dual(const double* pos, uint32_t i, uint32_t n) {
+    double from = (i > 1) ? pos[i-1] : pos[i];
+    double to = (i < n-2) ? pos[i+1] : pos[i];
+    return (to-from)/2;
+}
+
+void lattice_apply_bound(struct lattice* lattice, bound_t func, void *ptr, uint32_t first, uint32_t last) {
     /* extract the dimension of the lattice */
     uint32_t w = lattice->dim.x;
-    uint32_t h = lattice->dim.y;
 
     /* used for returning data from the boundary function */
     struct bound bound = {NONE, 0};
+    struct rect pos;
 
     /* apply the boundary function to each cell */
-    for(uint32_t j = 0; j < h; j++) {
+    for(uint32_t j = first; j < last; j++) {
         for(uint32_t i = 0; i < w; i++) {
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[i+j*w];
+            /* compute the index of the cell */
+            uint32_t index = i+j*w;
 
             /* make sure the cell isn't already set */
-            if(cell->cond != UNSET)
+            if(lattice->cond[index] != UNSET)
                 continue;
 
             /* apply the boundary function */
-            if(func(ptr, &bound, &cell->pos) == NULL)
+            lattice_position(lattice, i, j, &pos);
+            if(func(ptr, &bound, &pos) == NULL)
                 continue;
 
             /* update the cell */
-            cell->value = bound.value;
-            cell->cond  = bound.cond;
+            lattice->value[index] = bound.value;
+            lattice->cond[index]  = bound.cond;
         }
     }
 }
 
-void lattice_apply_weight(struct lattice* lattice, weight_t func, void *ptr) {
+void lattice_apply_weight(struct lattice* lattice, weight_t func, void *ptr, uint32_t first, uint32_t last) {
     /* extract the dimension of the lattice */
     uint32_t w = lattice->dim.x;
-    uint32_t h = lattice->dim.y;
+
+    struct rect pos;
 
     /* apply the weight function to each cell */
-    for(uint32_t j = 0; j < h; j++) {
+    for(uint32_t j = first; j < last; j++) {
         for(uint32_t i = 0; i < w; i++) {
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[i+j*w];
-
             /* update the cell */
-            cell->weight = func(ptr, &cell->pos);
+            lattice_position(lattice, i, j, &pos);
+            lattice->weight[i+j*w] = func(ptr, &pos);
         }
     }
 }
 
-/* definition of the supported configurations */
-#define GETFORMULA_MIDDLE_0     (  v1*w1+  v2*w2+  v3*w3+  v4*w4)/(w1+w2+w3+w4)
-#define GETFORMULA_SIDE_1       (     2*v2*w2+  v3*w3+  v4*w4)/(2*w2+w3+w4)
-#define GETFORMULA_SIDE_2       (2*v1*w1     +  v3*w3+  v4*w4)/(2*w1+w3+w4)
-#define GETFORMULA_SIDE_3       (  v1*w1+  v2*w2+    +2*v4*w4)/(2*w4+w1+w2)
-#define GETFORMULA_SIDE_4       (  v1*w1+  v2*w2+2*v3*w3     )/(2*w3+w1+w2)
-#define GETFORMULA_CORNER_1     (   v2*w2+v3*w3   )/(w2+w3)
-#define GETFORMULA_CORNER_2     (v1*w1   +v3*w3   )/(w1+w3)
-#define GETFORMULA_CORNER_3     (v1*w1      +v4*w4)/(w1+w4)
-#define GETFORMULA_CORNER_4     (   v2*w2   +v4*w4)/(w2+w4)
-#define GETFORMULA_INV_CORNER_1 (  v1*w1+2*v2*w2+2*v3*w3+  v4+w4)/(w1+2*w2+2*w3+w4)
-#define GETFORMULA_INV_CORNER_2 (2*v1*w1+  v2*w2+2*v3*w3+  v4*w4)/(2*w1+w2+2*w3+w4)
-#define GETFORMULA_INV_CORNER_3 (2*v1*w1+  v2*w2+  v3*w3+2*v4*w4)/(2*w1+w2+w3+2*w4)
-#define GETFORMULA_INV_CORNER_4 (  v1*w1+2*v2*w2+  v3*w3+2*v4*w4)/(w1+2*w2+w3+2*w4)
-
 /**
- * This macro generates function for the supported configurations.
- * Even though not each function needs all the adjacent point, the
- * compiler should optimize away points that are not needed.
+ * This function computes the symmetric stencil of a cell of a graded
+ * lattice. The coefficient between two cells is the product of their
+ * weights and the width of the cells across the edge, divided by the
+ * length of the edge. With equal distances, this is the same as the
+ * stencil of a uniform lattice.
  */
-#define MAKE_FUNCPOINTS(NUM,IDX) \
-double func_##NUM##_##IDX (struct lattice* lattice, struct cell* cell) {\
-    uint32_t i1 = cell->adj[0];           \
-    uint32_t i2 = cell->adj[1];           \
-    uint32_t i3 = cell->adj[2];           \
-    uint32_t i4 = cell->adj[3];           \
-                                          \
-    double v1 = lattice->cells[i1].value; \
-    double v2 = lattice->cells[i2].value; \
-    double v3 = lattice->cells[i3].value; \
-    double v4 = lattice->cells[i4].value; \
-                                          \
-    double w1 = lattice->cells[i1].weight;\
-    double w2 = lattice->cells[i2].weight;\
-    double w3 = lattice->cells[i3].weight;\
-    double w4 = lattice->cells[i4].weight;\
-                                          \
-    (void)v1;(void)v2;(void)v3;(void)v4;  \
-    (void)w1;(void)w2;(void)w3;(void)w4;  \
-    return GETFORMULA_##NUM##_##IDX ;     \
+static void lattice_stencil_graded(struct lattice* lattice, uint32_t index, double* a) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+    uint32_t i = index%w;
+    uint32_t j = index/w;
+    uint8_t* cond = lattice->cond;
+    double* weight = lattice->weight;
+    const double* xs = lattice->xs;
+    const double* ys = lattice->ys;
+
+    double dx = lattice_dual(xs, i, w);
+    double dy = lattice_dual(ys, j, h);
+    double s = weight[index];
+
+    a[STENCIL_S] = (cond[index-w] == NEUMANN) ? 0 : -s*weight[index-w]*dx/(ys[j]-ys[j-1]);
+    a[STENCIL_N] = (cond[index+w] == NEUMANN) ? 0 : -s*weight[index+w]*dx/(ys[j+1]-ys[j]);
+    a[STENCIL_W] = (cond[index-1] == NEUMANN) ? 0 : -s*weight[index-1]*dy/(xs[i]-xs[i-1]);
+    a[STENCIL_E] = (cond[index+1] == NEUMANN) ? 0 : -s*weight[index+1]*dy/(xs[i+1]-xs[i]);
+    a[STENCIL_C] = -(a[STENCIL_S]+a[STENCIL_N]+a[STENCIL_W]+a[STENCIL_E]);
+    a[STENCIL_C] += lattice_open_term(lattice, index, false);
+}
+
+void lattice_stencil(struct lattice* lattice, uint32_t index, double* a) {
+    uint32_t w = lattice->dim.x;
+    uint8_t* cond = lattice->cond;
+    double* weight = lattice->weight;
+
+    if(lattice->xs != NULL) {
+        lattice_stencil_graded(lattice, index, a);
+        return;
+    }
+
+    /* check if the adjacent cells are neumann boundary */
+    int A1 = (cond[index-w] == NEUMANN) ? 1 : 0;
+    int A2 = (cond[index+w] == NEUMANN) ? 1 : 0;
+    int A3 = (cond[index-1] == NEUMANN) ? 1 : 0;
+    int A4 = (cond[index+1] == NEUMANN) ? 1 : 0;
+
+    /* a neumann boundary mirrors the opposite cell */
+    double m1 = A1 ? 0 : (A2 ? 2 : 1);
+    double m2 = A2 ? 0 : (A1 ? 2 : 1);
+    double m3 = A3 ? 0 : (A4 ? 2 : 1);
+    double m4 = A4 ? 0 : (A3 ? 2 : 1);
+    double s = weight[index]*((A1 || A2) ? 0.5 : 1.0)*((A3 || A4) ? 0.5 : 1.0);
+
+    a[STENCIL_S] = -s*m1*weight[index-w];
+    a[STENCIL_N] = -s*m2*weight[index+w];
+    a[STENCIL_W] = -s*m3*weight[index-1];
+    a[STENCIL_E] = -s*m4*weight[index+1];
+    a[STENCIL_C] = -(a[STENCIL_S]+a[STENCIL_N]+a[STENCIL_W]+a[STENCIL_E]);
+    if(A1 || A2 || A3 || A4)
+        a[STENCIL_C] += lattice_open_term(lattice, index, false);
 }
 
-/* we generate the function for each configuration */
-MAKE_FUNCPOINTS(MIDDLE,0)
-MAKE_FUNCPOINTS(SIDE,1)
-MAKE_FUNCPOINTS(SIDE,2)
-MAKE_FUNCPOINTS(SIDE,3)
-MAKE_FUNCPOINTS(SIDE,4)
-MAKE_FUNCPOINTS(CORNER,1)
-MAKE_FUNCPOINTS(CORNER,2)
-MAKE_FUNCPOINTS(CORNER,3)
-MAKE_FUNCPOINTS(CORNER,4)
-MAKE_FUNCPOINTS(INV_CORNER,1)
-MAKE_FUNCPOINTS(INV_CORNER,2)
-MAKE_FUNCPOINTS(INV_CORNER,3)
-MAKE_FUNCPOINTS(INV_CORNER,4)
-
-void lattice_generate_function(struct lattice* lattice) {
+void lattice_set_open(struct lattice* lattice, uint8_t borders, struct rect* center) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+
+    lattice->open = borders;
+    lattice->center = *center;
+
+    /* only the cells next to the outer ring change */
+    struct point first, last;
+    first = (struct point) {1, 1};
+    last = (struct point) {w-1, 2};
+    lattice_compile(lattice, &first, &last);
+    first = (struct point) {1, h-2};
+    last = (struct point) {w-1, h-1};
+    lattice_compile(lattice, &first, &last);
+    first = (struct point) {1, 1};
+    last = (struct point) {2, h-1};
+    lattice_compile(lattice, &first, &last);
+    first = (struct point) {w-2, 1};
+    last = (struct point) {w-1, h-1};
+    lattice_compile(lattice, &first, &last);
+}
+
+double lattice_open_term(struct lattice* lattice, uint32_t index, bool air) {
+    if(lattice->open == 0)
+        return 0;
+
+    uint32_t w = lattice->dim.x;
+    uint8_t* cond = lattice->cond;
+    double* weight = lattice->weight;
+
+    /* the open borders next to the cell */
+    int A1 = (cond[index-w] == NEUMANN) && (lattice->open & BORDER_SOUTH);
+    int A2 = (cond[index+w] == NEUMANN) && (lattice->open & BORDER_NORTH);
+    int A3 = (cond[index-1] == NEUMANN) && (lattice->open & BORDER_WEST);
+    int A4 = (cond[index+1] == NEUMANN) && (lattice->open & BORDER_EAST);
+    if(!A1 && !A2 && !A3 && !A4)
+        return 0;
+
+    /* the factors of the borders along each axis, with the same scale as lattice_stencil */
+    double s = air ? 1.0 : weight[index];
+    double fx, fy;
+    if(lattice->xs != NULL) {
+        /* the flux leaves through the width of the cell along the border */
+        fx = s*lattice_dual(lattice->ys, index/w, lattice->dim.y);
+        fy = s*lattice_dual(lattice->xs, index%w, w);
+    } else {
+        /* the outer cell mirrors the opposite one */
+        int N1 = cond[index-w] == NEUMANN;
+        int N2 = cond[index+w] == NEUMANN;
+        int N3 = cond[index-1] == NEUMANN;
+        int N4 = cond[index+1] == NEUMANN;
+        s *= ((N1 || N2) ? 0.5 : 1.0)*((N3 || N4) ? 0.5 : 1.0);
+        fx = 2*s*lattice->step.x;
+        fy = 2*s*lattice->step.y;
+    }
+
+    struct rect pos;
+    lattice_position(lattice, index%w, index/w, &pos);
+    double dx = pos.x-lattice->center.x;
+    double dy = pos.y-lattice->center.y;
+    double r2 = dx*dx+dy*dy;
+    if(r2 == 0)
+        return 0;
+
+    /*
+     * The outer cell is the mirrored cell corrected by the derivative
+     * across the border, which is the potential of the cell scaled by
+     * the component of the direction away from the centre divided by
+     * the distance. Borders facing the centre are left as they are.
+     */
+    double term = 0;
+    if(A1)
+        term += fy*(air ? 1.0 : weight[index+w])*fmax(-dy, 0)/r2;
+    if(A2)
+        term += fy*(air ? 1.0 : weight[index-w])*fmax(dy, 0)/r2;
+    if(A3)
+        term += fx*(air ? 1.0 : weight[index+1])*fmax(-dx, 0)/r2;
+    if(A4)
+        term += fx*(air ? 1.0 : weight[index-1])*fmax(dx, 0)/r2;
+
+    return term;
+}
+
+void lattice_edges(struct lattice* lattice, uint32_t index, bool air, double* east, double* north) {
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+    uint32_t i = index%w;
+    uint32_t j = index/w;
+    const double* g = lattice->weight;
+
+    if(lattice->xs != NULL) {
+        *east = (i == w-2) ? 0 : lattice_dual(lattice->ys, j, h)/(lattice->xs[i+1]-lattice->xs[i]);
+        *north = (j == h-2) ? 0 : lattice_dual(lattice->xs, i, w)/(lattice->ys[j+1]-lattice->ys[j]);
+    } else {
+        /* the edges along the outer cells are shared with their mirror image */
+        double hf = (j == 1 || j == h-2) ? 0.5 : 1.0;
+        double vf = (j == h-2) ? 0 : 1.0;
+        *east = (i == w-2) ? 0 : hf;
+        *north = (i == 1 || i == w-2) ? 0.5*vf : vf;
+    }
+
+    if(!air) {
+        *east = *east*g[index]*g[index+1];
+        *north = *north*g[index]*g[index+w];
+    }
+}
+
+/**
+ * These are the supported configurations of the adjacent neumann
+ * cells. A neumann cell mirrors the cell on the opposite side, which
+ * is folded into the stencil by doubling the factor of that cell.
+ */
+enum lattice_config {
+    MIDDLE_0,
+    SIDE_1,
+    SIDE_2,
+    SIDE_3,
+    SIDE_4,
+    CORNER_1,
+    CORNER_2,
+    CORNER_3,
+    CORNER_4,
+    INV_CORNER_1,
+    INV_CORNER_2,
+    INV_CORNER_3,
+    INV_CORNER_4,
+};
+
+/**
+ * These are the factors applied to the weights of the adjacent cells
+ * for each configuration, in the order below, left and right.
+ */
+static const double lattice_factors[][4] = {
+    [MIDDLE_0]     = {1, 1, 1, 1},
+    [SIDE_1]       = {0, 2, 1, 1},
+    [SIDE_2]       = {2, 0, 1, 1},
+    [SIDE_3]       = {1, 1, 0, 2},
+    [SIDE_4]       = {1, 1, 2, 0},
+    [CORNER_1]     = {0, 1, 1, 0},
+    [CORNER_2]     = {1, 0, 1, 0},
+    [CORNER_3]     = {1, 0, 0, 1},
+    [CORNER_4]     = {0, 1, 0, 1},
+    [INV_CORNER_1] = {1, 2, 2, 1},
+    [INV_CORNER_2] = {2, 1, 2, 1},
+    [INV_CORNER_3] = {2, 1, 1, 2},
+    [INV_CORNER_4] = {1, 2, 1, 2},
+};
+
+void lattice_compile(struct lattice* lattice, struct point* first, struct point* last) {
     /* extract the dimension of the lattice */
     int32_t w = lattice->dim.x;
-    int32_t h = lattice->dim.y;
 
-    for(int32_t j = 0; j < h; j++) {
-        for(int32_t i = 0; i < w; i++) {
+    /* shortcut to the conditions and weights */
+    uint8_t* cond = lattice->cond;
+    double* weight = lattice->weight;
+
+    for(int32_t j = first->y; j < (int32_t) last->y; j++) {
+        for(int32_t i = first->x; i < (int32_t) last->x; i++) {
             /* compute the index of the cell */
             uint32_t index = i+j*w;
+            enum lattice_config config;
 
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[index];
-
-            /* we ignore neumann or dirichlet conditions */
-            if(cell->cond == NEUMANN || cell->cond == DIRICHLET) {
-                lattice->update[index] = NULL;
+            /* neumann or dirichlet cells keep their value */
+            if(cond[index] == NEUMANN || cond[index] == DIRICHLET) {
+                lattice->coeff[STENCIL_C][index] = 1.0;
+                lattice->coeff[STENCIL_W][index] = 0;
+                lattice->coeff[STENCIL_E][index] = 0;
+                lattice->coeff[STENCIL_S][index] = 0;
+                lattice->coeff[STENCIL_N][index] = 0;
 
                 continue;
             }
 
-            /* extracts each adjacent cell */
-            struct cell* a1 = &lattice->cells[cell->adj[0]];
-            struct cell* a2 = &lattice->cells[cell->adj[1]];
-            struct cell* a3 = &lattice->cells[cell->adj[2]];
-            struct cell* a4 = &lattice->cells[cell->adj[3]];
+            /* the stencil of a graded lattice is normalised directly */
+            if(lattice->xs != NULL) {
+                double a[STENCIL_SIZE];
+                lattice_stencil(lattice, index, a);
+                lattice->coeff[STENCIL_C][index] = 0;
+                lattice->coeff[STENCIL_S][index] = -a[STENCIL_S]/a[STENCIL_C];
+                lattice->coeff[STENCIL_N][index] = -a[STENCIL_N]/a[STENCIL_C];
+                lattice->coeff[STENCIL_W][index] = -a[STENCIL_W]/a[STENCIL_C];
+                lattice->coeff[STENCIL_E][index] = -a[STENCIL_E]/a[STENCIL_C];
 
-            struct cell* d1 = &lattice->cells[cell->diag[0]];
-            struct cell* d2 = &lattice->cells[cell->diag[1]];
-            struct cell* d3 = &lattice->cells[cell->diag[2]];
-            struct cell* d4 = &lattice->cells[cell->diag[3]];
+                continue;
+            }
 
             /* check if the adjacent cells are neumann boundary */
-            int A1 = (a1->cond == NEUMANN) ? 1 : 0;
-            int A2 = (a2->cond == NEUMANN) ? 1 : 0;
-            int A3 = (a3->cond == NEUMANN) ? 1 : 0;
-            int A4 = (a4->cond == NEUMANN) ? 1 : 0;
+            int A1 = (cond[index-w] == NEUMANN) ? 1 : 0;
+            int A2 = (cond[index+w] == NEUMANN) ? 1 : 0;
+            int A3 = (cond[index-1] == NEUMANN) ? 1 : 0;
+            int A4 = (cond[index+1] == NEUMANN) ? 1 : 0;
 
             /* check if the diagonal cells are neumann boundary */
-            int D1 = (d1->cond == NEUMANN) ? 1 : 0;
-            int D2 = (d2->cond == NEUMANN) ? 1 : 0;
-            int D3 = (d3->cond == NEUMANN) ? 1 : 0;
-            int D4 = (d4->cond == NEUMANN) ? 1 : 0;
+            int D1 = (cond[index-w+1] == NEUMANN) ? 1 : 0;
+            int D2 = (cond[index+w+1] == NEUMANN) ? 1 : 0;
+            int D3 = (cond[index+w-1] == NEUMANN) ? 1 : 0;
+            int D4 = (cond[index-w-1] == NEUMANN) ? 1 : 0;
 
-            /* generate a function the supported configurations */
-            #define f lattice->update[index]
+            /* find the configuration of the cell */
             if(!A1 && !A2 && !A3 && !A4) {
-                if     ( D1 && !D2 && !D3 && !D4) f = &func_INV_CORNER_1;
-                else if(!D1 &&  D2 && !D3 && !D4) f = &func_INV_CORNER_2;
-                else if(!D1 && !D2 &&  D3 && !D4) f = &func_INV_CORNER_3;
-                else if(!D1 && !D2 && !D3 &&  D4) f = &func_INV_CORNER_4;
-                else f = &func_MIDDLE_0;
+                if     ( D1 && !D2 && !D3 && !D4) config = INV_CORNER_1;
+                else if(!D1 &&  D2 && !D3 && !D4) config = INV_CORNER_2;
+                else if(!D1 && !D2 &&  D3 && !D4) config = INV_CORNER_3;
+                else if(!D1 && !D2 && !D3 &&  D4) config = INV_CORNER_4;
+                else config = MIDDLE_0;
             }
-            else if( A1 && !A2 && !A3 && !A4) f = &func_SIDE_1;
-            else if(!A1 &&  A2 && !A3 && !A4) f = &func_SIDE_2;
-            else if(!A1 && !A2 &&  A3 && !A4) f = &func_SIDE_3;
-            else if(!A1 && !A2 && !A3 &&  A4) f = &func_SIDE_4;
-            else if( A1 && !A2 && !A3 &&  A4) f = &func_CORNER_1;
-            else if(!A1 &&  A2 && !A3 &&  A4) f = &func_CORNER_2;
-            else if(!A1 &&  A2 &&  A3 && !A4) f = &func_CORNER_3;
-            else if( A1 && !A2 &&  A3 && !A4) f = &func_CORNER_4;
-            else f = &func_MIDDLE_0;
-            #undef f
+            else if( A1 && !A2 && !A3 && !A4) config = SIDE_1;
+            else if(!A1 &&  A2 && !A3 && !A4) config = SIDE_2;
+            else if(!A1 && !A2 &&  A3 && !A4) config = SIDE_3;
+            else if(!A1 && !A2 && !A3 &&  A4) config = SIDE_4;
+            else if( A1 && !A2 && !A3 &&  A4) config = CORNER_1;
+            else if(!A1 &&  A2 && !A3 &&  A4) config = CORNER_2;
+            else if(!A1 &&  A2 &&  A3 && !A4) config = CORNER_3;
+            else if( A1 && !A2 &&  A3 && !A4) config = CORNER_4;
+            else config = MIDDLE_0;
+
+            /* normalise the weighted factors */
+            const double* f = lattice_factors[config];
+            double c1 = f[0]*weight[index-w];
+            double c2 = f[1]*weight[index+w];
+            double c3 = f[2]*weight[index-1];
+            double c4 = f[3]*weight[index+1];
+            double sum = c1+c2+c3+c4;
+
+            /* the open border term is given for lattice_stencil, which scales the factors by half the weight */
+            if(config != MIDDLE_0 && lattice->open != 0)
+                sum += lattice_open_term(lattice, index, false)/(0.5*weight[index]);
+
+            lattice->coeff[STENCIL_C][index] = 0;
+            lattice->coeff[STENCIL_S][index] = c1/sum;
+            lattice->coeff[STENCIL_N][index] = c2/sum;
+            lattice->coeff[STENCIL_W][index] = c3/sum;
+            lattice->coeff[STENCIL_E][index] = c4/sum;
+        }
+    }
+}
+
+/**
+ * This function finds the cell of the source lattice before a
+ * position along one axis, given in cells of the source lattice. It
+ * returns false if the position is outside of the problem.
+ */
+static inline bool lattice_locate(double* pos, uint32_t n, uint32_t* first, double* t) {
+    /* the problem spans the cells 1 to n-2 */
+    if(*pos < 0.5 || *pos > n-1.5)
+        return false;
+    if(*pos < 1) *pos = 1;
+    if(*pos > n-2) *pos = n-2;
+
+    *first = (uint32_t) *pos;
+    if(*first > n-3) *first = n-3;
+    *t = *pos-*first;
+
+    return true;
+}
+
+/**
+ * This function converts a spatial position along one axis to cells
+ * of a lattice, counted from the outer ring. The positions of a graded
+ * lattice are searched, the cells in between are interpolated
+ * linearly.
+ */
+static double lattice_index(const double* axis, uint32_t n, double step, double pos) {
+    if(axis == NULL)
+        return pos/step+1;
+
+    /* find the last cell at or before the position, the outer ring is left out */
+    uint32_t lo = 1;
+    uint32_t hi = n-3;
+    while(lo < hi) {
+        uint32_t mid = (lo+hi+1)/2;
+        if(axis[mid] <= pos)
+            lo = mid;
+        else
+            hi = mid-1;
+    }
+
+    return lo+(pos-axis[lo])/(axis[lo+1]-axis[lo]);
+}
+
+void lattice_resample(struct lattice* from, struct lattice* to, struct rect* origin, struct rect* scale) {
+    /* extract the dimension of the lattices */
+    uint32_t w = to->dim.x;
+    uint32_t h = to->dim.y;
+    uint32_t fw = from->dim.x;
+    uint32_t fh = from->dim.y;
+    struct rect pos;
+
+    for(uint32_t j = 1; j < h-1; j++) {
+        /* find the rows of the source around the cell */
+        lattice_position(to, 0, j, &pos);
+        double y = lattice_index(from->ys, fh, from->step.y, origin->y+scale->y*pos.y);
+        uint32_t y0;
+        double ty;
+        if(!lattice_locate(&y, fh, &y0, &ty))
+            continue;
+
+        for(uint32_t i = 1; i < w-1; i++) {
+            /* compute the index of the cell */
+            uint32_t index = i+j*w;
+
+            /* fixed cells keep their value */
+            if(lattice_fixed(to, index))
+                continue;
+
+            /* find the columns of the source around the cell */
+            lattice_position(to, i, 0, &pos);
+            double x = lattice_index(from->xs, fw, from->step.x, origin->x+scale->x*pos.x);
+            uint32_t x0;
+            double tx;
+            if(!lattice_locate(&x, fw, &x0, &tx))
+                continue;
+
+            /* interpolate between the four cells */
+            double* v = &from->value[x0+y0*fw];
+            double below = (1-tx)*v[0]+tx*v[1];
+            double above = (1-tx)*v[fw]+tx*v[fw+1];
+            to->value[index] = (1-ty)*below+ty*above;
         }
     }
 }
 
+void lattice_prolongate(struct lattice* from, struct lattice* to) {
+    /* both lattices cover the same problem */
+    struct rect origin = {0, 0};
+    struct rect scale = {1, 1};
+
+    lattice_resample(from, to, &origin, &scale);
+}
+
+void lattice_rebuild(struct lattice* lattice, struct point* first, struct point* last, bound_t func, weight_t w_func, void *ptr) {
+    /* extract the dimension of the lattice */
+    uint32_t w = lattice->dim.x;
+    uint32_t h = lattice->dim.y;
+
+    /* limit the rectangle to the lattice */
+    uint32_t x0 = first->x;
+    uint32_t y0 = first->y;
+    uint32_t x1 = (last->x < w) ? last->x : w;
+    uint32_t y1 = (last->y < h) ? last->y : h;
+    if(x0 >= x1 || y0 >= y1)
+        return;
+
+    /* used for returning data from the boundary function */
+    struct bound bound = {NONE, 0};
+    struct rect pos;
+
+    for(uint32_t j = y0; j < y1; j++) {
+        for(uint32_t i = x0; i < x1; i++) {
+            /* compute the index of the cell */
+            uint32_t index = i+j*w;
+            lattice_position(lattice, i, j, &pos);
+
+            /* apply the weight function */
+            lattice->weight[index] = w_func(ptr, &pos);
+
+            /* the conditions of the outer ring never change */
+            if(i == 0 || j == 0 || i == w-1 || j == h-1)
+                continue;
+
+            /* apply the boundary function, the cell is free if it isn't handled */
+            lattice->cond[index] = UNSET;
+            if(func(ptr, &bound, &pos) != NULL) {
+                /* free cells keep their value as a starting point */
+                if(bound.cond != NONE)
+                    lattice->value[index] = bound.value;
+                lattice->cond[index] = bound.cond;
+            }
+        }
+    }
+
+    /* the stencils of the adjacent cells depend on the changed cells */
+    struct point from = {(x0 > 0) ? x0-1 : 0, (y0 > 0) ? y0-1 : 0};
+    struct point to = {(x1 < w) ? x1+1 : w, (y1 < h) ? y1+1 : h};
+    lattice_compile(lattice, &from, &to);
+}
+
 uint32_t lattice_compute(struct lattice* lattice, double threshold) {
     uint32_t iterations = 0;
 
@@ -351,26 +905,20 @@ double lattice_iterate(struct lattice* lattice) {
     /* the largest difference */
     double diff = 0;
 
-    for(int32_t j = 0; j < h; j++) {
-        for(int32_t i = 0; i < w; i++) {
+    /* the outer ring is never updated */
+    for(int32_t j = 1; j < h-1; j++) {
+        for(int32_t i = 1; i < w-1; i++) {
             /* compute the index of the cell */
             uint32_t index = i+j*w;
             double value, check;
 
-            /* extract the pointer to the specified cell */
-            struct cell* cell = &lattice->cells[index];
-
-            /* make sure the cell can be updated */
-            if(lattice->update[index] == NULL)
-                continue;
-
-            /* compute the new value */
-            value = (*lattice->update[index])(lattice, cell);
-            check = fabs(value-cell->value);
+            /* compute the new value, fixed cells keep theirs */
+            value = lattice_update(lattice, index);
+            check = fabs(value-lattice->value[index]);
             if(check > diff) diff = check;
 
             /* update the cell */
-            cell->value = value;
+            lattice->value[index] = value;
         }
     }
 
@@ -378,30 +926,5 @@ double lattice_iterate(struct lattice* lattice) {
 }
 
 uint32_t lattice_compute_threaded(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr) {
-    struct worker* worker;
-    struct worker* next;
-    uint32_t iterations = 0;
-
-    /* create the first worker and wait */
-    worker = worker_new(NULL, lattice, conf, cb, cb_ptr);
-    pthread_join(worker->thread, NULL);
-
-    /* traver the linked list */
-    next = worker->next;
-    worker->next = NULL;
-    while(next != NULL) {
-        /* count the total number of iterations */
-        iterations += next->iterations;
-
-        /* free the workers */
-        next = next->next;
-        if(next != NULL)
-           worker_delete(next->previous);
-    }
-
-    /* free the last worker */
-    worker_delete(worker);
-
-    return iterations;
+    return worker_compute(lattice, conf, cb, cb_ptr);
 }
-
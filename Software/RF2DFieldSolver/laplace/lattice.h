@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "tuple.h"
 #include "worker.h"
@@ -23,73 +24,107 @@ enum condition {
 };
 
 /**
- * This structure represent a cell in the matrix.
+ * This enumeration defines the order of the coefficients returned
+ * by lattice_stencil.
  */
-struct cell {
+enum stencil {
+    STENCIL_C,
+    STENCIL_W,
+    STENCIL_E,
+    STENCIL_S,
+    STENCIL_N,
+    STENCIL_SIZE,
+};
+
+/**
+ * These flags select the borders of the lattice that are open, see
+ * lattice_set_open.
+ */
+enum border {
+    BORDER_SOUTH = 1,
+    BORDER_NORTH = 2,
+    BORDER_WEST = 4,
+    BORDER_EAST = 8,
+};
+
+/**
+ * This is the alignment of the arrays contained in the lattice. It
+ * matches the size of a cache line so that each row of the sweeps
+ * starts on a fresh line.
+ */
+#define LATTICE_ALIGNMENT 64
+
+typedef double (*weight_t)(void *ptr, struct rect*);
+
+/**
+ * This structure represent the entire matrix used for
+ * solving the laplace equation with conditions.
+ *
+ * The cells are stored as a structure of arrays. Each array holds
+ * one property for all the cells, row after row, so that a cell at
+ * the index position (x,y) is found at offset x+y*dim.x. The adjacent
+ * cells are found from the row stride:
+ *
+ *      [     ] [i+w] [     ]
+ *      [ i-1 ] [ i ] [ i+1 ]
+ *      [     ] [i-w] [     ]
+ *
+ */
+struct lattice {
     /**
-     * This is the position of the cell in space.
+     * This contains the size of the matrix.
      */
-    struct rect pos;
+    struct point dim;
     /**
-     * This is the index position of the cell in the matrix.
+     * This is the spatial distance between two adjacent cells. For a
+     * graded lattice, it is the average distance.
      */
-    struct point index;
+    struct rect step;
     /**
-     * This is the current value contained in the cell.
+     * These are the positions of the columns and rows of a graded
+     * lattice, including the outer ring, or @{code NULL} for a
+     * uniform lattice.
      */
-    double value;
+    double* xs;
+    double* ys;
     /**
-     * This is the condition applied to this cell.
+     * This is the current value contained in each cell.
      */
-    enum condition cond;
+    double* value;
     /**
-     * This is the weight applied to this cell.
+     * This is the weight applied to each cell.
      */
-    double weight;
+    double* weight;
     /**
-     * These are the indexes of the four adjacent cells.
-     *
-     *      [ ] [1] [ ]
-     *      [3] [x] [4]
-     *      [ ] [2] [ ]
-     *
+     * This is the condition applied to each cell, stored as one
+     * byte per cell (see enum condition).
      */
-    uint32_t adj[4];
+    uint8_t* cond;
     /**
-     * These are the indexes of the four diagonal cells.
-     *
-     *      [4] [ ] [1]
-     *      [ ] [x] [ ]
-     *      [3] [ ] [2]
-     *
+     * These are the normalised coefficients of the stencil of each
+     * cell, one array per entry of enum stencil. The new value of a
+     * cell is the sum of the coefficients multiplied by the values
+     * of the cell and its adjacent cells. The coefficients of fixed
+     * cells keep their value unchanged.
      */
-    uint32_t diag[4];
-};
-
-typedef double (*weight_t)(void *ptr, struct rect*);
-
-/**
- * This structure represent the entire matrix used for
- * solving the laplace equation with conditions.
- */
-struct lattice {
-    /**
-     * This contains the size of the matrix.
-     */
-    struct point dim;
+    double* coeff[STENCIL_SIZE];
     /**
-     * This is the actual matrix of cell.
+     * These are the open borders of the lattice (see enum border),
+     * all other borders mirror the cells inside.
      */
-    struct cell* cells;
+    uint8_t open;
     /**
-     * This is the matrix containing all the update functions
-     * for each of the cell.
+     * This is the position the field of an open border decays from.
      */
-    double (**update)(struct lattice*, struct cell*);
+    struct rect center;
     /**
-     * Set this to true if all threads should abort their calculation as soon as possible
+     * This points to a flag that makes all threads abort their
+     * calculation as soon as possible once it is set. Several
+     * lattices may share the flag, so it stays valid while a lattice
+     * is replaced. It is @{code NULL} if the calculation can't be
+     * aborted.
      */
-    bool abort;
+    volatile bool* abort;
 };
 
 /**
@@ -122,8 +157,8 @@ typedef struct bound* (*bound_t)(void *ptr, struct bound*, struct rect*);
 /**
  * This function creates a lattice ready to be computed. It first
  * starts by allocating memory and appliying the boundary function.
- * After this step, it will generate a function that will update each
- * cell based on the adjacent cells.
+ * After this step, it will compile the stencil coefficients that
+ * update each cell based on the adjacent cells.
  *
  * Be warned that the final matrix contains 2 more columns and rows
  * in order to facilitate the computing. These added cells won't be
@@ -135,11 +170,103 @@ typedef struct bound* (*bound_t)(void *ptr, struct bound*, struct rect*);
  *        This point represents the resolution of the matrix.
  * @param func
  *        This is a pointer to the boundary function.
+ * @param pool
+ *        These are the threads sharing the work, @{code NULL} for a
+ *        single thread. The lattice is split in bands of rows, so
+ *        the boundary and weight functions are called concurrently
+ *        and must be thread safe. The result doesn't depend on the
+ *        number of threads.
+ *
+ * @return The pointer to the new lattice if everyhthing went as
+ *         expected, else @{code NULL} value.
+ */
+struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func, weight_t w_func, void *ptr, struct pool* pool);
+
+/**
+ * This function creates a lattice with columns and rows at arbitrary
+ * positions, which allows a fine mesh near the edges of conductors
+ * and a coarse one elsewhere. The stencil of each cell is computed
+ * from the distances to the adjacent cells, the outer ring mirrors
+ * the cells next to it like on a uniform lattice.
+ *
+ * The multigrid and conjugate gradient solvers work on a graded
+ * lattice through lattice_stencil.
+ *
+ * @param xs
+ *        These are the positions of the columns, in ascending order.
+ * @param nx
+ *        This is the number of columns, at least 2.
+ * @param ys
+ *        These are the positions of the rows, in ascending order.
+ * @param ny
+ *        This is the number of rows, at least 2.
+ * @param func
+ *        This is a pointer to the boundary function.
+ * @param pool
+ *        These are the threads sharing the work (see lattice_new).
  *
  * @return The pointer to the new lattice if everyhthing went as
  *         expected, else @{code NULL} value.
  */
-struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func, weight_t w_func, void *ptr);
+struct lattice* lattice_new_graded(const double* xs, uint32_t nx, const double* ys, uint32_t ny, bound_t func, weight_t w_func, void *ptr, struct pool* pool);
+
+/**
+ * This function creates a lattice with the conditions of another
+ * lattice, but with all weights set to one. It is the same problem
+ * without dielectric, ready to be computed. The boundary function is
+ * not called again, the conditions, values and abort flag are copied
+ * from the other lattice, so its current values are the starting
+ * point.
+ *
+ * @param from
+ *        This is a pointer to the lattice to copy.
+ *
+ * @return The pointer to the new lattice if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct lattice* lattice_new_uniform(struct lattice* from);
+
+/**
+ * This function creates a lattice with the conditions and weights of
+ * another lattice, where only one conductor is driven. The fixed
+ * cells of that conductor are set to 1 and all other cells to 0, so
+ * the solution gives one column of the capacitance matrix. The
+ * stencil and the abort flag are copied, neither the boundary nor the
+ * weight function is called again.
+ *
+ * @param from
+ *        This is a pointer to the lattice to copy.
+ * @param label
+ *        This array holds the conductor of each cell, a negative
+ *        value for cells not belonging to a conductor.
+ * @param conductor
+ *        This is the conductor set to 1.
+ *
+ * @return The pointer to the new lattice if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct lattice* lattice_new_excitation(struct lattice* from, const int32_t* label, int32_t conductor);
+
+/**
+ * This function rebuilds a rectangular part of a lattice after a
+ * change of the problem. The boundary and weight functions are applied
+ * again to the cells inside the rectangle. The stencil coefficients of
+ * these cells and of the cells around them are computed again. The
+ * other cells are not touched. The free cells keep their value, so
+ * the last solution is the starting point of the next computation.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param first
+ *        This is the first cell of the rectangle.
+ * @param last
+ *        This is the cell after the last cell of the rectangle, along
+ *        both axes. The conditions of the outer ring of the lattice
+ *        never change.
+ * @param func
+ *        This is a pointer to the boundary function.
+ */
+void lattice_rebuild(struct lattice* lattice, struct point* first, struct point* last, bound_t func, weight_t w_func, void *ptr);
 
 /**
  * This function frees the memory of a lattice.
@@ -149,6 +276,26 @@ struct lattice* lattice_new(struct rect* size, struct point* dim, bound_t func,
  */
 void lattice_delete(struct lattice* lattice);
 
+/**
+ * This function allocates memory aligned on LATTICE_ALIGNMENT bytes.
+ *
+ * @param size
+ *        This is the number of bytes to allocate.
+ *
+ * @return The pointer to the memory if everything went as expected,
+ *         else @{code NULL} value. It must be freed with
+ *         lattice_free_aligned.
+ */
+void* lattice_alloc_aligned(size_t size);
+
+/**
+ * This function frees memory allocated by lattice_alloc_aligned.
+ *
+ * @param ptr
+ *        This is a pointer to the memory to free.
+ */
+void lattice_free_aligned(void* ptr);
+
 /**
  * This function prints the value of each cell inside a lattice.
  *
@@ -157,6 +304,147 @@ void lattice_delete(struct lattice* lattice);
  */
 void lattice_print(struct lattice* lattice);
 
+/**
+ * This function returns true if the cell is never updated, either
+ * because its value is given or because it mirrors its neighbour.
+ */
+static inline bool lattice_fixed(struct lattice* lattice, uint32_t index) {
+    return lattice->cond[index] == NEUMANN || lattice->cond[index] == DIRICHLET;
+}
+
+/**
+ * This function computes the new value of a cell from the stencil
+ * coefficients. It must not be called for the outer ring of the
+ * lattice, for the other fixed cells it returns the current value.
+ */
+static inline double lattice_update(struct lattice* lattice, uint32_t index) {
+    uint32_t w = lattice->dim.x;
+    double* v = lattice->value;
+
+    return lattice->coeff[STENCIL_C][index]*v[index]
+         + lattice->coeff[STENCIL_W][index]*v[index-1]
+         + lattice->coeff[STENCIL_E][index]*v[index+1]
+         + lattice->coeff[STENCIL_S][index]*v[index-w]
+         + lattice->coeff[STENCIL_N][index]*v[index+w];
+}
+
+/**
+ * This function computes the symmetric form of the stencil of a
+ * cell. The update of a cell is scaled by its weight and halved for
+ * each axis with a neumann neighbour, so that the coefficient between
+ * two cells is the product of their weights. This gives a symmetric
+ * positive-definite system with the same solution as the update
+ * functions.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param index
+ *        This is the index of the cell, it must not be on the outer
+ *        ring of the lattice.
+ * @param a
+ *        This array receives the STENCIL_SIZE coefficients. The centre
+ *        coefficient is positive and the others are negative, the
+ *        coefficients towards neumann cells are zero.
+ */
+void lattice_stencil(struct lattice* lattice, uint32_t index, double* a);
+
+/**
+ * This function makes borders of a lattice open, as if the problem
+ * continued beyond them without any further conditions. Far from the
+ * charges the potential of a balanced structure decays like a dipole,
+ * so its derivative along the direction away from the centre is the
+ * potential divided by the distance. The cells at an open border use
+ * this as a Robin condition instead of mirroring the cells inside,
+ * which allows a much smaller lattice for the same accuracy.
+ *
+ * The stencils of the cells at the borders are computed again.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param borders
+ *        These are the open borders, a combination of enum border.
+ * @param center
+ *        This is the position the field decays from, usually the
+ *        middle of the traces.
+ */
+void lattice_set_open(struct lattice* lattice, uint8_t borders, struct rect* center);
+
+/**
+ * This function computes the term of an open border added to the
+ * centre coefficient of lattice_stencil. It is zero for cells not
+ * next to an open border.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param index
+ *        This is the index of the cell, it must not be on the outer
+ *        ring of the lattice.
+ * @param air
+ *        Set this to true to ignore the weights of the cells.
+ *
+ * @return The term added to the centre coefficient.
+ */
+double lattice_open_term(struct lattice* lattice, uint32_t index, bool air);
+
+/**
+ * This function computes the coefficients of the edges from a cell
+ * to its eastern and northern neighbours, in the scale of
+ * lattice_stencil. The edges along the outer ring are shared with
+ * their mirror image and the edges across it are zero, so summing
+ * over all cells counts every edge of the problem once.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param index
+ *        This is the index of the cell, it must not be on the outer
+ *        ring of the lattice.
+ * @param air
+ *        Set this to true to ignore the weights of the cells.
+ * @param east
+ *        This receives the coefficient towards the eastern cell.
+ * @param north
+ *        This receives the coefficient towards the northern cell.
+ */
+void lattice_edges(struct lattice* lattice, uint32_t index, bool air, double* east, double* north);
+
+/**
+ * This function interpolates the values of a solved lattice onto
+ * another lattice. Only the cells that are updated by the solvers are
+ * written, so the result is a starting point for the computation of
+ * that lattice.
+ *
+ * The spatial position of a cell of the receiving lattice is mapped
+ * to the source lattice as origin+scale*position. The values are
+ * interpolated bilinearly from the four surrounding cells of the
+ * source lattice, its outer ring is never used. Cells that are more
+ * than half a cell outside of the source lattice are left unchanged.
+ * Either lattice may be graded.
+ *
+ * @param from
+ *        This is a pointer to the lattice that contains the values.
+ * @param to
+ *        This is a pointer to the lattice that receives the values.
+ * @param origin
+ *        This is the position of the origin of the receiving lattice
+ *        in the source lattice.
+ * @param scale
+ *        This is the ratio between the spatial units of the receiving
+ *        and the source lattice.
+ */
+void lattice_resample(struct lattice* from, struct lattice* to, struct rect* origin, struct rect* scale);
+
+/**
+ * This function interpolates the values of a solved lattice onto
+ * another lattice of the same spatial size, typically a finer one
+ * (see lattice_resample).
+ *
+ * @param from
+ *        This is a pointer to the lattice that contains the values.
+ * @param to
+ *        This is a pointer to the lattice that receives the values.
+ */
+void lattice_prolongate(struct lattice* from, struct lattice* to);
+
 /**
  * This function computes the laplace equation sequentially for a
  * given lattice.
@@ -172,15 +460,16 @@ uint32_t lattice_compute(struct lattice* lattice, double threshold);
 
 /**
  * This function computes the laplace equation in parrallel for a
- * given lattice. The number of iteration might varies from one
- * execution to an other.
+ * given lattice, on the threads of the pool given in the
+ * configuration (see worker_compute).
  *
  * @param lattice
  *        This is a pointer to the lattice.
  * @param conf
  *        This is a pointer the configuration of the computation.
  *
- * @return The number of iterations.
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
  */
 uint32_t lattice_compute_threaded(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr);
 
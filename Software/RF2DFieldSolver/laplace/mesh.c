@@ -0,0 +1,1028 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "mesh.h"
+
+/**
+ * The circumradius of a triangle may be this many times its shortest
+ * edge, which keeps all angles above about 20 degrees.
+ */
+#define MESH_RATIO 1.4142135623730951
+
+/**
+ * Edges shorter than finest divided by this are not split any more.
+ */
+#define MESH_FLOOR 16
+
+/**
+ * This structure describes an edge on the border of a cavity.
+ */
+struct mesh_edge {
+    uint32_t from;
+    uint32_t to;
+    /* the triangle outside of the cavity, MESH_NONE at the border */
+    uint32_t outside;
+    uint8_t segment;
+};
+
+/**
+ * This structure holds the state of the triangulation while it is
+ * built.
+ */
+struct mesh_builder {
+    struct mesh* mesh;
+    struct rect size;
+    uint32_t point_capacity;
+    uint32_t triangle_capacity;
+
+    /* a triangle at each point, MESH_NONE until it is inserted */
+    uint32_t* around;
+    /* the edges of each triangle that are part of a segment */
+    uint8_t* segment;
+    /* marks the triangles of the current cavity */
+    uint32_t* stamp;
+    uint32_t time;
+
+    /* the cavity of the point being inserted */
+    uint32_t* cavity;
+    uint32_t cavity_count;
+    uint32_t cavity_capacity;
+    struct mesh_edge* border;
+    uint32_t border_count;
+    uint32_t border_capacity;
+    /* the edges on the border of the area that are left out */
+    uint32_t skipped;
+
+    /* the segments and triangles that have to be checked */
+    uint32_t* segments;
+    uint32_t segment_count;
+    uint32_t segment_capacity;
+    uint32_t* queue;
+    uint32_t queue_count;
+    uint32_t queue_capacity;
+
+    /* the vertices the size of the triangles grows from */
+    uint32_t first_vertex;
+    uint32_t last_vertex;
+    double finest;
+    double growth;
+    double coarsest;
+    uint32_t limit;
+};
+
+/**
+ * This function makes room for at least the given number of elements
+ * in an array.
+ */
+static int mesh_reserve(void** array, uint32_t* capacity, uint32_t needed, size_t size) {
+    if(needed <= *capacity)
+        return 0;
+
+    uint32_t grown = *capacity ? *capacity : 16;
+    while(grown < needed)
+        grown *= 2;
+    void* p = realloc(*array, (size_t) grown*size);
+    if(p == NULL)
+        return -1;
+    *array = p;
+    *capacity = grown;
+    return 0;
+}
+
+/**
+ * This function makes room for at least the given number of points.
+ */
+static int mesh_reserve_points(struct mesh_builder* b, uint32_t needed) {
+    uint32_t capacity = b->point_capacity;
+
+    if(mesh_reserve((void**) &b->mesh->point, &capacity, needed, sizeof(struct rect)) != 0)
+        return -1;
+    capacity = b->point_capacity;
+    if(mesh_reserve((void**) &b->around, &capacity, needed, sizeof(uint32_t)) != 0)
+        return -1;
+    b->point_capacity = capacity;
+    return 0;
+}
+
+/**
+ * This function makes room for at least the given number of triangles.
+ */
+static int mesh_reserve_triangles(struct mesh_builder* b, uint32_t needed) {
+    uint32_t capacity = b->triangle_capacity;
+    uint32_t corners = 3*capacity;
+    uint32_t neighbours = 3*capacity;
+    uint32_t segments = 3*capacity;
+
+    if(mesh_reserve((void**) &b->stamp, &capacity, needed, sizeof(uint32_t)) != 0)
+        return -1;
+    if(mesh_reserve((void**) &b->mesh->corner, &corners, 3*capacity, sizeof(uint32_t)) != 0
+    || mesh_reserve((void**) &b->mesh->neighbour, &neighbours, 3*capacity, sizeof(uint32_t)) != 0
+    || mesh_reserve((void**) &b->segment, &segments, 3*capacity, sizeof(uint8_t)) != 0)
+        return -1;
+    for(uint32_t t = b->triangle_capacity; t < capacity; t++)
+        b->stamp[t] = 0;
+    b->triangle_capacity = capacity;
+    return 0;
+}
+
+/**
+ * This function adds a segment to the ones to check.
+ */
+static int mesh_push_segment(struct mesh_builder* b, uint32_t from, uint32_t to) {
+    if(mesh_reserve((void**) &b->segments, &b->segment_capacity, 2*b->segment_count+2, sizeof(uint32_t)) != 0)
+        return -1;
+    b->segments[2*b->segment_count] = from;
+    b->segments[2*b->segment_count+1] = to;
+    b->segment_count++;
+    return 0;
+}
+
+/**
+ * This function adds a triangle to the ones to check.
+ */
+static int mesh_push_triangle(struct mesh_builder* b, uint32_t t) {
+    if(mesh_reserve((void**) &b->queue, &b->queue_capacity, b->queue_count+1, sizeof(uint32_t)) != 0)
+        return -1;
+    b->queue[b->queue_count++] = t;
+    return 0;
+}
+
+/**
+ * This function returns twice the signed area of the triangle abc,
+ * positive if the corners are in counter-clockwise order.
+ */
+static long double mesh_orient(const struct rect* a, const struct rect* b, const struct rect* c) {
+    return ((long double) b->x-a->x)*((long double) c->y-a->y)
+         - ((long double) b->y-a->y)*((long double) c->x-a->x);
+}
+
+/**
+ * This function returns a positive value if d lies inside the
+ * circumcircle of the counter-clockwise triangle abc.
+ */
+static long double mesh_incircle(const struct rect* a, const struct rect* b, const struct rect* c, const struct rect* d) {
+    long double adx = (long double) a->x-d->x, ady = (long double) a->y-d->y;
+    long double bdx = (long double) b->x-d->x, bdy = (long double) b->y-d->y;
+    long double cdx = (long double) c->x-d->x, cdy = (long double) c->y-d->y;
+
+    return (adx*adx+ady*ady)*(bdx*cdy-cdx*bdy)
+         + (bdx*bdx+bdy*bdy)*(cdx*ady-adx*cdy)
+         + (cdx*cdx+cdy*cdy)*(adx*bdy-bdx*ady);
+}
+
+/**
+ * This function returns on which side of the edge from u to v the
+ * position lies. The edge is always evaluated in the same direction,
+ * so both triangles of an edge agree on the side of a point.
+ */
+static long double mesh_side(const struct mesh* mesh, uint32_t u, uint32_t v, const struct rect* p) {
+    if(u < v)
+        return mesh_orient(&mesh->point[u], &mesh->point[v], p);
+    return -mesh_orient(&mesh->point[v], &mesh->point[u], p);
+}
+
+/**
+ * This function returns true if the position lies inside or on the
+ * circle with the edge from u to v as diameter.
+ */
+static bool mesh_encroached(const struct mesh* mesh, uint32_t u, uint32_t v, const struct rect* p) {
+    const struct rect* a = &mesh->point[u];
+    const struct rect* c = &mesh->point[v];
+
+    return (a->x-p->x)*(c->x-p->x)+(a->y-p->y)*(c->y-p->y) <= 0;
+}
+
+/**
+ * This function walks from a triangle towards the position and
+ * returns the triangle containing it, or MESH_NONE if it is outside
+ * of the area.
+ */
+static uint32_t mesh_walk(const struct mesh* mesh, const struct rect* p, uint32_t t) {
+    /* the walk ends in a Delaunay triangulation, the limit only guards against rounding */
+    uint32_t limit = mesh->triangles+16;
+
+    for(uint32_t steps = 0; steps < limit; steps++) {
+        const uint32_t* c = &mesh->corner[3*t];
+        uint32_t next = t;
+
+        for(uint32_t i = 0; i < 3; i++) {
+            uint32_t k = (i+steps)%3;
+            if(mesh_side(mesh, c[(k+1)%3], c[(k+2)%3], p) < 0) {
+                next = mesh->neighbour[3*t+k];
+                break;
+            }
+        }
+        if(next == t)
+            return t;
+        if(next == MESH_NONE)
+            return MESH_NONE;
+        t = next;
+    }
+
+    /* fall back to checking every triangle */
+    for(t = 0; t < mesh->triangles; t++) {
+        const uint32_t* c = &mesh->corner[3*t];
+        if(mesh_side(mesh, c[1], c[2], p) >= 0 && mesh_side(mesh, c[2], c[0], p) >= 0 && mesh_side(mesh, c[0], c[1], p) >= 0)
+            return t;
+    }
+    return MESH_NONE;
+}
+
+/**
+ * This function adds a triangle to the cavity.
+ */
+static int mesh_cavity_add(struct mesh_builder* b, uint32_t t) {
+    if(mesh_reserve((void**) &b->cavity, &b->cavity_capacity, b->cavity_count+1, sizeof(uint32_t)) != 0)
+        return -1;
+    b->cavity[b->cavity_count++] = t;
+    b->stamp[t] = b->time;
+    return 0;
+}
+
+/**
+ * This function finds the triangles whose circumcircle contains the
+ * point, starting from the triangle containing it, and the edges
+ * around them. Triangles are added until the point sees every edge
+ * from the inside, so the new triangles are never inverted. It returns
+ * 0 if the point can be inserted, else -1.
+ */
+static int mesh_cavity(struct mesh_builder* b, uint32_t q, uint32_t start) {
+    struct mesh* mesh = b->mesh;
+    const struct rect* p = &mesh->point[q];
+    bool grown;
+
+    b->time++;
+    b->cavity_count = 0;
+    if(mesh_cavity_add(b, start) != 0)
+        return -1;
+
+    for(uint32_t i = 0; i < b->cavity_count; i++) {
+        uint32_t t = b->cavity[i];
+        for(uint32_t k = 0; k < 3; k++) {
+            uint32_t n = mesh->neighbour[3*t+k];
+            if(n == MESH_NONE || b->stamp[n] == b->time)
+                continue;
+            const uint32_t* c = &mesh->corner[3*n];
+            if(mesh_incircle(&mesh->point[c[0]], &mesh->point[c[1]], &mesh->point[c[2]], p) > 0)
+                if(mesh_cavity_add(b, n) != 0)
+                    return -1;
+        }
+    }
+
+    do {
+        grown = false;
+        b->border_count = 0;
+        b->skipped = 0;
+        for(uint32_t i = 0; i < b->cavity_count && !grown; i++) {
+            uint32_t t = b->cavity[i];
+            for(uint32_t k = 0; k < 3; k++) {
+                uint32_t n = mesh->neighbour[3*t+k];
+                if(n != MESH_NONE && b->stamp[n] == b->time)
+                    continue;
+
+                uint32_t u = mesh->corner[3*t+(k+1)%3];
+                uint32_t v = mesh->corner[3*t+(k+2)%3];
+                long double side = mesh_side(mesh, u, v, p);
+                if(side <= 0) {
+                    if(n != MESH_NONE) {
+                        if(mesh_cavity_add(b, n) != 0)
+                            return -1;
+                        grown = true;
+                        break;
+                    }
+                    /* the point lies on the border of the area */
+                    if(side < 0)
+                        return -1;
+                    b->skipped++;
+                    continue;
+                }
+
+                if(mesh_reserve((void**) &b->border, &b->border_capacity, b->border_count+1, sizeof(struct mesh_edge)) != 0)
+                    return -1;
+                struct mesh_edge* e = &b->border[b->border_count++];
+                e->from = u;
+                e->to = v;
+                e->outside = n;
+                e->segment = b->segment[3*t+k];
+            }
+        }
+    } while(grown);
+
+    /* a cavity with a point inside would lose that point */
+    if(b->border_count+b->skipped != b->cavity_count+2)
+        return -1;
+    return 0;
+}
+
+/**
+ * This function replaces the cavity by a fan of triangles around the
+ * point. Segments inside of the cavity are lost, they are checked
+ * again, as well as the segments the point lies close to.
+ */
+static int mesh_fill(struct mesh_builder* b, uint32_t q) {
+    struct mesh* mesh = b->mesh;
+    const struct rect* p = &mesh->point[q];
+
+    /* the segments inside of the cavity are removed */
+    for(uint32_t i = 0; i < b->cavity_count; i++) {
+        uint32_t t = b->cavity[i];
+        for(uint32_t k = 0; k < 3; k++) {
+            uint32_t n = mesh->neighbour[3*t+k];
+            if(b->segment[3*t+k] && n != MESH_NONE && b->stamp[n] == b->time && t < n)
+                if(mesh_push_segment(b, mesh->corner[3*t+(k+1)%3], mesh->corner[3*t+(k+2)%3]) != 0)
+                    return -1;
+        }
+    }
+
+    uint32_t needed = mesh->triangles+b->border_count-b->cavity_count;
+    if(mesh_reserve_triangles(b, needed) != 0)
+        return -1;
+
+    /* the new triangles reuse the ones of the cavity */
+    uint32_t added = mesh->triangles;
+    for(uint32_t i = 0; i < b->border_count; i++) {
+        uint32_t t = i < b->cavity_count ? b->cavity[i] : added++;
+        struct mesh_edge* e = &b->border[i];
+
+        mesh->corner[3*t] = q;
+        mesh->corner[3*t+1] = e->from;
+        mesh->corner[3*t+2] = e->to;
+        mesh->neighbour[3*t] = e->outside;
+        b->segment[3*t] = e->segment;
+        b->segment[3*t+1] = 0;
+        b->segment[3*t+2] = 0;
+        b->stamp[t] = 0;
+        /* keep the index of the new triangle to link the fan */
+        e->outside = t;
+
+        if(mesh->neighbour[3*t] != MESH_NONE) {
+            uint32_t n = mesh->neighbour[3*t];
+            for(uint32_t k = 0; k < 3; k++)
+                if(mesh->corner[3*n+(k+1)%3] == e->to && mesh->corner[3*n+(k+2)%3] == e->from)
+                    mesh->neighbour[3*n+k] = t;
+        }
+        b->around[q] = t;
+        b->around[e->from] = t;
+        b->around[e->to] = t;
+    }
+    mesh->triangles = added;
+
+    for(uint32_t i = 0; i < b->border_count; i++) {
+        uint32_t t = b->border[i].outside;
+        mesh->neighbour[3*t+1] = MESH_NONE;
+        mesh->neighbour[3*t+2] = MESH_NONE;
+        for(uint32_t j = 0; j < b->border_count; j++) {
+            /* the triangle across the edge from the end point back to the point */
+            if(b->border[j].from == b->border[i].to)
+                mesh->neighbour[3*t+1] = b->border[j].outside;
+            /* the triangle across the edge from the point to the start point */
+            if(b->border[j].to == b->border[i].from)
+                mesh->neighbour[3*t+2] = b->border[j].outside;
+        }
+        if(b->segment[3*t] && mesh_encroached(mesh, b->border[i].from, b->border[i].to, p))
+            if(mesh_push_segment(b, b->border[i].from, b->border[i].to) != 0)
+                return -1;
+        if(mesh_push_triangle(b, t) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function inserts a point of the mesh into the triangulation.
+ * It returns 0 if the point was inserted, 1 if it was left out and -1
+ * on errors.
+ */
+static int mesh_insert(struct mesh_builder* b, uint32_t q, uint32_t hint) {
+    struct mesh* mesh = b->mesh;
+    const struct rect* p = &mesh->point[q];
+
+    uint32_t t = mesh_walk(mesh, p, hint);
+    if(t == MESH_NONE)
+        return 1;
+    for(uint32_t k = 0; k < 3; k++) {
+        const struct rect* c = &mesh->point[mesh->corner[3*t+k]];
+        if(c->x == p->x && c->y == p->y)
+            return 1;
+    }
+    if(mesh_cavity(b, q, t) != 0)
+        return 1;
+    return mesh_fill(b, q);
+}
+
+/**
+ * This function adds a point to the mesh, without inserting it into
+ * the triangulation. It returns the index of the point.
+ */
+static uint32_t mesh_add_point(struct mesh_builder* b, double x, double y) {
+    if(mesh_reserve_points(b, b->mesh->points+1) != 0)
+        return MESH_NONE;
+    b->mesh->point[b->mesh->points].x = x;
+    b->mesh->point[b->mesh->points].y = y;
+    b->around[b->mesh->points] = MESH_NONE;
+    return b->mesh->points++;
+}
+
+/**
+ * This function finds the edge between two points. It returns 0 and
+ * the triangle and the corner opposite to the edge if it exists, else
+ * -1.
+ */
+static int mesh_find_edge(struct mesh_builder* b, uint32_t u, uint32_t v, uint32_t* triangle, uint32_t* corner) {
+    struct mesh* mesh = b->mesh;
+    uint32_t first = b->around[u];
+
+    if(first == MESH_NONE)
+        return -1;
+
+    /* turn around the point one way, and the other way if the border stops it */
+    for(uint32_t turn = 1; turn <= 2; turn++) {
+        uint32_t t = first;
+        for(uint32_t steps = 0; steps < mesh->triangles && t != MESH_NONE; steps++) {
+            const uint32_t* c = &mesh->corner[3*t];
+            uint32_t i = (c[0] == u) ? 0 : (c[1] == u) ? 1 : 2;
+            if(c[(i+1)%3] == v) {
+                *triangle = t;
+                *corner = (i+2)%3;
+                return 0;
+            }
+            if(c[(i+2)%3] == v) {
+                *triangle = t;
+                *corner = (i+1)%3;
+                return 0;
+            }
+            t = mesh->neighbour[3*t+(i+turn)%3];
+            if(t == first)
+                return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function finds the neighbour of a point that lies on the line
+ * towards another point. It returns MESH_NONE if there is no edge
+ * along that line.
+ */
+static uint32_t mesh_next_along(struct mesh_builder* b, uint32_t u, uint32_t v) {
+    struct mesh* mesh = b->mesh;
+    double tolerance = 1e-9*fmax(b->size.x, b->size.y);
+    const struct rect* a = &mesh->point[u];
+    const struct rect* c = &mesh->point[v];
+    double dx = c->x-a->x, dy = c->y-a->y;
+    double length = hypot(dx, dy);
+    uint32_t first = b->around[u];
+
+    if(first == MESH_NONE || length == 0)
+        return MESH_NONE;
+
+    for(uint32_t turn = 1; turn <= 2; turn++) {
+        uint32_t t = first;
+        for(uint32_t steps = 0; steps < mesh->triangles && t != MESH_NONE; steps++) {
+            const uint32_t* corner = &mesh->corner[3*t];
+            uint32_t i = (corner[0] == u) ? 0 : (corner[1] == u) ? 1 : 2;
+            for(uint32_t k = 1; k <= 2; k++) {
+                uint32_t w = corner[(i+k)%3];
+                const struct rect* p = &mesh->point[w];
+                double along = ((p->x-a->x)*dx+(p->y-a->y)*dy)/length;
+                double dist = fabs((p->x-a->x)*dy-(p->y-a->y)*dx)/length;
+                if(along > 0 && along <= length+tolerance && dist <= tolerance)
+                    return w;
+            }
+            t = mesh->neighbour[3*t+(i+turn)%3];
+            if(t == first)
+                return MESH_NONE;
+        }
+    }
+    return MESH_NONE;
+}
+
+/**
+ * This function follows a segment from one end point to the other
+ * through the points it was split at. It returns true if all of its
+ * parts are edges of the triangulation.
+ */
+static bool mesh_recovered(struct mesh_builder* b, uint32_t u, uint32_t v) {
+    for(uint32_t steps = 0; steps < b->mesh->points && u != v; steps++) {
+        u = mesh_next_along(b, u, v);
+        if(u == MESH_NONE)
+            return false;
+    }
+    return u == v;
+}
+
+/**
+ * This function splits a segment in the middle, unless it is too
+ * short, and adds both halves to the segments to check.
+ */
+static int mesh_split_segment(struct mesh_builder* b, uint32_t u, uint32_t v) {
+    struct mesh* mesh = b->mesh;
+    const struct rect* a = &mesh->point[u];
+    const struct rect* c = &mesh->point[v];
+
+    if(hypot(c->x-a->x, c->y-a->y) < 2*b->finest/MESH_FLOOR || mesh->points >= b->limit)
+        return 0;
+
+    uint32_t m = mesh_add_point(b, (a->x+c->x)/2, (a->y+c->y)/2);
+    if(m == MESH_NONE)
+        return -1;
+    int ret = mesh_insert(b, m, b->around[u] != MESH_NONE ? b->around[u] : 0);
+    if(ret < 0)
+        return -1;
+    if(ret > 0) {
+        mesh->points--;
+        return 0;
+    }
+    if(mesh_push_segment(b, u, m) != 0 || mesh_push_segment(b, m, v) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * This function checks a segment. A segment that is missing in the
+ * triangulation or has a point inside of its diametral circle is
+ * split in the middle, otherwise its edge is marked.
+ */
+static int mesh_check_segment(struct mesh_builder* b, uint32_t u, uint32_t v) {
+    struct mesh* mesh = b->mesh;
+    uint32_t t, k;
+
+    if(mesh_find_edge(b, u, v, &t, &k) == 0) {
+        uint32_t n = mesh->neighbour[3*t+k];
+        bool encroached = mesh_encroached(mesh, u, v, &mesh->point[mesh->corner[3*t+k]]);
+
+        b->segment[3*t+k] = 1;
+        if(n != MESH_NONE) {
+            for(uint32_t j = 0; j < 3; j++) {
+                if(mesh->neighbour[3*n+j] == t) {
+                    b->segment[3*n+j] = 1;
+                    encroached |= mesh_encroached(mesh, u, v, &mesh->point[mesh->corner[3*n+j]]);
+                }
+            }
+        }
+        if(!encroached)
+            return 0;
+    }
+    return mesh_split_segment(b, u, v);
+}
+
+/**
+ * This function returns the largest allowed edge at a position.
+ */
+static double mesh_size(struct mesh_builder* b, const struct rect* p) {
+    double d = INFINITY;
+
+    for(uint32_t i = b->first_vertex; i < b->last_vertex; i++) {
+        const struct rect* v = &b->mesh->point[i];
+        double dist = hypot(v->x-p->x, v->y-p->y);
+        if(dist < d)
+            d = dist;
+    }
+    return fmin(b->coarsest, b->finest+b->growth*d);
+}
+
+/**
+ * This function checks a triangle and splits it at the center of its
+ * circumcircle if it is too flat or too large. If the center
+ * encroaches upon segments, they are split instead.
+ */
+static int mesh_check_triangle(struct mesh_builder* b, uint32_t t) {
+    struct mesh* mesh = b->mesh;
+    const uint32_t* c = &mesh->corner[3*t];
+
+    if(t >= mesh->triangles)
+        return 0;
+
+    const struct rect* p0 = &mesh->point[c[0]];
+    const struct rect* p1 = &mesh->point[c[1]];
+    const struct rect* p2 = &mesh->point[c[2]];
+    double l0 = (p1->x-p2->x)*(p1->x-p2->x)+(p1->y-p2->y)*(p1->y-p2->y);
+    double l1 = (p2->x-p0->x)*(p2->x-p0->x)+(p2->y-p0->y)*(p2->y-p0->y);
+    double l2 = (p0->x-p1->x)*(p0->x-p1->x)+(p0->y-p1->y)*(p0->y-p1->y);
+    double shortest = fmin(l0, fmin(l1, l2));
+    double longest = fmax(l0, fmax(l1, l2));
+
+    /* the circumcenter relative to the first corner */
+    double bx = p1->x-p0->x, by = p1->y-p0->y;
+    double cx = p2->x-p0->x, cy = p2->y-p0->y;
+    double d = 2*(bx*cy-by*cx);
+    if(d <= 0)
+        return 0;
+    double ux = (cy*(bx*bx+by*by)-by*(cx*cx+cy*cy))/d;
+    double uy = (bx*(cx*cx+cy*cy)-cx*(bx*bx+by*by))/d;
+    double radius = ux*ux+uy*uy;
+
+    struct rect center = {(p0->x+p1->x+p2->x)/3, (p0->y+p1->y+p2->y)/3};
+    double size = mesh_size(b, &center);
+    double floor = b->finest/MESH_FLOOR;
+    bool large = longest > size*size;
+    bool flat = radius > MESH_RATIO*MESH_RATIO*shortest && shortest > floor*floor;
+    if(!large && !flat)
+        return 0;
+
+    struct rect split = {p0->x+ux, p0->y+uy};
+    if(split.x < 0 || split.y < 0 || split.x > b->size.x || split.y > b->size.y)
+        return 0;
+    uint32_t start = mesh_walk(mesh, &split, t);
+    if(start == MESH_NONE)
+        return 0;
+
+    uint32_t q = mesh_add_point(b, split.x, split.y);
+    if(q == MESH_NONE)
+        return -1;
+    if(mesh_cavity(b, q, start) != 0) {
+        mesh->points--;
+        return 0;
+    }
+
+    /* the segments of the cavity the center lies close to are split instead */
+    uint32_t first = b->segment_count;
+    for(uint32_t i = 0; i < b->cavity_count; i++) {
+        uint32_t s = b->cavity[i];
+        for(uint32_t k = 0; k < 3; k++) {
+            uint32_t u = mesh->corner[3*s+(k+1)%3];
+            uint32_t v = mesh->corner[3*s+(k+2)%3];
+            if(!b->segment[3*s+k] || !mesh_encroached(mesh, u, v, &split))
+                continue;
+            const struct rect* a = &mesh->point[u];
+            const struct rect* e = &mesh->point[v];
+            if(hypot(e->x-a->x, e->y-a->y) < 2*floor)
+                continue;
+            if(mesh_push_segment(b, u, v) != 0)
+                return -1;
+        }
+    }
+    if(b->segment_count == first)
+        return mesh_fill(b, q);
+
+    mesh->points--;
+    uint32_t count = b->segment_count-first;
+    uint32_t* encroached = malloc(2*count*sizeof(uint32_t));
+    if(encroached == NULL)
+        return -1;
+    memcpy(encroached, &b->segments[2*first], 2*count*sizeof(uint32_t));
+    b->segment_count = first;
+
+    int ret = 0;
+    for(uint32_t i = 0; i < count && ret == 0; i++)
+        ret = mesh_split_segment(b, encroached[2*i], encroached[2*i+1]);
+    free(encroached);
+    if(ret != 0)
+        return -1;
+    /* the triangle is checked again once the segments are split */
+    return mesh_push_triangle(b, t);
+}
+
+/**
+ * This function clips a segment to the area. It returns false if
+ * nothing of it is left.
+ */
+static bool mesh_clip(const struct rect* size, struct rect* a, struct rect* c) {
+    double t0 = 0, t1 = 1;
+    double dx = c->x-a->x, dy = c->y-a->y;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {a->x, size->x-a->x, a->y, size->y-a->y};
+
+    for(uint32_t k = 0; k < 4; k++) {
+        if(p[k] == 0) {
+            if(q[k] < 0)
+                return false;
+            continue;
+        }
+        double r = q[k]/p[k];
+        if(p[k] < 0) {
+            if(r > t1) return false;
+            if(r > t0) t0 = r;
+        } else {
+            if(r < t0) return false;
+            if(r < t1) t1 = r;
+        }
+    }
+
+    struct rect from = {a->x+t0*dx, a->y+t0*dy};
+    struct rect to = {a->x+t1*dx, a->y+t1*dy};
+    *a = from;
+    *c = to;
+    return true;
+}
+
+/**
+ * This function returns the index of a point at the position, adding
+ * it if there is none within the tolerance yet.
+ */
+static uint32_t mesh_merge_point(struct mesh_builder* b, struct rect p, double tolerance) {
+    struct mesh* mesh = b->mesh;
+
+    /* points close to the border are moved onto it */
+    if(p.x < tolerance) p.x = 0;
+    if(p.y < tolerance) p.y = 0;
+    if(p.x > b->size.x-tolerance) p.x = b->size.x;
+    if(p.y > b->size.y-tolerance) p.y = b->size.y;
+
+    for(uint32_t i = 0; i < mesh->points; i++)
+        if(fabs(mesh->point[i].x-p.x) <= tolerance && fabs(mesh->point[i].y-p.y) <= tolerance)
+            return i;
+    return mesh_add_point(b, p.x, p.y);
+}
+
+/**
+ * This function compares two segments by their end points.
+ */
+static int mesh_compare_segments(const void* a, const void* b) {
+    const uint32_t* s = (const uint32_t*) a;
+    const uint32_t* t = (const uint32_t*) b;
+
+    if(s[0] != t[0])
+        return s[0] < t[0] ? -1 : 1;
+    if(s[1] != t[1])
+        return s[1] < t[1] ? -1 : 1;
+    return 0;
+}
+
+/**
+ * This function compares two points along a segment.
+ */
+static int mesh_compare_along(const void* a, const void* b) {
+    const double* s = (const double*) a;
+    const double* t = (const double*) b;
+
+    return (s[0] > t[0])-(s[0] < t[0]);
+}
+
+/**
+ * This function turns the segments into points and segments that
+ * only meet at their end points. The segments are clipped to the
+ * area, split where they cross each other and where another point
+ * lies on them, and the duplicates are removed. The resulting
+ * segments are added to the ones to check.
+ */
+static int mesh_arrange(struct mesh_builder* b, const struct rect* vertices, uint32_t count, const uint32_t* segments, uint32_t segment_count) {
+    struct mesh* mesh = b->mesh;
+    double tolerance = 1e-9*fmax(b->size.x, b->size.y);
+    uint32_t* lines = malloc((4+(size_t) segment_count)*2*sizeof(uint32_t));
+    uint32_t* pieces = NULL;
+    double* along = NULL;
+    uint32_t line_count = 0;
+    uint32_t piece_count = 0;
+    uint32_t piece_capacity = 0;
+    uint32_t along_capacity = 0;
+    int ret = -1;
+
+    if(lines == NULL)
+        goto ERROR;
+
+    /* the border of the area */
+    for(uint32_t k = 0; k < 4; k++) {
+        lines[2*k] = k;
+        lines[2*k+1] = (k+1)%4;
+    }
+    line_count = 4;
+
+    for(uint32_t s = 0; s < segment_count; s++) {
+        if(segments[2*s] >= count || segments[2*s+1] >= count)
+            continue;
+        struct rect a = vertices[segments[2*s]];
+        struct rect c = vertices[segments[2*s+1]];
+        if(!mesh_clip(&b->size, &a, &c))
+            continue;
+        uint32_t u = mesh_merge_point(b, a, tolerance);
+        uint32_t v = mesh_merge_point(b, c, tolerance);
+        if(u == MESH_NONE || v == MESH_NONE)
+            goto ERROR;
+        if(u == v)
+            continue;
+        lines[2*line_count] = u;
+        lines[2*line_count+1] = v;
+        line_count++;
+    }
+
+    /* the crossings of the segments */
+    for(uint32_t i = 0; i < line_count; i++) {
+        for(uint32_t j = i+1; j < line_count; j++) {
+            struct rect a = mesh->point[lines[2*i]];
+            struct rect c = mesh->point[lines[2*i+1]];
+            struct rect e = mesh->point[lines[2*j]];
+            struct rect f = mesh->point[lines[2*j+1]];
+            double rx = c.x-a.x, ry = c.y-a.y;
+            double sx = f.x-e.x, sy = f.y-e.y;
+            double den = rx*sy-ry*sx;
+            if(den == 0)
+                continue;
+            double t = ((e.x-a.x)*sy-(e.y-a.y)*sx)/den;
+            double u = ((e.x-a.x)*ry-(e.y-a.y)*rx)/den;
+            if(t <= 0 || t >= 1 || u <= 0 || u >= 1)
+                continue;
+            struct rect cross = {a.x+t*rx, a.y+t*ry};
+            if(mesh_merge_point(b, cross, tolerance) == MESH_NONE)
+                goto ERROR;
+        }
+    }
+
+    /* split the segments at the points on them */
+    for(uint32_t i = 0; i < line_count; i++) {
+        uint32_t u = lines[2*i];
+        uint32_t v = lines[2*i+1];
+        struct rect a = mesh->point[u];
+        struct rect c = mesh->point[v];
+        double dx = c.x-a.x, dy = c.y-a.y;
+        double length = hypot(dx, dy);
+        uint32_t found = 0;
+
+        for(uint32_t k = 0; k < mesh->points; k++) {
+            if(k == u || k == v)
+                continue;
+            const struct rect* p = &mesh->point[k];
+            double t = ((p->x-a.x)*dx+(p->y-a.y)*dy)/(length*length);
+            double dist = fabs((p->x-a.x)*dy-(p->y-a.y)*dx)/length;
+            if(t <= 0 || t >= 1 || dist > tolerance)
+                continue;
+            if(mesh_reserve((void**) &along, &along_capacity, 2*found+2, sizeof(double)) != 0)
+                goto ERROR;
+            along[2*found] = t;
+            along[2*found+1] = k;
+            found++;
+        }
+        if(found > 0)
+            qsort(along, found, 2*sizeof(double), mesh_compare_along);
+
+        uint32_t from = u;
+        for(uint32_t k = 0; k <= found; k++) {
+            uint32_t to = (k < found) ? (uint32_t) along[2*k+1] : v;
+            if(mesh_reserve((void**) &pieces, &piece_capacity, 2*piece_count+2, sizeof(uint32_t)) != 0)
+                goto ERROR;
+            pieces[2*piece_count] = from < to ? from : to;
+            pieces[2*piece_count+1] = from < to ? to : from;
+            piece_count++;
+            from = to;
+        }
+    }
+
+    /* overlapping segments give the same pieces */
+    qsort(pieces, piece_count, 2*sizeof(uint32_t), mesh_compare_segments);
+    for(uint32_t i = 0; i < piece_count; i++) {
+        if(i > 0 && mesh_compare_segments(&pieces[2*i], &pieces[2*i-2]) == 0)
+            continue;
+        if(mesh_push_segment(b, pieces[2*i], pieces[2*i+1]) != 0)
+            goto ERROR;
+    }
+    ret = 0;
+
+ERROR:
+    free(lines);
+    free(pieces);
+    free(along);
+    return ret;
+}
+
+/**
+ * This function builds the buckets for finding points.
+ */
+static int mesh_finish(struct mesh* mesh, struct rect* size) {
+    /* about two triangles for each bucket */
+    double side = sqrt(size->x*size->y/(mesh->triangles/2+1));
+    mesh->grid.x = (uint32_t) ceil(size->x/side);
+    mesh->grid.y = (uint32_t) ceil(size->y/side);
+    mesh->bucket.x = size->x/mesh->grid.x;
+    mesh->bucket.y = size->y/mesh->grid.y;
+    mesh->start = malloc((size_t) mesh->grid.x*mesh->grid.y*sizeof(uint32_t));
+    if(mesh->start == NULL)
+        return -1;
+
+    uint32_t t = 0;
+    for(uint32_t j = 0; j < mesh->grid.y; j++) {
+        for(uint32_t i = 0; i < mesh->grid.x; i++) {
+            struct rect center = {(i+0.5)*mesh->bucket.x, (j+0.5)*mesh->bucket.y};
+            uint32_t found = mesh_walk(mesh, &center, t);
+            if(found != MESH_NONE)
+                t = found;
+            mesh->start[i+j*mesh->grid.x] = t;
+        }
+    }
+    return 0;
+}
+
+struct mesh* mesh_new(struct rect* size, const struct rect* vertices, uint32_t count, const uint32_t* segments, uint32_t segment_count, double finest, double growth, double coarsest, uint32_t limit) {
+    struct mesh_builder b = {0};
+    struct mesh* mesh = calloc(1, sizeof(struct mesh));
+    uint32_t* pieces = NULL;
+    uint32_t piece_count = 0;
+
+    if(mesh == NULL || size->x <= 0 || size->y <= 0 || finest <= 0)
+        goto ERROR;
+
+    b.mesh = mesh;
+    b.size = *size;
+    b.finest = finest;
+    b.growth = growth;
+    b.coarsest = coarsest;
+    b.limit = limit;
+
+    /* the corners of the area form the first two triangles */
+    if(mesh_add_point(&b, 0, 0) == MESH_NONE || mesh_add_point(&b, size->x, 0) == MESH_NONE
+    || mesh_add_point(&b, size->x, size->y) == MESH_NONE || mesh_add_point(&b, 0, size->y) == MESH_NONE)
+        goto ERROR;
+    if(mesh_arrange(&b, vertices, count, segments, segment_count) != 0)
+        goto ERROR;
+    b.first_vertex = 4;
+    b.last_vertex = mesh->points;
+
+    /* the segments are checked once the refinement ends */
+    piece_count = b.segment_count;
+    pieces = malloc(2*((size_t) piece_count+1)*sizeof(uint32_t));
+    if(pieces == NULL)
+        goto ERROR;
+    memcpy(pieces, b.segments, 2*(size_t) piece_count*sizeof(uint32_t));
+
+    if(mesh_reserve_triangles(&b, 2) != 0)
+        goto ERROR;
+    static const uint32_t corner[6] = {0, 1, 2, 0, 2, 3};
+    static const uint32_t neighbour[6] = {MESH_NONE, 1, MESH_NONE, MESH_NONE, MESH_NONE, 0};
+    memcpy(mesh->corner, corner, sizeof(corner));
+    memcpy(mesh->neighbour, neighbour, sizeof(neighbour));
+    memset(b.segment, 0, 6);
+    mesh->triangles = 2;
+    for(uint32_t k = 0; k < 4; k++)
+        b.around[k] = k < 3 ? 0 : 1;
+
+    if(mesh_push_triangle(&b, 0) != 0 || mesh_push_triangle(&b, 1) != 0)
+        goto ERROR;
+
+    for(uint32_t q = 4; q < b.last_vertex; q++) {
+        if(mesh_insert(&b, q, b.around[q-1] != MESH_NONE ? b.around[q-1] : 0) < 0)
+            goto ERROR;
+    }
+
+    /* the segments first, then the triangles, until nothing is left to split */
+    while(mesh->points < b.limit) {
+        if(b.segment_count > 0) {
+            b.segment_count--;
+            if(mesh_check_segment(&b, b.segments[2*b.segment_count], b.segments[2*b.segment_count+1]) != 0)
+                goto ERROR;
+        } else if(b.queue_count > 0) {
+            b.queue_count--;
+            if(mesh_check_triangle(&b, b.queue[b.queue_count]) != 0)
+                goto ERROR;
+        } else {
+            break;
+        }
+    }
+
+    for(uint32_t i = 0; i < piece_count; i++) {
+        if(!mesh_recovered(&b, pieces[2*i], pieces[2*i+1]))
+            mesh->missing++;
+    }
+
+    if(mesh_finish(mesh, size) != 0)
+        goto ERROR;
+
+    free(pieces);
+    free(b.around);
+    free(b.segment);
+    free(b.stamp);
+    free(b.cavity);
+    free(b.border);
+    free(b.segments);
+    free(b.queue);
+    return mesh;
+
+ERROR:
+    free(pieces);
+    free(b.around);
+    free(b.segment);
+    free(b.stamp);
+    free(b.cavity);
+    free(b.border);
+    free(b.segments);
+    free(b.queue);
+    mesh_delete(mesh);
+    return NULL;
+}
+
+void mesh_delete(struct mesh* mesh) {
+    if(mesh == NULL)
+        return;
+
+    free(mesh->point);
+    free(mesh->corner);
+    free(mesh->neighbour);
+    free(mesh->start);
+    free(mesh);
+}
+
+uint32_t mesh_locate(struct mesh* mesh, const struct rect* pos, uint32_t hint) {
+    double w = mesh->bucket.x*mesh->grid.x;
+    double h = mesh->bucket.y*mesh->grid.y;
+
+    if(!(pos->x >= 0 && pos->y >= 0 && pos->x <= w && pos->y <= h))
+        return MESH_NONE;
+    if(hint == MESH_NONE || hint >= mesh->triangles) {
+        uint32_t i = (uint32_t) (pos->x/mesh->bucket.x);
+        uint32_t j = (uint32_t) (pos->y/mesh->bucket.y);
+        if(i >= mesh->grid.x) i = mesh->grid.x-1;
+        if(j >= mesh->grid.y) j = mesh->grid.y-1;
+        hint = mesh->start[i+j*mesh->grid.x];
+    }
+    return mesh_walk(mesh, pos, hint);
+}
@@ -0,0 +1,145 @@
+#ifndef INCLUDE_MESH_H
+#define INCLUDE_MESH_H
+
+#include <stdint.h>
+
+#include "tuple.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This marks a missing triangle or point.
+ */
+#define MESH_NONE UINT32_MAX
+
+/**
+ * This structure represents a triangulation of a rectangular area.
+ * The corners of each triangle are in counter-clockwise order.
+ */
+struct mesh {
+    /**
+     * This contains the number of points.
+     */
+    uint32_t points;
+    /**
+     * This contains the number of triangles.
+     */
+    uint32_t triangles;
+    /**
+     * This contains the position of each point.
+     */
+    struct rect* point;
+    /**
+     * This contains the three points of each triangle.
+     */
+    uint32_t* corner;
+    /**
+     * This contains the three triangles next to each triangle, the
+     * neighbour k shares the edge opposite to the corner k. It is
+     * MESH_NONE at the border of the area.
+     */
+    uint32_t* neighbour;
+    /**
+     * This contains the number of buckets along each axis.
+     */
+    struct point grid;
+    /**
+     * This contains the size of a bucket.
+     */
+    struct rect bucket;
+    /**
+     * This contains a triangle in the middle of each bucket, where
+     * the search for a point starts.
+     */
+    uint32_t* start;
+    /**
+     * This contains the number of segments that are not made of edges
+     * of the triangulation, because the refinement stopped at the
+     * limit of points or at the shortest edge. The triangles along
+     * them may reach across the segment.
+     */
+    uint32_t missing;
+};
+
+/**
+ * This function creates a conforming Delaunay triangulation of a
+ * rectangle from (0, 0) to size, with the given segments as edges.
+ *
+ * The segments are clipped to the area and split where they cross or
+ * touch each other. The points are inserted one by one (Bowyer-Watson)
+ * and the triangulation is refined in the manner of Ruppert: a segment
+ * with a point inside or on the circle over it is split in the
+ * middle, which makes every segment an edge of the triangulation. A
+ * triangle is split at the center of its circumcircle if it is too
+ * flat or too large, unless that center lies on the circle of a
+ * segment, which is split instead. A triangle is too flat if its
+ * circumradius exceeds sqrt(2) times its shortest edge. It is too
+ * large if its longest edge exceeds
+ *
+ *     min(coarsest, finest + growth * d),
+ *
+ * where d is the distance from its center to the nearest vertex of the
+ * segments, so the triangles are small at the corners where the field
+ * changes fastest and grow away from them. Edges shorter than a
+ * sixteenth of finest are not split any further, which ends the
+ * refinement at small input angles. The segments that are not edges
+ * when the refinement ends are counted in missing.
+ *
+ * @param size
+ *        This is the upper right corner of the area.
+ * @param vertices
+ *        This array contains the end points of the segments.
+ * @param count
+ *        This is the number of vertices.
+ * @param segments
+ *        This array contains the indices of the two end points of
+ *        each segment.
+ * @param segment_count
+ *        This is the number of segments.
+ * @param finest
+ *        This is the size of the triangles at the vertices.
+ * @param growth
+ *        This is the growth of the size with the distance.
+ * @param coarsest
+ *        This is the size of the largest triangles.
+ * @param limit
+ *        The refinement stops once the mesh has this many points.
+ *
+ * @return The pointer to the new mesh if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct mesh* mesh_new(struct rect* size, const struct rect* vertices, uint32_t count, const uint32_t* segments, uint32_t segment_count, double finest, double growth, double coarsest, uint32_t limit);
+
+/**
+ * This function frees the memory of a mesh.
+ *
+ * @param mesh
+ *        This is a pointer to the mesh to free.
+ */
+void mesh_delete(struct mesh* mesh);
+
+/**
+ * This function finds the triangle containing a point by walking
+ * towards it through the triangles.
+ *
+ * @param mesh
+ *        This is a pointer to the mesh.
+ * @param pos
+ *        This is the position of the point.
+ * @param hint
+ *        This is a triangle the walk starts from, best the one found
+ *        for a point nearby. With MESH_NONE the walk starts from the
+ *        bucket of the point.
+ *
+ * @return The index of the triangle if the point is inside the area,
+ *         else MESH_NONE.
+ */
+uint32_t mesh_locate(struct mesh* mesh, const struct rect* pos, uint32_t hint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,715 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "multigrid.h"
+#include "sor.h"
+#include "pool.h"
+
+/**
+ * This is the number of smoothing sweeps applied before and after
+ * the coarse grid correction.
+ */
+#define MG_SMOOTH 2
+
+/**
+ * The coarsening stops once a side of the grid is this short.
+ */
+#define MG_COARSEST 4
+
+/**
+ * This is the largest number of grids in the hierarchy.
+ */
+#define MG_MAX_LEVELS 24
+
+/**
+ * These are the positions of the entries of a 9 point stencil.
+ *
+ *      [NW] [N] [NE]
+ *      [W ] [C] [E ]
+ *      [SW] [S] [SE]
+ *
+ */
+enum mg_dir {
+    MG_C,
+    MG_W,
+    MG_E,
+    MG_S,
+    MG_N,
+    MG_SW,
+    MG_SE,
+    MG_NW,
+    MG_NE,
+    MG_DIRS,
+};
+
+static const int32_t mg_dx[MG_DIRS] = {0, -1, 1,  0, 0, -1,  1, -1, 1};
+static const int32_t mg_dy[MG_DIRS] = {0,  0, 0, -1, 1, -1, -1,  1, 1};
+
+/**
+ * This structure represents one grid of the hierarchy. All the grids
+ * keep a ring of fixed cells around them, just like the lattice.
+ *
+ * The operator of the coarse grids is symmetric, so only the centre
+ * and the four entries towards east and north are stored, the other
+ * ones are found in the adjacent cells.
+ */
+struct mg_level {
+    /**
+     * This contains the size of the grid, including the ring.
+     */
+    uint32_t w;
+    uint32_t h;
+    /**
+     * This is the lattice, only set for the finest grid.
+     */
+    struct lattice* lattice;
+    /**
+     * These are the solution, right hand side and residual.
+     */
+    double* u;
+    double* f;
+    double* r;
+    /**
+     * These are the entries of the operator.
+     */
+    double* c;
+    double* e;
+    double* n;
+    double* ne;
+    double* nw;
+    /**
+     * This scales the update of a lattice cell to the residual of the
+     * symmetric operator, only used for the finest grid.
+     */
+    double* scale;
+    /**
+     * This is set for the cells that are not part of the problem.
+     */
+    uint8_t* fixed;
+    /**
+     * These are the threads updating the lattice, only used for the
+     * finest grid.
+     */
+    struct pool* pool;
+};
+
+/**
+ * This structure contains the state of a parallel update of the
+ * finest grid.
+ */
+struct mg_task {
+    struct mg_level* level;
+    int reverse;
+    /* the tiles handed out to the threads */
+    struct sor_tiles tiles;
+    /* the largest difference of each thread */
+    double* diffs;
+};
+
+
+
+/**
+ * This structure contains the hierarchy of grids.
+ */
+struct multigrid {
+    uint32_t count;
+    struct mg_level levels[MG_MAX_LEVELS];
+};
+
+static int32_t mg_offset(struct mg_level* level, uint32_t dir) {
+    return mg_dx[dir]+mg_dy[dir]*(int32_t) level->w;
+}
+
+/**
+ * This function computes the stencil of a lattice cell, the order of
+ * the first entries matches the one of lattice_stencil.
+ */
+static void mg_lattice_row(struct lattice* lattice, uint32_t i, double* a) {
+    lattice_stencil(lattice, i, a);
+
+    for(uint32_t k = STENCIL_SIZE; k < MG_DIRS; k++)
+        a[k] = 0;
+}
+
+/**
+ * This function extracts the full 9 point stencil of a cell.
+ */
+static void mg_row(struct mg_level* level, uint32_t i, double* a) {
+    uint32_t w = level->w;
+
+    if(level->lattice != NULL) {
+        mg_lattice_row(level->lattice, i, a);
+        return;
+    }
+
+    a[MG_C]  = level->c[i];
+    a[MG_E]  = level->e[i];
+    a[MG_W]  = level->e[i-1];
+    a[MG_N]  = level->n[i];
+    a[MG_S]  = level->n[i-w];
+    a[MG_NE] = level->ne[i];
+    a[MG_SW] = level->ne[i-w-1];
+    a[MG_NW] = level->nw[i];
+    a[MG_SE] = level->nw[i-w+1];
+}
+
+/**
+ * This function returns the coarse cells a fine cell is interpolated
+ * from along one axis. The coarse cell X sits on top of the fine cell
+ * 2X-1, so odd cells are copied and even cells are averaged.
+ */
+static uint32_t mg_weights(uint32_t x, uint32_t* X, double* p) {
+    if(x & 1) {
+        X[0] = (x+1)/2;
+        p[0] = 1.0;
+        return 1;
+    }
+
+    X[0] = x/2;
+    p[0] = 0.5;
+    X[1] = x/2+1;
+    p[1] = 0.5;
+    return 2;
+}
+
+static void mg_level_free(struct mg_level* level) {
+    lattice_free_aligned(level->f);
+    lattice_free_aligned(level->r);
+    lattice_free_aligned(level->c);
+    lattice_free_aligned(level->e);
+    lattice_free_aligned(level->n);
+    lattice_free_aligned(level->ne);
+    lattice_free_aligned(level->nw);
+    lattice_free_aligned(level->scale);
+    lattice_free_aligned(level->fixed);
+
+    /* the finest grid uses the values of the lattice */
+    if(level->lattice == NULL)
+        lattice_free_aligned(level->u);
+}
+
+static int mg_level_alloc(struct mg_level* level, uint32_t w, uint32_t h, struct lattice* lattice) {
+    uint32_t m = w*h;
+
+    memset(level, 0, sizeof(struct mg_level));
+    level->w = w;
+    level->h = h;
+    level->lattice = lattice;
+
+    level->r = lattice_alloc_aligned(m*sizeof(double));
+    level->fixed = lattice_alloc_aligned(m*sizeof(uint8_t));
+    if(level->r == NULL || level->fixed == NULL)
+        return -1;
+
+    if(lattice != NULL) {
+        level->u = lattice->value;
+        level->scale = lattice_alloc_aligned(m*sizeof(double));
+        if(level->scale == NULL)
+            return -1;
+    } else {
+        level->u  = lattice_alloc_aligned(m*sizeof(double));
+        level->f  = lattice_alloc_aligned(m*sizeof(double));
+        level->c  = lattice_alloc_aligned(m*sizeof(double));
+        level->e  = lattice_alloc_aligned(m*sizeof(double));
+        level->n  = lattice_alloc_aligned(m*sizeof(double));
+        level->ne = lattice_alloc_aligned(m*sizeof(double));
+        level->nw = lattice_alloc_aligned(m*sizeof(double));
+        if(level->u == NULL || level->f == NULL || level->c == NULL || level->e == NULL
+        || level->n == NULL || level->ne == NULL || level->nw == NULL)
+            return -1;
+
+        memset(level->u, 0, m*sizeof(double));
+        memset(level->f, 0, m*sizeof(double));
+        memset(level->c, 0, m*sizeof(double));
+        memset(level->e, 0, m*sizeof(double));
+        memset(level->n, 0, m*sizeof(double));
+        memset(level->ne, 0, m*sizeof(double));
+        memset(level->nw, 0, m*sizeof(double));
+    }
+    memset(level->r, 0, m*sizeof(double));
+
+    return 0;
+}
+
+/**
+ * This function prepares the finest grid from the lattice.
+ */
+static void mg_setup_finest(struct mg_level* level) {
+    struct lattice* lattice = level->lattice;
+    double a[MG_DIRS];
+
+    for(uint32_t i = 0; i < level->w*level->h; i++) {
+        level->fixed[i] = lattice_fixed(lattice, i);
+        level->scale[i] = 0;
+
+        if(!level->fixed[i]) {
+            mg_lattice_row(lattice, i, a);
+            level->scale[i] = a[MG_C];
+        }
+    }
+}
+
+/**
+ * This function computes the operator of a coarse grid from the one
+ * of the next finer grid as the product of restriction, fine operator
+ * and prolongation. Fixed fine cells are neither interpolated nor
+ * restricted, so conductors remain part of every coarse operator.
+ */
+static void mg_setup_coarse(struct mg_level* fine, struct mg_level* coarse) {
+    uint32_t wc = coarse->w;
+    double a[MG_DIRS];
+
+    for(uint32_t y = 1; y+1 < fine->h; y++) {
+        for(uint32_t x = 1; x+1 < fine->w; x++) {
+            uint32_t i = x+y*fine->w;
+            uint32_t IX[2], IY[2];
+            double px[2], py[2];
+
+            if(fine->fixed[i])
+                continue;
+
+            mg_row(fine, i, a);
+            uint32_t nix = mg_weights(x, IX, px);
+            uint32_t niy = mg_weights(y, IY, py);
+
+            for(uint32_t k = 0; k < MG_DIRS; k++) {
+                uint32_t JX[2], JY[2];
+                double qx[2], qy[2];
+
+                /* connections to fixed cells are not part of the problem */
+                if(a[k] == 0 || fine->fixed[i+mg_offset(fine, k)])
+                    continue;
+
+                uint32_t njx = mg_weights(x+mg_dx[k], JX, qx);
+                uint32_t njy = mg_weights(y+mg_dy[k], JY, qy);
+
+                for(uint32_t iy = 0; iy < niy; iy++)
+                for(uint32_t ix = 0; ix < nix; ix++)
+                for(uint32_t jy = 0; jy < njy; jy++)
+                for(uint32_t jx = 0; jx < njx; jx++) {
+                    uint32_t I = IX[ix]+IY[iy]*wc;
+                    int32_t dx = (int32_t) JX[jx]-(int32_t) IX[ix];
+                    int32_t dy = (int32_t) JY[jy]-(int32_t) IY[iy];
+                    double v = px[ix]*py[iy]*a[k]*qx[jx]*qy[jy];
+
+                    /* the other half of the operator follows from symmetry */
+                    if(dx == 0 && dy == 0) coarse->c[I] += v;
+                    else if(dx ==  1 && dy == 0) coarse->e[I] += v;
+                    else if(dx ==  0 && dy == 1) coarse->n[I] += v;
+                    else if(dx ==  1 && dy == 1) coarse->ne[I] += v;
+                    else if(dx == -1 && dy == 1) coarse->nw[I] += v;
+                }
+            }
+        }
+    }
+
+    /* cells without any fine cell to interpolate are not part of the problem */
+    for(uint32_t y = 0; y < coarse->h; y++) {
+        for(uint32_t x = 0; x < coarse->w; x++) {
+            uint32_t I = x+y*wc;
+
+            coarse->fixed[I] = x == 0 || y == 0 || x+1 == coarse->w || y+1 == coarse->h || coarse->c[I] == 0;
+            if(coarse->fixed[I])
+                coarse->c[I] = 1.0;
+        }
+    }
+}
+
+/**
+ * This function applies one red-black Gauss-Seidel sweep to the
+ * lattice, the threads take tiles of one colour until none are left.
+ */
+static void mg_smooth_work(void* ptr, uint32_t id, uint32_t count) {
+    struct mg_task* task = (struct mg_task*) ptr;
+
+    (void) id;
+    (void) count;
+
+    for(uint32_t step = 0; step < 2; step++) {
+        uint32_t colour = task->reverse ? 1-step : step;
+
+        sor_sweep_tiles(&task->tiles, task->level->lattice, colour, 1.0);
+        pool_barrier(task->level->pool);
+    }
+}
+
+/**
+ * This function applies one Gauss-Seidel sweep. The cells are updated
+ * in four colours, none of which is coupled to itself, and the order
+ * of the colours is reversed for the sweeps after the correction so
+ * that the cycle remains symmetric.
+ */
+static void mg_smooth(struct mg_level* level, int reverse) {
+    double a[MG_DIRS];
+
+    if(level->lattice != NULL) {
+        struct mg_task task;
+        task.level = level;
+        task.reverse = reverse;
+        task.diffs = NULL;
+        sor_tiles_init(&task.tiles, level->lattice, pool_size(level->pool));
+        pool_run(level->pool, &mg_smooth_work, &task);
+        return;
+    }
+
+    for(uint32_t step = 0; step < 4; step++) {
+        uint32_t colour = reverse ? 3-step : step;
+
+        for(uint32_t y = 1+(colour>>1); y+1 < level->h; y += 2) {
+            for(uint32_t x = 1+(colour&1); x+1 < level->w; x += 2) {
+                uint32_t i = x+y*level->w;
+                double sum;
+
+                if(level->fixed[i])
+                    continue;
+
+                mg_row(level, i, a);
+                sum = level->f[i];
+                for(uint32_t k = 1; k < MG_DIRS; k++)
+                    sum -= a[k]*level->u[i+mg_offset(level, k)];
+                level->u[i] = sum/a[MG_C];
+            }
+        }
+    }
+}
+
+/**
+ * This function computes the residual of the cells in a range.
+ *
+ * @return The largest change a Gauss-Seidel sweep would apply, only
+ *         computed for the finest grid.
+ */
+static double mg_residual_range(struct mg_level* level, uint32_t first, uint32_t last) {
+    double a[MG_DIRS];
+    double diff = 0;
+
+    for(uint32_t i = first; i < last; i++) {
+        double sum;
+
+        if(level->fixed[i]) {
+            level->r[i] = 0;
+            continue;
+        }
+
+        if(level->lattice != NULL) {
+            struct lattice* lattice = level->lattice;
+            double update = lattice_update(lattice, i)-lattice->value[i];
+
+            if(fabs(update) > diff) diff = fabs(update);
+            level->r[i] = level->scale[i]*update;
+            continue;
+        }
+
+        mg_row(level, i, a);
+        sum = level->f[i];
+        for(uint32_t k = 0; k < MG_DIRS; k++)
+            sum -= a[k]*level->u[i+mg_offset(level, k)];
+        level->r[i] = sum;
+    }
+
+    return diff;
+}
+
+static void mg_residual_work(void* ptr, uint32_t id, uint32_t count) {
+    struct mg_task* task = (struct mg_task*) ptr;
+    struct mg_level* level = task->level;
+    uint32_t cells = level->w*level->h;
+    uint32_t first = (uint64_t) cells*id/count;
+    uint32_t last = (uint64_t) cells*(id+1)/count;
+
+    task->diffs[id] = mg_residual_range(level, first, last);
+}
+
+/**
+ * This function computes the residual of a grid.
+ *
+ * @return The largest change a Gauss-Seidel sweep would apply, only
+ *         computed for the finest grid.
+ */
+static double mg_residual(struct mg_level* level) {
+    struct mg_task task;
+    uint32_t count = pool_size(level->pool);
+    double diff = 0;
+
+    if(count == 1)
+        return mg_residual_range(level, 0, level->w*level->h);
+
+    /* fall back to a single thread if there is no memory */
+    task.level = level;
+    task.diffs = malloc(count*sizeof(double));
+    if(task.diffs == NULL)
+        return mg_residual_range(level, 0, level->w*level->h);
+
+    pool_run(level->pool, &mg_residual_work, &task);
+    for(uint32_t t = 0; t < count; t++)
+        if(task.diffs[t] > diff) diff = task.diffs[t];
+    free(task.diffs);
+
+    return diff;
+}
+
+/**
+ * This function restricts the residual of a grid to the right hand
+ * side of the next coarser grid.
+ */
+static void mg_restrict(struct mg_level* fine, struct mg_level* coarse) {
+    memset(coarse->f, 0, coarse->w*coarse->h*sizeof(double));
+
+    for(uint32_t y = 1; y+1 < fine->h; y++) {
+        for(uint32_t x = 1; x+1 < fine->w; x++) {
+            uint32_t i = x+y*fine->w;
+            uint32_t IX[2], IY[2];
+            double px[2], py[2];
+
+            if(fine->fixed[i])
+                continue;
+
+            uint32_t nix = mg_weights(x, IX, px);
+            uint32_t niy = mg_weights(y, IY, py);
+            for(uint32_t iy = 0; iy < niy; iy++)
+                for(uint32_t ix = 0; ix < nix; ix++)
+                    coarse->f[IX[ix]+IY[iy]*coarse->w] += px[ix]*py[iy]*fine->r[i];
+        }
+    }
+}
+
+/**
+ * This function interpolates the solution of a coarse grid and adds
+ * it to the next finer grid.
+ */
+static void mg_prolong(struct mg_level* fine, struct mg_level* coarse) {
+    for(uint32_t y = 1; y+1 < fine->h; y++) {
+        for(uint32_t x = 1; x+1 < fine->w; x++) {
+            uint32_t i = x+y*fine->w;
+            uint32_t IX[2], IY[2];
+            double px[2], py[2];
+
+            if(fine->fixed[i])
+                continue;
+
+            uint32_t nix = mg_weights(x, IX, px);
+            uint32_t niy = mg_weights(y, IY, py);
+            for(uint32_t iy = 0; iy < niy; iy++)
+                for(uint32_t ix = 0; ix < nix; ix++)
+                    fine->u[i] += px[ix]*py[iy]*coarse->u[IX[ix]+IY[iy]*coarse->w];
+        }
+    }
+}
+
+/**
+ * This function solves the coarsest grid with conjugate gradients.
+ */
+static void mg_solve_coarsest(struct mg_level* level) {
+    uint32_t m = level->w*level->h;
+    double a[MG_DIRS];
+    double *p, *q;
+    double rr, rr0, alpha, beta;
+
+    p = malloc(m*sizeof(double));
+    q = malloc(m*sizeof(double));
+    if(p == NULL || q == NULL) {
+        /* fall back to smoothing */
+        for(uint32_t s = 0; s < 100; s++)
+            mg_smooth(level, s & 1);
+        goto EXIT;
+    }
+
+    memset(level->u, 0, m*sizeof(double));
+    rr = 0;
+    for(uint32_t i = 0; i < m; i++) {
+        level->r[i] = level->fixed[i] ? 0 : level->f[i];
+        p[i] = level->r[i];
+        rr += level->r[i]*level->r[i];
+    }
+    rr0 = rr;
+
+    for(uint32_t it = 0; it < 2*m && rr > 1e-24*rr0 && rr > 0; it++) {
+        double pq = 0;
+
+        /* compute q = A*p */
+        for(uint32_t i = 0; i < m; i++) {
+            q[i] = 0;
+            if(level->fixed[i])
+                continue;
+
+            mg_row(level, i, a);
+            for(uint32_t k = 0; k < MG_DIRS; k++)
+                q[i] += a[k]*p[i+mg_offset(level, k)];
+            pq += p[i]*q[i];
+        }
+
+        alpha = rr/pq;
+        beta = rr;
+        rr = 0;
+        for(uint32_t i = 0; i < m; i++) {
+            level->u[i] += alpha*p[i];
+            level->r[i] -= alpha*q[i];
+            rr += level->r[i]*level->r[i];
+        }
+
+        beta = rr/beta;
+        for(uint32_t i = 0; i < m; i++)
+            p[i] = level->r[i]+beta*p[i];
+    }
+
+EXIT:
+    free(p);
+    free(q);
+}
+
+static void mg_cycle(struct mg_level* levels, uint32_t count, uint32_t l) {
+    struct mg_level* level = &levels[l];
+
+    /* the coarsest grid is solved directly */
+    if(l+1 == count && l > 0) {
+        mg_solve_coarsest(level);
+        return;
+    }
+
+    for(uint32_t s = 0; s < MG_SMOOTH; s++)
+        mg_smooth(level, 0);
+
+    if(l+1 < count) {
+        mg_residual(level);
+        mg_restrict(level, &levels[l+1]);
+        memset(levels[l+1].u, 0, levels[l+1].w*levels[l+1].h*sizeof(double));
+        mg_cycle(levels, count, l+1);
+        mg_prolong(level, &levels[l+1]);
+    }
+
+    for(uint32_t s = 0; s < MG_SMOOTH; s++)
+        mg_smooth(level, 1);
+}
+
+/**
+ * This function builds the coarse grids below the finest one.
+ */
+static int mg_build(struct multigrid* mg) {
+    /* halve the resolution until the grid is small enough */
+    while(mg->count < MG_MAX_LEVELS) {
+        struct mg_level* fine = &mg->levels[mg->count-1];
+        uint32_t nx = fine->w-2;
+        uint32_t ny = fine->h-2;
+
+        if(nx <= MG_COARSEST || ny <= MG_COARSEST)
+            break;
+
+        if(mg_level_alloc(&mg->levels[mg->count], nx/2+1+2, ny/2+1+2, NULL) != 0) {
+            mg->count++;
+            return -1;
+        }
+        mg_setup_coarse(fine, &mg->levels[mg->count]);
+        mg->count++;
+    }
+
+    return 0;
+}
+
+struct multigrid* multigrid_new(struct lattice* lattice) {
+    struct multigrid* mg;
+    struct mg_level* level;
+    double a[MG_DIRS];
+    uint32_t w = lattice->dim.x;
+
+    mg = calloc(1, sizeof(struct multigrid));
+    if(mg == NULL)
+        return NULL;
+
+    /* the finest grid stores the stencils of the lattice */
+    level = &mg->levels[0];
+    mg->count++;
+    if(mg_level_alloc(level, w, lattice->dim.y, NULL) != 0)
+        goto ERROR;
+
+    for(uint32_t i = 0; i < w*lattice->dim.y; i++)
+        level->fixed[i] = lattice_fixed(lattice, i);
+
+    for(uint32_t i = 0; i < w*lattice->dim.y; i++) {
+        if(level->fixed[i]) {
+            level->c[i] = 1.0;
+            continue;
+        }
+
+        /* connections to fixed cells are not part of the problem */
+        mg_lattice_row(lattice, i, a);
+        level->c[i] = a[MG_C];
+        level->e[i] = level->fixed[i+1] ? 0 : a[MG_E];
+        level->n[i] = level->fixed[i+w] ? 0 : a[MG_N];
+    }
+
+    if(mg_build(mg) != 0)
+        goto ERROR;
+
+    return mg;
+
+ERROR:
+    multigrid_delete(mg);
+    return NULL;
+}
+
+void multigrid_delete(struct multigrid* mg) {
+    if(mg == NULL)
+        return;
+
+    for(uint32_t l = 0; l < mg->count; l++)
+        mg_level_free(&mg->levels[l]);
+    free(mg);
+}
+
+void multigrid_precondition(struct multigrid* mg, const double* r, double* z) {
+    struct mg_level* level = &mg->levels[0];
+    uint32_t m = level->w*level->h;
+
+    for(uint32_t i = 0; i < m; i++) {
+        level->f[i] = level->fixed[i] ? 0 : r[i];
+        level->u[i] = 0;
+    }
+
+    mg_cycle(mg->levels, mg->count, 0);
+
+    for(uint32_t i = 0; i < m; i++)
+        z[i] = level->u[i];
+}
+
+uint32_t lattice_compute_multigrid(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr) {
+    struct multigrid* mg;
+    struct mg_level* levels;
+    uint32_t iterations = 0;
+    double diff;
+
+    mg = calloc(1, sizeof(struct multigrid));
+    if(mg == NULL)
+        return COMPUTE_FAILED;
+    levels = mg->levels;
+
+    /* the finest grid is the lattice itself */
+    mg->count++;
+    if(mg_level_alloc(&levels[0], lattice->dim.x, lattice->dim.y, lattice) != 0)
+        goto ERROR;
+    levels[0].pool = conf->pool;
+    mg_setup_finest(&levels[0]);
+
+    if(mg_build(mg) != 0)
+        goto ERROR;
+
+    do {
+        mg_cycle(levels, mg->count, 0);
+        iterations++;
+
+        /* check how much the solution still changes */
+        diff = mg_residual(&levels[0]);
+        if(cb) {
+            cb(cb_ptr, diff);
+        }
+    } while(diff > conf->threshold && !(lattice->abort && *lattice->abort));
+
+    multigrid_delete(mg);
+
+    return iterations;
+
+ERROR:
+    multigrid_delete(mg);
+
+    return COMPUTE_FAILED;
+}
@@ -0,0 +1,87 @@
+#ifndef INCLUDE_MULTIGRID_H
+#define INCLUDE_MULTIGRID_H
+
+#include <stdint.h>
+
+#include "lattice.h"
+#include "worker.h"
+#include "tuple.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This function computes the laplace equation for a given lattice
+ * with geometric multigrid V-cycles.
+ *
+ * A hierarchy of coarser grids is built from the lattice, each one
+ * with half the resolution of the previous one. The coarse operators
+ * are obtained from the weighted stencils of the lattice with bilinear
+ * prolongation and its transpose as restriction, which keeps the
+ * conductors and dielectric interfaces on every level. Each cycle
+ * smooths with the lattice stencils, solves for the smooth error on
+ * the coarser grids and corrects the solution, so the number of
+ * cycles hardly depends on the resolution.
+ *
+ * The computation stops once the largest change that a Gauss-Seidel
+ * sweep would apply falls below the threshold.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ *
+ * @return The number of V-cycles, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t lattice_compute_multigrid(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr);
+
+/**
+ * This structure contains a multigrid hierarchy used as a
+ * preconditioner. Its content is private to multigrid.c.
+ */
+struct multigrid;
+
+/**
+ * This function builds the multigrid hierarchy of the symmetric
+ * operator given by lattice_stencil, with the fixed cells removed.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice. It is only used during
+ *        the creation of the hierarchy.
+ *
+ * @return The pointer to the new hierarchy if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct multigrid* multigrid_new(struct lattice* lattice);
+
+/**
+ * This function frees the memory of a multigrid hierarchy.
+ *
+ * @param mg
+ *        This is a pointer to the hierarchy to free.
+ */
+void multigrid_delete(struct multigrid* mg);
+
+/**
+ * This function applies a single V-cycle, starting from zero, to
+ * approximately solve A*z = r. The cycle is symmetric so it can be
+ * used as preconditioner for conjugate gradients.
+ *
+ * @param mg
+ *        This is a pointer to the hierarchy.
+ * @param r
+ *        This is the right hand side, with one entry per cell of the
+ *        lattice. The entries of fixed cells are ignored.
+ * @param z
+ *        This receives the approximate solution, with zero for the
+ *        fixed cells.
+ */
+void multigrid_precondition(struct multigrid* mg, const double* r, double* z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
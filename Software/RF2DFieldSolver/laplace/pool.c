@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+struct pool {
+    uint32_t size;
+    pthread_t* threads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_barrier_t barrier;
+
+    /* the task of the current run */
+    pool_task_t task;
+    void* ptr;
+    /* this is incremented for each run */
+    uint32_t generation;
+    /* the number of helper threads still running the task */
+    uint32_t pending;
+    int quit;
+};
+
+/**
+ * This structure is passed to each helper thread.
+ */
+struct pool_thread {
+    struct pool* pool;
+    uint32_t id;
+};
+
+void* pool_work(void* ptr);
+
+struct pool* pool_new(uint32_t size) {
+    struct pool* pool;
+
+    if(size == 0)
+        size = 1;
+
+    pool = calloc(1, sizeof(struct pool));
+    if(pool == NULL) goto ERROR1;
+
+    pool->size = size;
+    pool->threads = calloc(size, sizeof(pthread_t));
+    if(pool->threads == NULL) goto ERROR2;
+
+    if(pthread_mutex_init(&pool->mutex, NULL) != 0) goto ERROR3;
+    if(pthread_cond_init(&pool->start, NULL) != 0) goto ERROR4;
+    if(pthread_cond_init(&pool->done, NULL) != 0) goto ERROR5;
+    if(pthread_barrier_init(&pool->barrier, NULL, size) != 0) goto ERROR6;
+
+    /* start the helper threads, the caller of pool_run is the thread 0 */
+    for(uint32_t t = 1; t < size; t++) {
+        struct pool_thread* thread = malloc(sizeof(struct pool_thread));
+
+        if(thread != NULL) {
+            thread->pool = pool;
+            thread->id = t;
+        }
+        if(thread == NULL || pthread_create(&pool->threads[t], NULL, &pool_work, thread) != 0) {
+            free(thread);
+
+            /* only keep the threads that could be started */
+            pool->size = t;
+            pthread_barrier_destroy(&pool->barrier);
+            pthread_barrier_init(&pool->barrier, NULL, t);
+            break;
+        }
+    }
+
+    return pool;
+
+ERROR6:
+    pthread_cond_destroy(&pool->done);
+ERROR5:
+    pthread_cond_destroy(&pool->start);
+ERROR4:
+    pthread_mutex_destroy(&pool->mutex);
+ERROR3:
+    free(pool->threads);
+ERROR2:
+    free(pool);
+ERROR1:
+    return NULL;
+}
+
+void pool_delete(struct pool* pool) {
+    if(pool == NULL)
+        return;
+
+    /* wake up the helper threads and wait for them */
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(uint32_t t = 1; t < pool->size; t++)
+        pthread_join(pool->threads[t], NULL);
+
+    pthread_barrier_destroy(&pool->barrier);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+uint32_t pool_size(struct pool* pool) {
+    return pool != NULL ? pool->size : 1;
+}
+
+void pool_run(struct pool* pool, pool_task_t task, void* ptr) {
+    if(pool == NULL || pool->size == 1) {
+        task(ptr, 0, 1);
+        return;
+    }
+
+    /* hand the task to the helper threads */
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->ptr = ptr;
+    pool->pending = pool->size-1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    task(ptr, 0, pool->size);
+
+    /* wait for the helper threads */
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_barrier(struct pool* pool) {
+    if(pool == NULL || pool->size == 1)
+        return;
+
+    pthread_barrier_wait(&pool->barrier);
+}
+
+void* pool_work(void* ptr) {
+    struct pool_thread* thread = (struct pool_thread*) ptr;
+    struct pool* pool = thread->pool;
+    uint32_t id = thread->id;
+    uint32_t generation = 0;
+
+    free(thread);
+
+    pthread_mutex_lock(&pool->mutex);
+    for(;;) {
+        pool_task_t task;
+        void* task_ptr;
+
+        /* sleep until there is a new task */
+        while(pool->generation == generation && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        if(pool->quit)
+            break;
+
+        generation = pool->generation;
+        task = pool->task;
+        task_ptr = pool->ptr;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task(task_ptr, id, pool->size);
+
+        pthread_mutex_lock(&pool->mutex);
+        if(--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
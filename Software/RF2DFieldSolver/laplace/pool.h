@@ -0,0 +1,97 @@
+#ifndef INCLUDE_POOL_H
+#define INCLUDE_POOL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure represents a persistent pool of threads. The threads
+ * are created once and sleep between the computations. Its content is
+ * private to pool.c.
+ */
+struct pool;
+
+/**
+ * This is the definition of a task run by the pool. It is called
+ * once on each thread of the pool.
+ *
+ * @param ptr
+ *        This is the pointer given to pool_run.
+ * @param id
+ *        This is the number of the thread, from 0 to count-1.
+ * @param count
+ *        This is the number of threads running the task.
+ */
+typedef void (*pool_task_t)(void* ptr, uint32_t id, uint32_t count);
+
+/**
+ * This function creates a pool of threads.
+ *
+ * @param size
+ *        This is the number of threads of the pool, including the
+ *        thread calling pool_run.
+ *
+ * @return The pointer to the new pool if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct pool* pool_new(uint32_t size);
+
+/**
+ * This function stops the threads and frees the memory of a pool.
+ *
+ * @param pool
+ *        This is a pointer to the pool to free.
+ */
+void pool_delete(struct pool* pool);
+
+/**
+ * This function returns the number of threads of a pool, a
+ * @{code NULL} pool has a single thread.
+ */
+uint32_t pool_size(struct pool* pool);
+
+/**
+ * This function runs a task on all the threads of a pool and waits
+ * until all of them returned. The calling thread takes part as the
+ * thread 0, the task is simply called if the pool is @{code NULL}.
+ *
+ * @param pool
+ *        This is a pointer to the pool.
+ * @param task
+ *        This is the task to run.
+ * @param ptr
+ *        This pointer is passed to the task.
+ */
+void pool_run(struct pool* pool, pool_task_t task, void* ptr);
+
+/**
+ * This function waits until all the threads of the pool reached it.
+ * It must only be called from inside a task, by all the threads.
+ *
+ * @param pool
+ *        This is a pointer to the pool.
+ */
+void pool_barrier(struct pool* pool);
+
+/**
+ * This function hands out work items to the threads of a task. Each
+ * call returns the next item of a shared counter, which must be reset
+ * while no thread uses it.
+ *
+ * @param counter
+ *        This is a pointer to the shared counter.
+ *
+ * @return The value of the counter before the call.
+ */
+static inline uint32_t pool_next(uint32_t* counter) {
+    return __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#include "raster.h"
+
+#include <algorithm>
+
+#include <QtGlobal>
+
+namespace {
+
+struct Edge {
+    double x1, y1;
+    double x2, y2;
+};
+
+}
+
+void Raster::setGrid(const QVector<double> &xs, const QVector<double> &ys)
+{
+    this->xs = xs;
+    this->ys = ys;
+    cells.fill(unset, xs.size() * ys.size());
+}
+
+void Raster::clear()
+{
+    xs.clear();
+    ys.clear();
+    cells.clear();
+}
+
+void Raster::fill(const QList<QPointF> &vertices, int value)
+{
+    if(vertices.isEmpty()) {
+        return;
+    }
+
+    // build the edge table, the polygon is implicitly closed
+    QVector<Edge> edges;
+    for(int i=0;i<vertices.size();i++) {
+        auto p1 = vertices[i];
+        auto p2 = vertices[(i+1) % vertices.size()];
+        if(qFuzzyCompare(p1.y(), p2.y())) {
+            // ignore horizontal lines according to scan conversion rule
+            continue;
+        }
+        if(p2.y() < p1.y()) {
+            std::swap(p1, p2);
+        }
+        edges.append({p1.x(), p1.y(), p2.x(), p2.y()});
+    }
+    std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+        return a.y1 < b.y1;
+    });
+
+    QVector<Edge> active;
+    QVector<double> crossings;
+    int next = 0;
+    for(int j=0;j<ys.size();j++) {
+        double y = ys[j];
+        // an edge covers the rows from its lower end up to, but excluding, its upper end
+        while(next < edges.size() && edges[next].y1 <= y) {
+            active.append(edges[next++]);
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [=](const Edge &e) {
+            return y >= e.y2;
+        }), active.end());
+        if(active.isEmpty()) {
+            if(next >= edges.size()) {
+                // no edges left above this row
+                break;
+            }
+            continue;
+        }
+
+        crossings.clear();
+        for(const auto &e : active) {
+            crossings.append(e.x1 + ((e.x2 - e.x1) / (e.y2 - e.y1)) * (y - e.y1));
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        // a cell is inside if an odd number of crossings lies at or left of it
+        int *row = &cells[j * xs.size()];
+        for(int k=0;k<crossings.size();k+=2) {
+            int from = std::lower_bound(xs.begin(), xs.end(), crossings[k]) - xs.begin();
+            int to = xs.size();
+            if(k+1 < crossings.size()) {
+                to = std::lower_bound(xs.begin(), xs.end(), crossings[k+1]) - xs.begin();
+            }
+            for(int i=from;i<to;i++) {
+                if(row[i] == unset) {
+                    row[i] = value;
+                }
+            }
+        }
+    }
+}
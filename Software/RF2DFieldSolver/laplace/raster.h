@@ -0,0 +1,35 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <QList>
+#include <QPointF>
+#include <QVector>
+
+// Assigns polygons to the cells of a rectilinear grid with a scanline fill.
+// A cell belongs to a polygon under the same rules as QPolygonF::containsPoint
+// with Qt::OddEvenFill, so the result matches testing every cell on its own.
+class Raster
+{
+public:
+    Raster() {}
+
+    static constexpr int unset = -1;
+
+    // the coordinates of the columns and rows, both must be ascending
+    void setGrid(const QVector<double> &xs, const QVector<double> &ys);
+    void clear();
+
+    // assigns the value to all cells inside the polygon that are still unset,
+    // so the polygon filled first takes priority where polygons overlap
+    void fill(const QList<QPointF> &vertices, int value);
+
+    int columns() const {return xs.size();}
+    int rows() const {return ys.size();}
+    int at(int x, int y) const {return cells[x + y * xs.size()];}
+
+private:
+    QVector<double> xs, ys;
+    QVector<int> cells;
+};
+
+#endif // RASTER_H
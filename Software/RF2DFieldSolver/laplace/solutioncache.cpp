@@ -0,0 +1,144 @@
+#include "solutioncache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+
+constexpr quint32 fileMagic = 0x52463253;
+constexpr quint32 fileVersion = 4;
+constexpr qint64 defaultMemoryLimit = 512LL * 1024 * 1024;
+
+}
+
+SolutionCache::SolutionCache()
+{
+    setMemoryLimit(defaultMemoryLimit);
+}
+
+void SolutionCache::setMemoryLimit(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    memory.setMaxCost(bytes / 1024);
+}
+
+void SolutionCache::setDirectory(const QString &directory)
+{
+    QMutexLocker locker(&mutex);
+    this->directory = directory;
+}
+
+QByteArray SolutionCache::key(const QByteArray &description)
+{
+    return QCryptographicHash::hash(description, QCryptographicHash::Sha256);
+}
+
+bool SolutionCache::get(const QByteArray &key, Solution &solution)
+{
+    QMutexLocker locker(&mutex);
+    auto s = memory.object(key);
+    if(s) {
+        solution = *s;
+        return true;
+    }
+    if(!load(key, solution)) {
+        return false;
+    }
+    // keep it in memory for the next lookup
+    memory.insert(key, new Solution(solution), cost(solution));
+    return true;
+}
+
+void SolutionCache::insert(const QByteArray &key, const Solution &solution)
+{
+    QMutexLocker locker(&mutex);
+    memory.insert(key, new Solution(solution), cost(solution));
+    store(key, solution);
+}
+
+void SolutionCache::setResults(const QByteArray &key, const QMap<QString, double> &results)
+{
+    QMutexLocker locker(&mutex);
+    auto s = memory.object(key);
+    if(!s) {
+        // already dropped from memory
+        Solution solution;
+        if(!load(key, solution)) {
+            return;
+        }
+        solution.results = results;
+        store(key, solution);
+        return;
+    }
+    s->results = results;
+    store(key, *s);
+}
+
+int SolutionCache::cost(const Solution &solution)
+{
+    return qMax<qint64>(1, (qint64) (solution.values.size() + solution.airValues.size() + solution.capacitances.size() + solution.airCapacitances.size()
+            + solution.meshX.size() + solution.meshY.size()) * sizeof(double) / 1024);
+}
+
+QString SolutionCache::filename(const QByteArray &key)
+{
+    return QDir(directory).filePath(QString::fromLatin1(key.toHex()) + ".solution");
+}
+
+bool SolutionCache::load(const QByteArray &key, Solution &solution)
+{
+    if(directory.isEmpty()) {
+        return false;
+    }
+    QFile file(filename(key));
+    if(!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if(magic != fileMagic || version != fileVersion) {
+        qWarning() << "Ignoring cached solution of unknown format:" << file.fileName();
+        return false;
+    }
+    Solution s;
+    stream >> s.dimX >> s.dimY >> s.values >> s.airValues >> s.capacitances >> s.airCapacitances >> s.meshX >> s.meshY >> s.results;
+    if(stream.status() != QDataStream::Ok || (qint64) s.values.size() != (qint64) s.dimX * s.dimY
+            || (!s.airValues.isEmpty() && s.airValues.size() != s.values.size())
+            || s.capacitances.size() != s.airCapacitances.size()
+            || (!s.meshX.isEmpty() && ((qint64) s.meshX.size() + 2 != s.dimX || (qint64) s.meshY.size() + 2 != s.dimY))) {
+        qWarning() << "Ignoring damaged cached solution:" << file.fileName();
+        return false;
+    }
+    solution = s;
+    return true;
+}
+
+void SolutionCache::store(const QByteArray &key, const Solution &solution)
+{
+    if(directory.isEmpty()) {
+        return;
+    }
+    if(!QDir().mkpath(directory)) {
+        qWarning() << "Unable to create the solution cache directory:" << directory;
+        return;
+    }
+    // write to a temporary file first, so an interrupted write never leaves a damaged file
+    QSaveFile file(filename(key));
+    if(!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to store solution:" << file.fileName();
+        return;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_15);
+    stream << fileMagic << fileVersion;
+    stream << solution.dimX << solution.dimY << solution.values << solution.airValues << solution.capacitances << solution.airCapacitances << solution.meshX << solution.meshY << solution.results;
+    if(!file.commit()) {
+        qWarning() << "Unable to store solution:" << file.fileName();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef SOLUTIONCACHE_H
+#define SOLUTIONCACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+// Keeps the solutions of past calculations, so a problem that has already been
+// solved can be shown again without solving it. The least recently used
+// solutions are dropped from memory once the limit is reached. If a directory
+// is set, the solutions are also stored as files and loaded from there when
+// they are no longer in memory.
+class SolutionCache
+{
+public:
+    SolutionCache();
+
+    class Solution {
+    public:
+        Solution() : dimX(0), dimY(0) {}
+        uint32_t dimX, dimY;
+        // the potential of all cells of the lattice, including the outer ring
+        QVector<double> values;
+        // the solution without dielectric, empty if it was not solved
+        QVector<double> airValues;
+        // the capacitance matrices of the traces, empty if they were not calculated
+        QVector<double> capacitances, airCapacitances;
+        // the positions of the columns and rows of a graded lattice, empty for a uniform one
+        QVector<double> meshX, meshY;
+        // the parameters extracted from the potential, empty until they are set
+        QMap<QString, double> results;
+    };
+
+    // the limit of the solutions kept in memory in bytes
+    void setMemoryLimit(qint64 bytes);
+    // the directory of the stored solutions, an empty string disables storing them
+    void setDirectory(const QString &directory);
+
+    // the key of a solution is a hash of everything the solution depends on
+    static QByteArray key(const QByteArray &description);
+
+    bool get(const QByteArray &key, Solution &solution);
+    void insert(const QByteArray &key, const Solution &solution);
+    void setResults(const QByteArray &key, const QMap<QString, double> &results);
+
+private:
+    // the cost of the entries in memory is counted in KiB
+    static int cost(const Solution &solution);
+    QString filename(const QByteArray &key);
+    bool load(const QByteArray &key, Solution &solution);
+    void store(const QByteArray &key, const Solution &solution);
+
+    QCache<QByteArray, Solution> memory;
+    QString directory;
+    QMutex mutex;
+};
+
+#endif // SOLUTIONCACHE_H
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "sor.h"
+#include "kernel.h"
+#include "pool.h"
+
+/**
+ * This is the number of iterations over which the convergence rate
+ * is measured before the over-relaxation factor is adjusted.
+ */
+#define SOR_WINDOW 16
+
+/**
+ * This is the largest over-relaxation factor that will be used.
+ */
+#define SOR_OMEGA_MAX 1.99
+
+/**
+ * This is the number of rows of a tile.
+ */
+#define SOR_TILE_Y 4
+
+/**
+ * This is the smallest number of columns of a tile.
+ */
+#define SOR_TILE_MIN_X 32
+
+/**
+ * This is the number of tiles each thread should find.
+ */
+#define SOR_TILES_PER_THREAD 4
+
+/**
+ * This structure contains the state shared by all the threads.
+ */
+struct sor_shared {
+    struct lattice* lattice;
+    struct config* conf;
+
+    /* the tiles handed out to the threads */
+    struct sor_tiles tiles;
+
+    /* the largest difference of each thread */
+    double* diffs;
+    /* the over-relaxation factor of the current iteration */
+    double omega;
+    uint32_t iterations;
+    int running;
+
+    /* used for estimating the convergence rate */
+    double window_start;
+    uint32_t window_count;
+    double last_rate;
+
+    progress_callback_t cb;
+    void *cb_ptr;
+};
+
+/**
+ * This function adjusts the over-relaxation factor from the
+ * observed decrease of the largest difference.
+ */
+void sor_adapt(struct sor_shared* shared, double diff);
+
+void sor_work(void* ptr, uint32_t id, uint32_t count);
+
+uint32_t lattice_compute_sor(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr) {
+    struct sor_shared shared;
+
+    shared.diffs = malloc(pool_size(conf->pool)*sizeof(double));
+    if(shared.diffs == NULL) goto ERROR;
+
+    /* initialise the shared state */
+    shared.lattice = lattice;
+    shared.conf = conf;
+    sor_tiles_init(&shared.tiles, lattice, pool_size(conf->pool));
+    shared.omega = 1.0;
+    shared.iterations = 0;
+    shared.running = 1;
+    shared.window_start = 0;
+    shared.window_count = 0;
+    shared.last_rate = 0;
+    shared.cb = cb;
+    shared.cb_ptr = cb_ptr;
+
+    pool_run(conf->pool, &sor_work, &shared);
+
+    free(shared.diffs);
+
+    return shared.iterations;
+
+ERROR:
+    return COMPUTE_FAILED;
+}
+
+void sor_work(void* ptr, uint32_t id, uint32_t count) {
+    struct sor_shared* shared = (struct sor_shared*) ptr;
+    struct lattice* lattice = shared->lattice;
+    struct pool* pool = shared->conf->pool;
+    double diff, check;
+
+    do {
+        /* update the first colour, then the second one */
+        diff = sor_sweep_tiles(&shared->tiles, lattice, 0, shared->omega);
+        pool_barrier(pool);
+        check = sor_sweep_tiles(&shared->tiles, lattice, 1, shared->omega);
+        if(check > diff) diff = check;
+
+        shared->diffs[id] = diff;
+        pool_barrier(pool);
+
+        /* the first thread collects the result of the iteration */
+        if(id == 0) {
+            diff = 0;
+            for(uint32_t t = 0; t < count; t++)
+                if(shared->diffs[t] > diff) diff = shared->diffs[t];
+
+            shared->iterations++;
+            if(shared->cb) {
+                shared->cb(shared->cb_ptr, diff);
+            }
+            sor_adapt(shared, diff);
+
+            /* no thread uses the tiles at the moment */
+            shared->tiles.next[0] = 0;
+            shared->tiles.next[1] = 0;
+            shared->running = diff > shared->conf->threshold && !(lattice->abort && *lattice->abort);
+        }
+        pool_barrier(pool);
+    } while(shared->running);
+}
+
+void sor_tiles_init(struct sor_tiles* tiles, struct lattice* lattice, uint32_t threads) {
+    uint32_t nx = lattice->dim.x-2;
+    uint32_t ny = lattice->dim.y-2;
+
+    /* start with bands of full rows */
+    tiles->size.x = nx;
+    tiles->size.y = SOR_TILE_Y;
+
+    for(;;) {
+        tiles->count.x = (nx+tiles->size.x-1)/tiles->size.x;
+        tiles->count.y = (ny+tiles->size.y-1)/tiles->size.y;
+        if((uint64_t) tiles->count.x*tiles->count.y >= (uint64_t) SOR_TILES_PER_THREAD*threads)
+            break;
+
+        /* cut the rows first, then use thinner bands */
+        if(tiles->size.x >= 2*SOR_TILE_MIN_X)
+            tiles->size.x = (tiles->size.x+1)/2;
+        else if(tiles->size.y > 1)
+            tiles->size.y = 1;
+        else
+            break;
+    }
+
+    tiles->next[0] = 0;
+    tiles->next[1] = 0;
+}
+
+double sor_sweep_tiles(struct sor_tiles* tiles, struct lattice* lattice, uint32_t colour, double omega) {
+    uint32_t count = tiles->count.x*tiles->count.y;
+    double diff = 0;
+
+    for(;;) {
+        uint32_t tile = pool_next(&tiles->next[colour]);
+
+        if(tile >= count)
+            break;
+
+        /* the outer ring is never updated */
+        uint32_t x0 = 1+(tile%tiles->count.x)*tiles->size.x;
+        uint32_t y0 = 1+(tile/tiles->count.x)*tiles->size.y;
+        uint32_t x1 = x0+tiles->size.x;
+        uint32_t y1 = y0+tiles->size.y;
+        if(x1 > lattice->dim.x-1) x1 = lattice->dim.x-1;
+        if(y1 > lattice->dim.y-1) y1 = lattice->dim.y-1;
+
+        for(uint32_t j = y0; j < y1; j++) {
+            double check = kernel_sweep_row(lattice, j, x0, x1, colour, omega);
+            if(check > diff) diff = check;
+        }
+    }
+
+    return diff;
+}
+
+void sor_adapt(struct sor_shared* shared, double diff) {
+    double rate, previous, mu2, omega;
+
+    /* measure the convergence rate over a few iterations */
+    if(shared->window_count == 0)
+        shared->window_start = diff;
+    if(++shared->window_count <= SOR_WINDOW)
+        return;
+    shared->window_count = 0;
+
+    if(shared->window_start <= 0 || diff <= 0)
+        return;
+    rate = pow(diff/shared->window_start, 1.0/SOR_WINDOW);
+    previous = shared->last_rate;
+    shared->last_rate = rate;
+
+    /* only trust the rate once it settled */
+    if(rate >= 1.0 || fabs(rate-previous) > 0.1*(1.0-rate))
+        return;
+
+    /*
+     * As long as omega is below the optimum, the rate is the largest
+     * eigenvalue of the SOR iteration. It gives the spectral radius of
+     * the Jacobi iteration, from which the optimal factor follows.
+     */
+    omega = shared->omega;
+    mu2 = (rate+omega-1)*(rate+omega-1)/(rate*omega*omega);
+    if(mu2 >= 1.0)
+        return;
+
+    omega = 2.0/(1.0+sqrt(1.0-mu2));
+    if(omega > SOR_OMEGA_MAX)
+        omega = SOR_OMEGA_MAX;
+
+    /* the factor is only ever raised, the rate has to settle again */
+    if(omega > shared->omega) {
+        shared->omega = omega;
+        shared->last_rate = 0;
+    }
+}
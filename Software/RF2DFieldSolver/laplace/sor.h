@@ -0,0 +1,94 @@
+#ifndef INCLUDE_SOR_H
+#define INCLUDE_SOR_H
+
+#include <stdint.h>
+
+#include "lattice.h"
+#include "worker.h"
+#include "tuple.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This function computes the laplace equation in parallel for a
+ * given lattice using red-black successive over-relaxation.
+ *
+ * The cells are split in two colours like a checkerboard. All the
+ * cells of one colour only depend on cells of the other colour, so
+ * the threads of the pool take tiles of one colour until none are
+ * left, and all threads meet before the next colour starts.
+ * The result doesn't depend on the number of threads.
+ *
+ * The over-relaxation factor starts at 1 (plain Gauss-Seidel) and is
+ * raised from the observed convergence rate until it reaches the
+ * estimated optimum.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ *
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t lattice_compute_sor(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr);
+
+/**
+ * This structure splits the lattice into tiles that are handed out to
+ * the threads of a sweep, so that the work is shared along both axes.
+ */
+struct sor_tiles {
+    /**
+     * This is the size of a tile.
+     */
+    struct point size;
+    /**
+     * This is the number of tiles along each axis.
+     */
+    struct point count;
+    /**
+     * This is the next tile of each colour, it must be reset while no
+     * thread sweeps that colour.
+     */
+    uint32_t next[2];
+};
+
+/**
+ * This function splits the lattice into bands of a few rows, which
+ * are cut into shorter tiles until there are several tiles for each
+ * thread.
+ *
+ * @param tiles
+ *        This receives the decomposition.
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param threads
+ *        This is the number of threads sharing the tiles.
+ */
+void sor_tiles_init(struct sor_tiles* tiles, struct lattice* lattice, uint32_t threads);
+
+/**
+ * This function applies over-relaxation to all the cells of one
+ * colour inside the tiles taken by the calling thread. All the
+ * threads call it until no tiles are left.
+ *
+ * @param tiles
+ *        This is the decomposition of the lattice.
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param colour
+ *        This selects the cells to update, 0 or 1.
+ * @param omega
+ *        This is the over-relaxation factor, 1 gives Gauss-Seidel.
+ *
+ * @return The largest difference applied to a cell.
+ */
+double sor_sweep_tiles(struct sor_tiles* tiles, struct lattice* lattice, uint32_t colour, double omega);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
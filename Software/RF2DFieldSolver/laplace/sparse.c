@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "sparse.h"
+
+struct sparse* sparse_new(uint32_t rows, uint32_t size) {
+    struct sparse* matrix;
+
+    matrix = calloc(1, sizeof(struct sparse));
+    if(matrix == NULL) goto ERROR;
+
+    matrix->rows = rows;
+    matrix->size = size;
+    matrix->row = calloc(rows+1, sizeof(uint32_t));
+    matrix->col = malloc(size*sizeof(uint32_t));
+    matrix->val = malloc(size*sizeof(double));
+    if(matrix->row == NULL || matrix->col == NULL || matrix->val == NULL)
+        goto ERROR;
+
+    return matrix;
+
+ERROR:
+    sparse_delete(matrix);
+    return NULL;
+}
+
+void sparse_delete(struct sparse* matrix) {
+    if(matrix == NULL)
+        return;
+
+    free(matrix->row);
+    free(matrix->col);
+    free(matrix->val);
+    free(matrix);
+}
+
+void sparse_multiply(struct sparse* matrix, const double* x, double* y, uint32_t first, uint32_t last) {
+    for(uint32_t i = first; i < last; i++) {
+        double sum = 0;
+
+        for(uint32_t k = matrix->row[i]; k < matrix->row[i+1]; k++)
+            sum += matrix->val[k]*x[matrix->col[k]];
+        y[i] = sum;
+    }
+}
+
+struct sparse* sparse_ichol(struct sparse* matrix) {
+    struct sparse* factor;
+    uint32_t size = 0;
+
+    /* the factor has the pattern of the lower triangle */
+    for(uint32_t i = 0; i < matrix->rows; i++)
+        for(uint32_t k = matrix->row[i]; k < matrix->row[i+1]; k++)
+            if(matrix->col[k] <= i) size++;
+
+    factor = sparse_new(matrix->rows, size);
+    if(factor == NULL)
+        return NULL;
+
+    size = 0;
+    for(uint32_t i = 0; i < matrix->rows; i++) {
+        double diag = 0;
+        factor->row[i] = size;
+
+        for(uint32_t k = matrix->row[i]; k < matrix->row[i+1]; k++) {
+            uint32_t j = matrix->col[k];
+            double sum;
+
+            if(j > i)
+                break;
+            if(j == i) {
+                diag = matrix->val[k];
+                continue;
+            }
+
+            /* subtract the product of the rows i and j left of column j */
+            sum = matrix->val[k];
+            for(uint32_t a = factor->row[i], b = factor->row[j]; a < size && b+1 < factor->row[j+1];) {
+                if(factor->col[a] < factor->col[b]) a++;
+                else if(factor->col[a] > factor->col[b]) b++;
+                else sum -= factor->val[a++]*factor->val[b++];
+            }
+
+            factor->col[size] = j;
+            factor->val[size] = sum/factor->val[factor->row[j+1]-1];
+            diag -= factor->val[size]*factor->val[size];
+            size++;
+        }
+
+        /* keep the original diagonal if the factorisation breaks down */
+        if(diag <= 0) {
+            for(uint32_t k = matrix->row[i]; k < matrix->row[i+1]; k++)
+                if(matrix->col[k] == i) diag = matrix->val[k];
+        }
+
+        factor->col[size] = i;
+        factor->val[size] = sqrt(diag);
+        size++;
+    }
+    factor->row[matrix->rows] = size;
+
+    return factor;
+}
+
+void sparse_ichol_solve(struct sparse* factor, const double* r, double* z) {
+    /* forward substitution with L */
+    for(uint32_t i = 0; i < factor->rows; i++) {
+        double sum = r[i];
+        uint32_t last = factor->row[i+1]-1;
+
+        for(uint32_t k = factor->row[i]; k < last; k++)
+            sum -= factor->val[k]*z[factor->col[k]];
+        z[i] = sum/factor->val[last];
+    }
+
+    /* backward substitution with L^T, column by column */
+    for(uint32_t i = factor->rows; i-- > 0;) {
+        uint32_t last = factor->row[i+1]-1;
+
+        z[i] /= factor->val[last];
+        for(uint32_t k = factor->row[i]; k < last; k++)
+            z[factor->col[k]] -= factor->val[k]*z[i];
+    }
+}
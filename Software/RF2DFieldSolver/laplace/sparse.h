@@ -0,0 +1,107 @@
+#ifndef INCLUDE_SPARSE_H
+#define INCLUDE_SPARSE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure represents a sparse matrix in compressed row
+ * storage. The entries of row i are found at the positions
+ * row[i] to row[i+1]-1 of col and val, sorted by column.
+ */
+struct sparse {
+    /**
+     * This contains the number of rows.
+     */
+    uint32_t rows;
+    /**
+     * This contains the number of entries.
+     */
+    uint32_t size;
+    /**
+     * This contains the start of each row, plus the end of the last.
+     */
+    uint32_t* row;
+    /**
+     * This contains the column of each entry.
+     */
+    uint32_t* col;
+    /**
+     * This contains the value of each entry.
+     */
+    double* val;
+};
+
+/**
+ * This function allocates a sparse matrix. The content of the rows
+ * has to be filled by the caller.
+ *
+ * @param rows
+ *        This is the number of rows.
+ * @param size
+ *        This is the largest number of entries.
+ *
+ * @return The pointer to the new matrix if everything went as
+ *         expected, else @{code NULL} value.
+ */
+struct sparse* sparse_new(uint32_t rows, uint32_t size);
+
+/**
+ * This function frees the memory of a sparse matrix.
+ *
+ * @param matrix
+ *        This is a pointer to the matrix to free.
+ */
+void sparse_delete(struct sparse* matrix);
+
+/**
+ * This function computes y = A*x for a range of rows.
+ *
+ * @param matrix
+ *        This is a pointer to the matrix.
+ * @param x
+ *        This is the vector to multiply.
+ * @param y
+ *        This receives the product.
+ * @param first
+ *        This is the first row to compute.
+ * @param last
+ *        This is the row after the last one to compute.
+ */
+void sparse_multiply(struct sparse* matrix, const double* x, double* y, uint32_t first, uint32_t last);
+
+/**
+ * This function computes the incomplete Cholesky factorisation with
+ * zero fill-in of a symmetric positive-definite matrix. Only the
+ * lower triangle of the matrix is used.
+ *
+ * @param matrix
+ *        This is a pointer to the matrix.
+ *
+ * @return The lower triangular factor L, with the diagonal as last
+ *         entry of each row, if everything went as expected, else
+ *         @{code NULL} value.
+ */
+struct sparse* sparse_ichol(struct sparse* matrix);
+
+/**
+ * This function solves L*L^T*z = r with a factor returned by
+ * sparse_ichol.
+ *
+ * @param factor
+ *        This is a pointer to the factor.
+ * @param r
+ *        This is the right hand side.
+ * @param z
+ *        This receives the solution, it must not be the same as r.
+ */
+void sparse_ichol_solve(struct sparse* factor, const double* r, double* z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
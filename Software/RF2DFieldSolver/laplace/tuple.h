@@ -13,10 +13,16 @@ struct point {
     uint32_t y;
 };
 
+struct pool;
+
 struct config {
-    uint8_t threads;
-    uint8_t distance;
+    uint32_t threads;
     double threshold;
+    /* the threads running the computation, NULL for a single thread */
+    struct pool* pool;
 };
 
+/* returned by the computations instead of the number of iterations if they failed */
+#define COMPUTE_FAILED UINT32_MAX
+
 #endif
@@ -1,243 +1,267 @@
 #include <stdlib.h>
-#include <stdio.h>
 #include <math.h>
-#include "worker.h"
-
-double iterate(struct worker* worker);
-
-struct worker*
-worker_new(struct worker* next, struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr) {
-    struct worker* worker;
-    int status;
 
-    /* make sure at least one of them is provided */
-    if(next == NULL && conf == NULL)
-        goto ERROR1;
+#include "worker.h"
+#include "pool.h"
+
+/**
+ * This is the size of a tile, about 200KB of values and coefficients
+ * which fits in the cache of most processors. Tiles are wide because
+ * the cells of a row are contiguous.
+ */
+#define WORKER_TILE_X 128
+#define WORKER_TILE_Y 32
+
+/**
+ * This is the smallest size of a tile.
+ */
+#define WORKER_TILE_MIN_X 16
+#define WORKER_TILE_MIN_Y 8
+
+/**
+ * This is the number of iterations that may overlap.
+ */
+#define WORKER_LOOKAHEAD 4
+
+/**
+ * This function updates the cells of a tile.
+ */
+double worker_sweep(struct lattice* lattice, struct tile* tile);
+
+/**
+ * This function checks if a tile can start its next iteration.
+ */
+int worker_ready(struct worker* worker, uint32_t x, uint32_t y);
+
+/**
+ * This function queues a tile if it is ready.
+ *
+ * @return 1 if the tile was queued, else 0.
+ */
+int worker_push(struct worker* worker, uint32_t x, uint32_t y);
+
+void worker_work(void* ptr, uint32_t id, uint32_t count);
+
+uint32_t worker_compute(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr) {
+    struct worker worker;
+    uint32_t nx = lattice->dim.x-2;
+    uint32_t ny = lattice->dim.y-2;
+    uint32_t threads = pool_size(conf->pool);
+    uint32_t sx = WORKER_TILE_X;
+    uint32_t sy = WORKER_TILE_Y;
+    uint32_t tiles;
+
+    /* make sure the diagonals of the wavefront hold a tile for each thread */
+    while((uint64_t) ((nx+sx-1)/sx)*((ny+sy-1)/sy) < (uint64_t) threads*threads) {
+        if(sx >= 2*WORKER_TILE_MIN_X && sx >= 4*sy)
+            sx /= 2;
+        else if(sy >= 2*WORKER_TILE_MIN_Y)
+            sy /= 2;
+        else if(sx >= 2*WORKER_TILE_MIN_X)
+            sx /= 2;
+        else
+            break;
+    }
 
-    /* allocate memory for the worker */
-    worker = malloc(sizeof(struct worker));
-    if(worker == NULL) goto ERROR1;
+    worker.lattice = lattice;
+    worker.conf = conf;
+    worker.count.x = (nx+sx-1)/sx;
+    worker.count.y = (ny+sy-1)/sy;
+    tiles = worker.count.x*worker.count.y;
 
-    /* initialise the spinlocks */
-    status = pthread_spin_init(&worker->lock, PTHREAD_PROCESS_SHARED);
-    if(status != 0) goto ERROR1;
+    worker.tiles = malloc(tiles*sizeof(struct tile));
+    if(worker.tiles == NULL) goto ERROR1;
 
-    status = pthread_spin_init(&worker->listLock, PTHREAD_PROCESS_SHARED);
-    if(status != 0) goto ERROR2;
+    worker.queue = malloc(tiles*sizeof(uint32_t));
+    if(worker.queue == NULL) goto ERROR2;
 
-    /* initialise the mutex */
-    status = pthread_mutex_init(&worker->mutex, NULL);
-    if(status != 0) goto ERROR3;
+    worker.diffs = calloc(WORKER_LOOKAHEAD, sizeof(double));
+    worker.finished = calloc(WORKER_LOOKAHEAD, sizeof(uint32_t));
+    if(worker.diffs == NULL || worker.finished == NULL) goto ERROR3;
 
-    /* initialise the wait condition */
-    status = pthread_cond_init(&worker->cond, NULL);
-    if(status != 0) goto ERROR4;
+    if(pthread_mutex_init(&worker.mutex, NULL) != 0) goto ERROR3;
+    if(pthread_cond_init(&worker.cond, NULL) != 0) goto ERROR4;
 
-    /* update the linked list */
-    if(next != NULL) {
-        worker->id = next->id+1;
+    /* the outer ring is never updated */
+    for(uint32_t y = 0; y < worker.count.y; y++) {
+        for(uint32_t x = 0; x < worker.count.x; x++) {
+            struct tile* tile = &worker.tiles[x+y*worker.count.x];
 
-        /* TODO we might need to lock here */
-        int needsPreviousLock = next->previous != next;
-        if(needsPreviousLock) {
-            pthread_spin_lock(&next->previous->listLock);
-        }
-        pthread_spin_lock(&next->listLock);
-        worker->previous = next->previous;
-        worker->next     = next;
-
-        /* copy the configuration from the next worker */
-        worker->conf.distance  = next->conf.distance;
-        worker->conf.threads   = next->conf.threads;
-        worker->conf.threshold = next->conf.threshold;
-
-        /* insert ourself into the linked list */
-        next->previous->next = worker;
-        next->previous       = worker;
-        if(needsPreviousLock) {
-            pthread_spin_unlock(&worker->previous->listLock);
+            tile->first.x = 1+x*sx;
+            tile->first.y = 1+y*sy;
+            tile->last.x = x+1 < worker.count.x ? 1+(x+1)*sx : 1+nx;
+            tile->last.y = y+1 < worker.count.y ? 1+(y+1)*sy : 1+ny;
+            tile->done = 0;
+            tile->busy = 0;
         }
-        pthread_spin_unlock(&next->listLock);
-    } else {
-        worker->id = 1;
-
-        /* this is the first worker */
-        worker->previous = worker;
-        worker->next = worker;
-
-        /*
-         * TODO make sure the maximum number of thread
-         *      is smaller than the resolution of the
-         *      lattice
-         */
-
-        /* copy the configuration */
-        worker->conf.distance  = conf->distance;
-        worker->conf.threads   = conf->threads;
-        worker->conf.threshold = conf->threshold;
     }
 
-    /* initialize fields */
-    worker->done = 0;
-    worker->lattice = lattice;
-    worker->iterations = 0;
-    worker->pos.x = 0;
-    worker->pos.y = 0;
-    worker->cb = cb;
-    worker->cb_ptr = cb_ptr;
+    worker.head = 0;
+    worker.size = 0;
+    worker.iterations = 0;
+    worker.running = 1;
+    worker.cb = cb;
+    worker.cb_ptr = cb_ptr;
+
+    /* the first tile starts the wavefront */
+    worker_push(&worker, 0, 0);
 
-    /* start the thread */
-    pthread_create(&worker->thread, NULL, &work, (void*) worker);
+    pool_run(conf->pool, &worker_work, &worker);
 
-    return worker;
+    pthread_cond_destroy(&worker.cond);
+    pthread_mutex_destroy(&worker.mutex);
+    free(worker.finished);
+    free(worker.diffs);
+    free(worker.queue);
+    free(worker.tiles);
+
+    return worker.iterations;
 
-//ERROR4:
-//    pthread_cond_destroy(&worker->cond);
 ERROR4:
-    pthread_mutex_destroy(&worker->mutex);
+    pthread_mutex_destroy(&worker.mutex);
 ERROR3:
-    pthread_spin_destroy(&worker->listLock);
+    free(worker.finished);
+    free(worker.diffs);
+    free(worker.queue);
 ERROR2:
-    pthread_spin_destroy(&worker->lock);
+    free(worker.tiles);
 ERROR1:
-    if(worker != NULL) free(worker);
-
-    return NULL;
+    return COMPUTE_FAILED;
 }
 
-void worker_delete(struct worker* worker) {
-    pthread_cond_destroy(&worker->cond);
-    pthread_mutex_destroy(&worker->mutex);
-    pthread_spin_destroy(&worker->lock);
-    free(worker);
-}
+int worker_ready(struct worker* worker, uint32_t x, uint32_t y) {
+    uint32_t w = worker->count.x;
+    struct tile* tile = &worker->tiles[x+y*w];
+    uint32_t next = tile->done+1;
 
-void* work(void* ptr) {
-    struct worker* worker = (struct worker*) ptr;
-    double diff;
+    if(tile->busy || !worker->running)
+        return 0;
 
-    printf("Thread %2d: starting\n", worker->id);
+    /* only a few iterations may be in progress */
+    if(next > worker->iterations+WORKER_LOOKAHEAD)
+        return 0;
 
-    do {
-        worker->iterations++;
-        diff = iterate(worker);
-        if(worker->cb) {
-            worker->cb(worker->cb_ptr, diff);
-        }
+    /* the tiles on the left and below must be done with this iteration */
+    if(x > 0 && worker->tiles[x-1+y*w].done < next)
+        return 0;
+    if(y > 0 && worker->tiles[x+(y-1)*w].done < next)
+        return 0;
 
-        /* safely reset the y position */
-        pthread_spin_lock(&worker->lock);
-        worker->pos.y = 0;
-        pthread_spin_unlock(&worker->lock);
-    } while(diff > worker->conf.threshold);
-
-    /* safely reset the y position */
-    pthread_spin_lock(&worker->lock);
-    worker->done = 1;
-    pthread_spin_unlock(&worker->lock);
-
-    /* wake up the previous worker if it was waiting for us */
-    if(pthread_mutex_trylock(&worker->previous->mutex) == 0) {
-        pthread_cond_signal(&worker->previous->cond);
-        pthread_mutex_unlock(&worker->previous->mutex);
-    }
+    /* the tiles on the right and above must be done with the previous one */
+    if(x+1 < w && worker->tiles[x+1+y*w].done < next-1)
+        return 0;
+    if(y+1 < worker->count.y && worker->tiles[x+(y+1)*w].done < next-1)
+        return 0;
 
-    printf("Thread %2d: finished with %d iterations\n",
-        worker->id, worker->iterations);
+    return 1;
+}
 
-    /* wait for all the threads */
-    if(worker->previous->id != 1) {
-        pthread_join(worker->previous->thread, NULL);
-    }
+int worker_push(struct worker* worker, uint32_t x, uint32_t y) {
+    uint32_t tiles = worker->count.x*worker->count.y;
+    uint32_t index = x+y*worker->count.x;
+
+    if(!worker_ready(worker, x, y))
+        return 0;
 
-    printf("Thread %2d: exiting\n", worker->id);
+    worker->tiles[index].busy = 1;
+    worker->queue[(worker->head+worker->size)%tiles] = index;
+    worker->size++;
 
-    return NULL;
+    return 1;
 }
 
-double iterate(struct worker* worker) {
+void worker_work(void* ptr, uint32_t id, uint32_t count) {
+    struct worker* worker = (struct worker*) ptr;
     struct lattice* lattice = worker->lattice;
-    uint32_t w = lattice->dim.x;
-    uint32_t h = lattice->dim.y;
-    uint32_t increment = 1;
-    double diff = 0;
+    uint32_t tiles = worker->count.x*worker->count.y;
 
-    do {
-        worker->pos.x = 0;
-        do {
-            uint32_t index = worker->pos.x+worker->pos.y*w;
-            struct cell* cell = &lattice->cells[index];
-            double value, check;
+    (void) id;
+    (void) count;
 
-            /* skip the cell if possible */
-            if(lattice->update[index] == NULL) {
-                worker->pos.x++;
-                continue;
-            }
+    pthread_mutex_lock(&worker->mutex);
+    for(;;) {
+        uint32_t index, x, y, slot;
+        uint32_t pushed = 0;
+        double diff;
 
-            /* compute the new value*/
-            value = (*lattice->update[index])(lattice, cell);
-            check = fabs(value-cell->value);
-            if(check > diff) diff = check;
+        /* wait for a tile */
+        while(worker->running && worker->size == 0)
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        if(!worker->running)
+            break;
 
-            /* update the cell */
-            cell->value = value;
-            worker->pos.x++;
-        } while(worker->pos.x < w);
-
-        /* make sure we can safely increment */
-        pthread_spin_lock(&worker->listLock);
-        pthread_spin_lock(&worker->next->lock);
-
-        /* compute the distance to the next worker */
-        uint32_t next;
-        if(worker->pos.y <= worker->next->pos.y)
-            next = worker->next->pos.y-worker->pos.y;
-        else
-            next = worker->next->pos.y-worker->pos.y+h;
-        pthread_spin_unlock(&worker->next->lock);
-        pthread_spin_unlock(&worker->listLock);
+        index = worker->queue[worker->head];
+        worker->head = (worker->head+1)%tiles;
+        worker->size--;
+        pthread_mutex_unlock(&worker->mutex);
 
-        /* increment is possible */
-        if(next >= 2 || worker->next->done)
-            increment = 1;
-        else
-            increment = 0;
+        diff = worker_sweep(lattice, &worker->tiles[index]);
 
-        /* if it's too early to change, then we have to wait */
-        if(!increment && worker->next != worker) {
-            pthread_mutex_lock(&worker->mutex);
-            pthread_cond_wait(&worker->cond, &worker->mutex);
-            pthread_mutex_unlock(&worker->mutex);
-        }
+        pthread_mutex_lock(&worker->mutex);
+        x = index%worker->count.x;
+        y = index/worker->count.x;
+        worker->tiles[index].busy = 0;
+        worker->tiles[index].done++;
 
-        /* safely increment the y position */
-        pthread_spin_lock(&worker->lock);
-        worker->pos.y++;
-        pthread_spin_unlock(&worker->lock);
-//        printf("Thread %2d: y: %u\n", worker->id, worker->pos.y);
+        /* collect the result of the iteration */
+        slot = worker->tiles[index].done%WORKER_LOOKAHEAD;
+        if(diff > worker->diffs[slot]) worker->diffs[slot] = diff;
 
-        /* wake up the previous worker if it was waiting for us */
-        if(pthread_mutex_trylock(&worker->previous->mutex) == 0) {
-            pthread_cond_signal(&worker->previous->cond);
-            pthread_mutex_unlock(&worker->previous->mutex);
-        }
+        if(++worker->finished[slot] == tiles) {
+            /* all the tiles finished this iteration */
+            diff = worker->diffs[slot];
+            worker->diffs[slot] = 0;
+            worker->finished[slot] = 0;
+            worker->iterations++;
 
-        /* create a new worker if possible */
-        if(worker->pos.y == worker->conf.distance
-        && worker->id < worker->conf.threads
-        && worker->previous->id-1 != worker->id)
-           worker_new(worker, worker->lattice, NULL, worker->cb, worker->cb_ptr);
+            if(worker->cb) {
+                worker->cb(worker->cb_ptr, diff);
+            }
+            worker->running = diff > worker->conf->threshold && !(lattice->abort && *lattice->abort);
+
+            /* this allows another iteration to start */
+            for(uint32_t j = 0; j < worker->count.y; j++)
+                for(uint32_t i = 0; i < worker->count.x; i++)
+                    pushed += worker_push(worker, i, j);
+        } else {
+            /* the tile itself and its neighbours might be ready now */
+            pushed += worker_push(worker, x, y);
+            if(x+1 < worker->count.x) pushed += worker_push(worker, x+1, y);
+            if(y+1 < worker->count.y) pushed += worker_push(worker, x, y+1);
+            if(x > 0) pushed += worker_push(worker, x-1, y);
+            if(y > 0) pushed += worker_push(worker, x, y-1);
+        }
 
-        if(lattice->abort) {
-            // abort requested. Just return 0 (indicating no diff, this will also prevent a further iteration)
-            return 0.0;
+        /* wake up a thread for each new tile, or all of them at the end */
+        if(!worker->running) {
+            pthread_cond_broadcast(&worker->cond);
+        } else {
+            /* this thread takes one of the tiles itself */
+            for(uint32_t n = 1; n < pushed; n++)
+                pthread_cond_signal(&worker->cond);
         }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+}
 
-        /* check if this iteration is finished */
-        if(worker->pos.y == h)
-            break;
-    } while(1);
+double worker_sweep(struct lattice* lattice, struct tile* tile) {
+    uint32_t w = lattice->dim.x;
+    double diff = 0;
+
+    for(uint32_t j = tile->first.y; j < tile->last.y; j++) {
+        for(uint32_t i = tile->first.x; i < tile->last.x; i++) {
+            uint32_t index = i+j*w;
+            double value, check;
+
+            /* compute the new value, fixed cells keep theirs */
+            value = lattice_update(lattice, index);
+            check = fabs(value-lattice->value[index]);
+            if(check > diff) diff = check;
+
+            /* update the cell */
+            lattice->value[index] = value;
+        }
+    }
 
     return diff;
 }
@@ -9,30 +9,78 @@ typedef void (*progress_callback_t)(void *ptr, double current_diff);
 #include "lattice.h"
 #include "tuple.h"
 
+/**
+ * This structure represents a rectangular tile of the lattice. The
+ * tiles are small enough for their cells to stay in the cache during
+ * a sweep.
+ */
+struct tile {
+    /**
+     * These are the first cell and the cell following the last one
+     * along each axis.
+     */
+    struct point first;
+    struct point last;
+    /**
+     * This is the number of iterations applied to the tile.
+     */
+    uint32_t done;
+    /**
+     * This is set while the tile is queued or being updated.
+     */
+    int busy;
+};
+
+/**
+ * This structure contains the state shared by the workers, which are
+ * the threads of the pool updating tiles.
+ */
 struct worker {
-    uint8_t id;
-    uint8_t done;
-    struct worker* previous;
-    struct worker* next;
     struct lattice* lattice;
-    struct point pos;
-    uint32_t iterations;
+    struct config* conf;
+
+    /* the tiles, row after row */
+    struct tile* tiles;
+    struct point count;
 
-    struct config conf;
+    /* the tiles ready to be updated */
+    uint32_t* queue;
+    uint32_t head;
+    uint32_t size;
 
-    pthread_t thread;
-    pthread_spinlock_t lock, listLock;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
 
+    /* the result of the iterations still in progress */
+    double* diffs;
+    uint32_t* finished;
+    /* the number of iterations finished by all the tiles */
+    uint32_t iterations;
+    int running;
+
     progress_callback_t cb;
     void *cb_ptr;
 };
 
-struct worker*
-worker_new(struct worker* next, struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr);
-
-void worker_delete(struct worker* worker);
-void* work(void* ptr);
+/**
+ * This function computes the laplace equation with Gauss-Seidel
+ * iterations on the threads of the pool given in the configuration.
+ *
+ * The lattice is split into tiles that are updated as a wavefront. A
+ * tile starts an iteration as soon as the tiles on its left and below
+ * finished that iteration and the tiles on its right and above
+ * finished the previous one, so the tiles are updated in the same
+ * order as a sequential sweep and several iterations overlap. Any
+ * idle thread takes the next ready tile.
+ *
+ * @param lattice
+ *        This is a pointer to the lattice.
+ * @param conf
+ *        This is a pointer the configuration of the computation.
+ *
+ * @return The number of iterations, or COMPUTE_FAILED if the
+ *         computation failed.
+ */
+uint32_t worker_compute(struct lattice* lattice, struct config* conf, progress_callback_t cb, void *cb_ptr);
 
 #endif
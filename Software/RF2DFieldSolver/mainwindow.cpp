@@ -2,6 +2,8 @@
 #include "ui_mainwindow.h"
 
 #include <QScrollBar>
+#include <QDir>
+#include <QFileInfo>
 
 #include <QDebug>
 #include <QVector>
@@ -50,6 +52,47 @@ MainWindow::MainWindow(QWidget *parent)
     ui->threads->setValue(20);
 
     ui->borderIsGND->setChecked(true);
+    ui->nestedIteration->setChecked(true);
+    ui->warmStart->setChecked(true);
+    ui->airSolve->setChecked(true);
+    ui->useSymmetry->setChecked(true);
+
+    for(auto s : Laplace::getSolvers()) {
+        ui->solver->addItem(Laplace::SolverToString(s));
+    }
+    for(auto p : Laplace::getPreconditioners()) {
+        ui->preconditioner->addItem(Laplace::PreconditionerToString(p));
+    }
+    ui->preconditioner->setCurrentText(Laplace::PreconditionerToString(Laplace::Preconditioner::Multigrid));
+    for(auto e : Laplace::getExtractions()) {
+        ui->extraction->addItem(Laplace::ExtractionToString(e));
+    }
+    // the preconditioner is only used by the conjugate gradients, which also solve on triangles
+    auto updatePreconditioner = [=](){
+        ui->preconditioner->setEnabled(Laplace::SolverFromString(ui->solver->currentText()) == Laplace::Solver::ConjugateGradient
+                                       || ui->triangleMesh->isChecked());
+    };
+    connect(ui->solver, &QComboBox::currentTextChanged, this, updatePreconditioner);
+    connect(ui->triangleMesh, &QCheckBox::toggled, this, updatePreconditioner);
+    updatePreconditioner();
+    // the distance is only used by the gauss integration
+    auto updateGaussDistance = [=](){
+        ui->gaussDistance->setEnabled(Laplace::ExtractionFromString(ui->extraction->currentText()) != Laplace::Extraction::FieldEnergy);
+    };
+    connect(ui->extraction, &QComboBox::currentTextChanged, this, updateGaussDistance);
+    updateGaussDistance();
+    // only borders that are not grounded can be open
+    auto updateOpenBorders = [=](){
+        ui->openBorders->setEnabled(!ui->borderIsGND->isChecked());
+    };
+    connect(ui->borderIsGND, &QCheckBox::toggled, this, updateOpenBorders);
+    updateOpenBorders();
+    // only a graded mesh can be refined
+    auto updateAdaptiveMesh = [=](){
+        ui->adaptiveMesh->setEnabled(ui->gradedMesh->isChecked());
+    };
+    connect(ui->gradedMesh, &QCheckBox::toggled, this, updateAdaptiveMesh);
+    updateAdaptiveMesh();
 
     ui->xleft->setUnit("m");
     ui->xleft->setPrefixes("um ");
@@ -188,76 +231,40 @@ MainWindow::MainWindow(QWidget *parent)
     connect(&laplace, &Laplace::info, this, &MainWindow::info);
     connect(&laplace, &Laplace::warning, this, &MainWindow::warning);
     connect(&laplace, &Laplace::error, this, &MainWindow::error);
+    connect(&gauss, &Gauss::info, this, &MainWindow::info);
+    connect(&gauss, &Gauss::warning, this, &MainWindow::warning);
+    connect(&gauss, &Gauss::error, this, &MainWindow::error);
     connect(&laplace, &Laplace::calculationDone, this, [=](){
         // laplace is done
         disconnect(&laplace, &Laplace::percentage, this, nullptr);
         disconnect(ui->abort, nullptr, &laplace, nullptr);
 
         ui->view->update();
-        // start gauss calculation
-        info("Starting gauss integration for charge without dielectric");
-        double chargeSumP = 0, chargeSumN = 0;
-        for(auto e : list->getElements()) {
-            switch(e->getType()) {
-            case Element::Type::TracePos:
-                chargeSumP += Gauss::getCharge(&laplace, nullptr, e, ui->resolution->value(), ui->gaussDistance->value());
-                break;
-            case Element::Type::TraceNeg:
-                chargeSumN -= Gauss::getCharge(&laplace, nullptr, e, ui->resolution->value(), ui->gaussDistance->value());
-                break;
-            case Element::Type::GND:
-            case Element::Type::Dielectric:
-            case Element::Type::Last:
-                break;
-            }
+        auto extraction = Laplace::ExtractionFromString(ui->extraction->currentText());
+        bool useGauss = extraction != Laplace::Extraction::FieldEnergy;
+        auto results = laplace.getResults();
+        if(results.value("extraction", -1) == (int) extraction
+                && (!useGauss || results.value("gaussDistance", -1) == ui->gaussDistance->value())) {
+            // the charges of this solution have been extracted before
+            info("Using the cached results");
+            showResults(results["CairP"], results["CairN"], results["CdielectricP"], results["CdielectricN"]);
+            return;
         }
-        info("Air gauss calculation done");
-        auto CairP = chargeSumP * e0;
-        auto LP = 1.0 / (std::pow(2.998e8, 2.0) * CairP);
-        ui->inductanceP->setValue(LP);
-
-        auto CairN = chargeSumN * e0;
-        auto LN = 1.0 / (std::pow(2.998e8, 2.0) * CairN);
-        ui->inductanceN->setValue(LN);
-
-        // start gauss calculation
-        info("Starting gauss integration for charge with dielectric");
-        chargeSumP = 0, chargeSumN = 0;
-        for(auto e : list->getElements()) {
-            switch(e->getType()) {
-            case Element::Type::TracePos:
-                chargeSumP += Gauss::getCharge(&laplace, list, e, ui->resolution->value(), ui->gaussDistance->value());
-                break;
-            case Element::Type::TraceNeg:
-                chargeSumN -= Gauss::getCharge(&laplace, list, e, ui->resolution->value(), ui->gaussDistance->value());
-                break;
-            case Element::Type::GND:
-            case Element::Type::Dielectric:
-            case Element::Type::Last:
-                break;
-            }
+        if(!useGauss) {
+            finishExtraction(0, 0, 0, 0);
+            return;
         }
-        info("Dielectric gauss calculation done");
-        auto CdielectricP = chargeSumP * e0;
-        ui->capacitanceP->setValue(CdielectricP);
-
-        auto CdielectricN = chargeSumN * e0;
-        ui->capacitanceN->setValue(CdielectricN);
-
-        auto impedanceP = sqrt(ui->inductanceP->value() / CdielectricP);
-        ui->impedanceP->setValue(impedanceP);
-
-        auto impedanceN = sqrt(ui->inductanceN->value() / CdielectricN);
-        ui->impedanceN->setValue(impedanceN);
-
-        ui->impedanceDiff->setValue(ui->impedanceP->value() + ui->impedanceN->value());
-
-        // calculation complete
-        ui->progress->setValue(100);
-        ui->update->setEnabled(true);
-        ui->abort->setEnabled(false);
-        calculationStopped();
-        ui->view->update();
+        // integrate the charges on the gauss threads, the window stays responsive in the meantime
+        connect(ui->abort, &QPushButton::clicked, &gauss, &Gauss::abortCalculation);
+        gauss.setThreads(ui->threads->value());
+        if(!gauss.startCalculation(&laplace, list, ui->resolution->value(), ui->gaussDistance->value())) {
+            disconnect(ui->abort, nullptr, &gauss, nullptr);
+            calculationStopped();
+        }
+    });
+    connect(&gauss, &Gauss::calculationDone, this, [=](double airP, double airN, double dielectricP, double dielectricN){
+        disconnect(ui->abort, nullptr, &gauss, nullptr);
+        finishExtraction(airP, airN, dielectricP, dielectricN);
     });
 
     auto calculationAborted = [=](){
@@ -267,6 +274,10 @@ MainWindow::MainWindow(QWidget *parent)
     };
 
     connect(&laplace, &Laplace::calculationAborted, this, calculationAborted);
+    connect(&gauss, &Gauss::calculationAborted, this, [=](){
+        disconnect(ui->abort, nullptr, &gauss, nullptr);
+        calculationAborted();
+    });
 
     auto scenarios = Scenario::createAll();
     for(auto s : scenarios) {
@@ -315,6 +326,19 @@ nlohmann::json MainWindow::toJSON()
     j["tolerance"] = ui->tolerance->value();
     j["threads"] = ui->threads->value();
     j["borderIsGND"] = ui->borderIsGND->isChecked();
+    j["openBorders"] = ui->openBorders->isChecked();
+    j["solver"] = ui->solver->currentText().toStdString();
+    j["preconditioner"] = ui->preconditioner->currentText().toStdString();
+    j["nestedIteration"] = ui->nestedIteration->isChecked();
+    j["warmStart"] = ui->warmStart->isChecked();
+    j["diskCache"] = ui->diskCache->isChecked();
+    j["extraction"] = ui->extraction->currentText().toStdString();
+    j["airSolve"] = ui->airSolve->isChecked();
+    j["conductorMatrix"] = ui->conductorMatrix->isChecked();
+    j["useSymmetry"] = ui->useSymmetry->isChecked();
+    j["gradedMesh"] = ui->gradedMesh->isChecked();
+    j["adaptiveMesh"] = ui->adaptiveMesh->isChecked();
+    j["triangleMesh"] = ui->triangleMesh->isChecked();
     // store elements
     j["list"] = list->toJSON();
     return j;
@@ -339,6 +363,19 @@ void MainWindow::fromJSON(nlohmann::json j)
     ui->tolerance->setValue(j.value("tolerance", ui->tolerance->value()));
     ui->threads->setValue(j.value("threads", ui->threads->value()));
     ui->borderIsGND->setChecked(j.value("borderIsGND", ui->borderIsGND->isChecked()));
+    ui->openBorders->setChecked(j.value("openBorders", ui->openBorders->isChecked()));
+    ui->solver->setCurrentText(QString::fromStdString(j.value("solver", ui->solver->currentText().toStdString())));
+    ui->preconditioner->setCurrentText(QString::fromStdString(j.value("preconditioner", ui->preconditioner->currentText().toStdString())));
+    ui->nestedIteration->setChecked(j.value("nestedIteration", ui->nestedIteration->isChecked()));
+    ui->warmStart->setChecked(j.value("warmStart", ui->warmStart->isChecked()));
+    ui->diskCache->setChecked(j.value("diskCache", ui->diskCache->isChecked()));
+    ui->extraction->setCurrentText(QString::fromStdString(j.value("extraction", ui->extraction->currentText().toStdString())));
+    ui->airSolve->setChecked(j.value("airSolve", ui->airSolve->isChecked()));
+    ui->conductorMatrix->setChecked(j.value("conductorMatrix", ui->conductorMatrix->isChecked()));
+    ui->useSymmetry->setChecked(j.value("useSymmetry", ui->useSymmetry->isChecked()));
+    ui->gradedMesh->setChecked(j.value("gradedMesh", ui->gradedMesh->isChecked()));
+    ui->adaptiveMesh->setChecked(j.value("adaptiveMesh", ui->adaptiveMesh->isChecked()));
+    ui->triangleMesh->setChecked(j.value("triangleMesh", ui->triangleMesh->isChecked()));
     // load elements
     if(j.contains("list")) {
         list->fromJSON(j["list"]);
@@ -395,6 +432,19 @@ void MainWindow::startCalculation()
     ui->threads->setEnabled(false);
     ui->tolerance->setEnabled(false);
     ui->borderIsGND->setEnabled(false);
+    ui->openBorders->setEnabled(false);
+    ui->solver->setEnabled(false);
+    ui->preconditioner->setEnabled(false);
+    ui->nestedIteration->setEnabled(false);
+    ui->warmStart->setEnabled(false);
+    ui->diskCache->setEnabled(false);
+    ui->extraction->setEnabled(false);
+    ui->airSolve->setEnabled(false);
+    ui->conductorMatrix->setEnabled(false);
+    ui->useSymmetry->setEnabled(false);
+    ui->gradedMesh->setEnabled(false);
+    ui->adaptiveMesh->setEnabled(false);
+    ui->triangleMesh->setEnabled(false);
     ui->add->setEnabled(false);
     ui->remove->setEnabled(false);
 
@@ -501,6 +551,28 @@ void MainWindow::startCalculation()
     laplace.setThreads(ui->threads->value());
     laplace.setThreshold(ui->tolerance->value());
     laplace.setGroundedBorders(ui->borderIsGND->isChecked());
+    laplace.setOpenBorders(ui->openBorders->isChecked());
+    laplace.setSolver(Laplace::SolverFromString(ui->solver->currentText()));
+    laplace.setPreconditioner(Laplace::PreconditionerFromString(ui->preconditioner->currentText()));
+    laplace.setNestedIteration(ui->nestedIteration->isChecked());
+    laplace.setWarmStart(ui->warmStart->isChecked());
+    laplace.setAirSolve(ui->airSolve->isChecked());
+    laplace.setConductorMatrix(ui->conductorMatrix->isChecked());
+    laplace.setUseSymmetry(ui->useSymmetry->isChecked());
+    laplace.setGradedMesh(ui->gradedMesh->isChecked());
+    laplace.setAdaptiveMesh(ui->adaptiveMesh->isChecked());
+    laplace.setTriangleMesh(ui->triangleMesh->isChecked());
+    QString cacheDirectory;
+    if(ui->diskCache->isChecked()) {
+        if(getFilename().isEmpty()) {
+            warning("The disk cache is only used for saved projects");
+        } else {
+            // the solutions are stored next to the project file
+            QFileInfo project(getFilename());
+            cacheDirectory = project.absoluteDir().filePath(project.completeBaseName() + ".cache");
+        }
+    }
+    laplace.setCacheDirectory(cacheDirectory);
     laplace.startCalculation(list);
     ui->view->update();
 }
@@ -517,11 +589,195 @@ void MainWindow::calculationStopped()
     ui->ytop->setEnabled(true);
     ui->ybottom->setEnabled(true);
     ui->resolution->setEnabled(true);
-    ui->gaussDistance->setEnabled(true);
+    ui->gaussDistance->setEnabled(Laplace::ExtractionFromString(ui->extraction->currentText()) != Laplace::Extraction::FieldEnergy);
     ui->threads->setEnabled(true);
     ui->tolerance->setEnabled(true);
     ui->borderIsGND->setEnabled(true);
+    ui->openBorders->setEnabled(!ui->borderIsGND->isChecked());
+    ui->solver->setEnabled(true);
+    ui->preconditioner->setEnabled(Laplace::SolverFromString(ui->solver->currentText()) == Laplace::Solver::ConjugateGradient
+                                   || ui->triangleMesh->isChecked());
+    ui->nestedIteration->setEnabled(true);
+    ui->warmStart->setEnabled(true);
+    ui->diskCache->setEnabled(true);
+    ui->extraction->setEnabled(true);
+    ui->airSolve->setEnabled(true);
+    ui->conductorMatrix->setEnabled(true);
+    ui->useSymmetry->setEnabled(true);
+    ui->gradedMesh->setEnabled(true);
+    ui->adaptiveMesh->setEnabled(ui->gradedMesh->isChecked());
+    ui->triangleMesh->setEnabled(true);
     ui->add->setEnabled(true);
     ui->remove->setEnabled(true);
 }
 
+
+void MainWindow::finishExtraction(double airP, double airN, double dielectricP, double dielectricN)
+{
+    auto extraction = Laplace::ExtractionFromString(ui->extraction->currentText());
+    bool useGauss = extraction != Laplace::Extraction::FieldEnergy;
+    if(extraction != Laplace::Extraction::GaussIntegration) {
+        info("Starting charge calculation from field energy");
+        double energyAirP, energyAirN, energyP, energyN;
+        if(!laplace.getEnergyCharges(true, energyAirP, energyAirN)
+                || !laplace.getEnergyCharges(false, energyP, energyN)) {
+            error("Charge calculation from field energy failed");
+            calculationStopped();
+            return;
+        }
+        info("Field energy calculation done");
+        if(extraction == Laplace::Extraction::FieldEnergyChecked) {
+            // compare against the gauss integration
+            constexpr double maxDeviation = 0.02;
+            auto check = [=](QString name, double energy, double gauss) {
+                if(energy == 0 && gauss == 0) {
+                    return;
+                }
+                auto deviation = std::abs(energy - gauss) / std::max(std::abs(energy), std::abs(gauss));
+                auto message = name+" charge from field energy deviates by "+QString::number(deviation * 100, 'f', 2)+"% from gauss integration";
+                if(deviation > maxDeviation) {
+                    warning(message);
+                } else {
+                    info(message);
+                }
+            };
+            check("Air RF+", energyAirP, airP);
+            check("Air RF-", energyAirN, airN);
+            check("Dielectric RF+", energyP, dielectricP);
+            check("Dielectric RF-", energyN, dielectricN);
+        }
+        airP = energyAirP;
+        airN = energyAirN;
+        dielectricP = energyP;
+        dielectricN = energyN;
+    }
+    auto CairP = airP * e0;
+    auto CairN = airN * e0;
+    auto CdielectricP = dielectricP * e0;
+    auto CdielectricN = dielectricN * e0;
+
+    // keep the results along with the solution
+    QMap<QString, double> results;
+    results["extraction"] = (int) extraction;
+    if(useGauss) {
+        results["gaussDistance"] = ui->gaussDistance->value();
+    }
+    results["CairP"] = CairP;
+    results["CairN"] = CairN;
+    results["CdielectricP"] = CdielectricP;
+    results["CdielectricN"] = CdielectricN;
+    laplace.setResults(results);
+
+    showResults(CairP, CairN, CdielectricP, CdielectricN);
+}
+
+void MainWindow::showResults(double CairP, double CairN, double CdielectricP, double CdielectricN)
+{
+    auto LP = 1.0 / (std::pow(2.998e8, 2.0) * CairP);
+    ui->inductanceP->setValue(LP);
+
+    auto LN = 1.0 / (std::pow(2.998e8, 2.0) * CairN);
+    ui->inductanceN->setValue(LN);
+
+    ui->capacitanceP->setValue(CdielectricP);
+    ui->capacitanceN->setValue(CdielectricN);
+
+    auto impedanceP = sqrt(ui->inductanceP->value() / CdielectricP);
+    ui->impedanceP->setValue(impedanceP);
+
+    auto impedanceN = sqrt(ui->inductanceN->value() / CdielectricN);
+    ui->impedanceN->setValue(impedanceN);
+
+    ui->impedanceDiff->setValue(ui->impedanceP->value() + ui->impedanceN->value());
+
+    showConductorMatrix();
+
+    // calculation complete
+    ui->progress->setValue(100);
+    ui->update->setEnabled(true);
+    ui->abort->setEnabled(false);
+    calculationStopped();
+    ui->view->update();
+}
+
+void MainWindow::showConductorMatrix()
+{
+    auto names = laplace.getConductorNames();
+    auto C = laplace.getCapacitanceMatrix(false);
+    auto Cair = laplace.getCapacitanceMatrix(true);
+    int n = names.size();
+    if(n == 0 || C.size() != n * n || Cair.size() != n * n) {
+        return;
+    }
+    for(auto &c : C) {
+        c *= e0;
+    }
+    for(auto &c : Cair) {
+        c *= e0;
+    }
+
+    // L = mu0 * e0 * Cair^-1, inverted by Gauss-Jordan elimination with partial pivoting
+    QVector<double> L(n * n, 0);
+    for(int i=0;i<n;i++) {
+        L[i * n + i] = 1.0 / std::pow(2.998e8, 2.0);
+    }
+    auto A = Cair;
+    for(int col=0;col<n;col++) {
+        int pivot = col;
+        for(int row=col+1;row<n;row++) {
+            if(std::abs(A[row * n + col]) > std::abs(A[pivot * n + col])) {
+                pivot = row;
+            }
+        }
+        if(A[pivot * n + col] == 0) {
+            warning("The air capacitance matrix is singular, a trace might not cover any cell");
+            return;
+        }
+        for(int k=0;k<n;k++) {
+            std::swap(A[col * n + k], A[pivot * n + k]);
+            std::swap(L[col * n + k], L[pivot * n + k]);
+        }
+        auto scale = 1.0 / A[col * n + col];
+        for(int k=0;k<n;k++) {
+            A[col * n + k] *= scale;
+            L[col * n + k] *= scale;
+        }
+        for(int row=0;row<n;row++) {
+            auto factor = A[row * n + col];
+            if(row == col || factor == 0) {
+                continue;
+            }
+            for(int k=0;k<n;k++) {
+                A[row * n + k] -= factor * A[col * n + k];
+                L[row * n + k] -= factor * L[col * n + k];
+            }
+        }
+    }
+
+    auto showMatrix = [=](QString title, const QVector<double> &m, double unit) {
+        info(title);
+        for(int i=0;i<n;i++) {
+            QString row = names[i]+":";
+            for(int k=0;k<n;k++) {
+                row += " " + QString::number(m[i * n + k] / unit, 'g', 5);
+            }
+            info(row);
+        }
+    };
+    showMatrix("Capacitance matrix in pF/m:", C, 1e-12);
+    showMatrix("Inductance matrix in nH/m:", L, 1e-9);
+
+    // modal impedances of each pair, exact for symmetric pairs
+    for(int i=0;i<n;i++) {
+        for(int k=i+1;k<n;k++) {
+            auto Cs = (C[i * n + i] + C[k * n + k]) / 2;
+            auto Ls = (L[i * n + i] + L[k * n + k]) / 2;
+            auto Cm = C[i * n + k];
+            auto Lm = L[i * n + k];
+            auto Zeven = sqrt((Ls + Lm) / (Cs + Cm));
+            auto Zodd = sqrt((Ls - Lm) / (Cs - Cm));
+            info(names[i]+"/"+names[k]+": Zeven = "+QString::number(Zeven, 'f', 2)+" Ohm, Zodd = "+QString::number(Zodd, 'f', 2)
+                 +" Ohm, Zdiff = "+QString::number(2 * Zodd, 'f', 2)+" Ohm");
+        }
+    }
+}
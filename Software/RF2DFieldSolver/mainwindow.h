@@ -32,6 +32,11 @@ private:
     static constexpr double e0 = 8.8541878188e-12;
     void startCalculation();
     void calculationStopped();
+    // continues once the charges were integrated, which are ignored if only the field energy is used
+    void finishExtraction(double airP, double airN, double dielectricP, double dielectricN);
+    void showResults(double CairP, double CairN, double CdielectricP, double CdielectricN);
+    // logs the capacitance and inductance matrices of all traces and the modal impedances of each pair
+    void showConductorMatrix();
     Ui::MainWindow *ui;
     ElementList *list;
     Laplace laplace;
@@ -31,6 +31,7 @@ bool Savable::openFromFileDialog(QString title, QString filetype)
     }
     file.close();
     fromJSON(j);
+    this->filename = filename;
     return true;
 }
 
@@ -50,5 +51,6 @@ bool Savable::saveToFileDialog(QString title, QString filetype, QString ending)
     file.open(filename.toStdString());
     file << setw(4) << toJSON() << endl;
     file.close();
+    this->filename = filename;
     return true;
 }
@@ -20,6 +20,8 @@ public:
 
     bool openFromFileDialog(QString title, QString filetype);
     bool saveToFileDialog(QString title, QString filetype, QString ending = "");
+    // the file last opened or saved, empty if there is none
+    QString getFilename() {return filename;}
 
     class SettingDescription {
     public:
@@ -93,6 +95,9 @@ public:
         }
         return j;
     }
+
+private:
+    QString filename;
 };
 
 #endif // SAVABLE_H